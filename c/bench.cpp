@@ -0,0 +1,285 @@
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "sdbuf.h"
+#include "sdb_json.h"
+
+// Not a test; timings for things that are meant to be fast. Build it
+// with bench.sh, which turns the optimizer on and the sanitizer off.
+// With --json, results come out as one JSON object per line, for
+// comparing one release with the next.
+
+#define BUF_SIZE (1 << 17)
+
+static volatile uint64_t sink;
+static bool json = false;
+
+// run f over and over until it has taken long enough to trust, and
+// return how long each of its ops took
+template <typename F>
+static double ns_per_op(size_t ops, F f) {
+    size_t reps = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    auto t1 = t0;
+    do {
+        f();
+        reps++;
+        t1 = std::chrono::steady_clock::now();
+    } while (t1 - t0 < std::chrono::milliseconds(50));
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / (reps * ops);
+}
+
+struct shape_t {
+    int fields;
+    int array;  // elements in each array field, or 1 for scalars
+    int blob;   // size of every fourth field as a blob, or 0 for none
+};
+
+static void report(const char *bench, const shape_t &sh, sdb_tlen_t size, double ns) {
+    if (json) {
+        printf("{\"bench\": \"%s\", \"fields\": %d, \"array\": %d, \"blob\": %d, "
+               "\"size\": %u, \"ns_per_op\": %.1f}\n",
+               bench, sh.fields, sh.array, sh.blob, (unsigned)size, ns);
+    } else {
+        printf("%-16s %6d %6d %6d %8u %12.1f\n",
+               bench, sh.fields, sh.array, sh.blob, (unsigned)size, ns);
+    }
+}
+
+static bool is_blob(const shape_t &sh, int i) {
+    return sh.blob && (i % 4 == 3);
+}
+
+// field i gets id i
+static void build(sdb_t *sdb, const shape_t &sh, const std::vector<uint32_t> &vals, const uint8_t *blob) {
+    for (int i=0; i<sh.fields; i++) {
+        if (is_blob(sh, i)) {
+            sdb_add_blob(sdb, i, blob, sh.blob);
+        } else if (sh.array > 1) {
+            sdb_set_vala(sdb, i, SDB_U32, sh.array, &vals[i * sh.array]);
+        } else {
+            sdb_set_vala(sdb, i, SDB_U32, 1, &vals[i]);
+        }
+    }
+}
+
+void bench_shape(const shape_t &sh) {
+    std::mt19937 rng(sh.fields * 131 + sh.array * 7 + sh.blob);
+    std::vector<uint32_t> vals(sh.fields * sh.array);
+    for (auto &v: vals) v = rng();
+    std::vector<uint8_t> blob(sh.blob, 0xa5);
+    std::vector<uint8_t> buf(BUF_SIZE);
+    std::vector<uint8_t> work(BUF_SIZE);
+    std::vector<uint8_t> out(BUF_SIZE);
+
+    // the baseline is the same data as a packed struct: one copy in and
+    // one copy out
+    size_t packed = 0;
+    for (int i=0; i<sh.fields; i++) {
+        packed += is_blob(sh, i) ? sh.blob : 4 * sh.array;
+    }
+
+    sdb_t sdb;
+    sdb_init(&sdb, buf.data(), BUF_SIZE, true);
+    build(&sdb, sh, vals, blob.data());
+    sdb_tlen_t size = sdb_size(&sdb);
+
+    report("packed_struct", sh, packed, ns_per_op(1, [&] {
+        memcpy(work.data(), buf.data(), packed);
+        memcpy(out.data(), work.data(), packed);
+        sink = out[packed / 2];
+    }));
+
+    report("encode", sh, size, ns_per_op(1, [&] {
+        sdb_t w;
+        sdb_init(&w, work.data(), size, true);
+        build(&w, sh, vals, blob.data());
+        sink = w.vals_size;
+    }));
+
+    report("decode", sh, size, ns_per_op(1, [&] {
+        sdb_t r;
+        sdb_init(&r, buf.data(), size, false);
+        uint64_t acc = 0;
+        for (int i=0; i<sh.fields; i++) {
+            auto mi = sdb_find(&r, i);
+            acc += sdb_get(&mi, out.data());
+        }
+        sink = acc;
+    }));
+
+    std::vector<char> text(4 * BUF_SIZE);
+    report("to_json", sh, size, ns_per_op(1, [&] {
+        size_t n = 0;
+        sdb_to_json(&sdb, text.data(), text.size(), &n, 0);
+        sink = n;
+    }));
+
+    report("hash", sh, size, ns_per_op(1, [&] {
+        sink = sdb_hash(&sdb);
+    }));
+
+    // against the copy that encode left in work
+    sdb_t copy;
+    sdb_init(&copy, work.data(), size, false);
+    report("equal", sh, size, ns_per_op(1, [&] {
+        sink = sdb_equal(&sdb, &copy);
+    }));
+
+    const size_t nids = 1024;
+    std::vector<sdb_id_t> ids(nids);
+    for (auto &id: ids) {
+        do {
+            id = rng() % sh.fields;
+        } while (is_blob(sh, id));
+    }
+
+    report("find", sh, size, ns_per_op(nids, [&] {
+        uint64_t acc = 0;
+        for (auto id: ids) acc += sdb_find(&sdb, id).elemcount;
+        sink = acc;
+    }));
+
+    report("get", sh, size, ns_per_op(nids, [&] {
+        uint64_t acc = 0;
+        for (auto id: ids) {
+            auto mi = sdb_find(&sdb, id);
+            sdb_get(&mi, out.data());
+            acc += out[0];
+        }
+        sink = acc;
+    }));
+
+    // each set replaces a field of the same size, moving it to the end
+    memcpy(work.data(), buf.data(), size);
+    sdb_t w;
+    sdb_init(&w, work.data(), BUF_SIZE, false);
+    report("set", sh, size, ns_per_op(nids, [&] {
+        for (auto id: ids) sdb_set_vala(&w, id, SDB_U32, sh.array, &vals[id * sh.array]);
+    }));
+
+    report("remove_and_set", sh, size, ns_per_op(nids, [&] {
+        for (auto id: ids) {
+            sdb_remove(&w, id);
+            sdb_set_vala(&w, id, SDB_U32, sh.array, &vals[id * sh.array]);
+        }
+    }));
+}
+
+void bench_nested(const shape_t &sh) {
+    // eight children of the given shape, built in place and read by path
+    std::vector<uint32_t> vals(sh.fields * sh.array, 7);
+    std::vector<uint8_t> blob(sh.blob, 0x5a);
+    std::vector<uint8_t> buf(BUF_SIZE * 8);
+    sdb_t sdb;
+    sdb_tlen_t len = buf.size();
+    auto encode = [&] {
+        sdb_init(&sdb, buf.data(), len, true);
+        for (sdb_id_t c=0; c<8; c++) {
+            sdb_t child;
+            sdb_begin_nested(&sdb, 0x100 + c, &child);
+            build(&child, sh, vals, blob.data());
+            sdb_end_nested(&sdb, &child);
+        }
+    };
+    // then again with just enough room, so as not to time the clearing
+    encode();
+    len = sdb_size(&sdb);
+    report("nested_encode", sh, sdb_size(&sdb), ns_per_op(1, encode));
+
+    sdb_id_t path[2] = { 0x100, 0 };
+    report("nested_get", sh, sdb_size(&sdb), ns_per_op(8 * 8, [&] {
+        uint64_t acc = 0;
+        for (sdb_id_t c=0; c<8; c++) {
+            path[0] = 0x100 + c;
+            for (sdb_id_t i=0; i<8; i++) {
+                path[1] = (i * 5) % sh.fields;
+                acc += sdb_find_path(&sdb, path, 2).elemcount;
+            }
+        }
+        sink = acc;
+    }));
+}
+
+void bench_filter() {
+    // lookups of optional fields that are mostly absent
+    const shape_t sh = { 64, 1, 0 };
+    const size_t nlookups = 1 << 12;
+    std::mt19937 rng(1);
+
+    std::vector<uint8_t> buf(BUF_SIZE);
+    sdb_t sdb;
+    sdb_init(&sdb, buf.data(), BUF_SIZE, true);
+    std::vector<sdb_id_t> present;
+    for (int i=0; i<sh.fields; i++) {
+        sdb_id_t id = 2 * i;
+        sdb_set_unsigned(&sdb, id, rng());
+        present.push_back(id);
+    }
+
+    for (int miss_pct: { 0, 50, 90 }) {
+        std::vector<sdb_id_t> ids(nlookups);
+        for (auto &id: ids) {
+            bool miss = (int)(rng() % 100) < miss_pct;
+            id = miss ? 2 * (rng() % 1000) + 1 : present[rng() % present.size()];
+        }
+        for (int filtered=0; filtered<2; filtered++) {
+            sdb_t r;
+            sdb_init(&r, buf.data(), BUF_SIZE, false);
+            if (filtered) sdb_build_filter(&r);
+            char name[32];
+            snprintf(name, sizeof(name), "%s_miss_%d", filtered ? "filtered" : "scan", miss_pct);
+            report(name, sh, sdb_size(&r), ns_per_op(nlookups, [&] {
+                uint64_t acc = 0;
+                for (auto id: ids) acc += sdb_get_unsigned(&r, id, NULL);
+                sink = acc;
+            }));
+        }
+    }
+}
+
+// doubles take the long way round in to_json, unless they're whole
+void bench_json_doubles() {
+    std::mt19937 rng(5);
+    std::vector<uint8_t> buf(BUF_SIZE);
+    sdb_t sdb;
+    sdb_init(&sdb, buf.data(), BUF_SIZE, true);
+    const shape_t sh = { 64, 1, 0 };
+    for (int i=0; i<sh.fields; i++) {
+        double d = (double)(rng() % 2000000) / 1000.0 - 1000.0;
+        sdb_set_val(&sdb, i, SDB_DOUBLE, &d);
+    }
+    std::vector<char> text(BUF_SIZE);
+    report("to_json_doubles", sh, sdb_size(&sdb), ns_per_op(1, [&] {
+        size_t n = 0;
+        sdb_to_json(&sdb, text.data(), text.size(), &n, 0);
+        sink = n;
+    }));
+}
+
+int main(int argc, char *argv[]) {
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--json")) json = true;
+    }
+    if (!json) {
+        printf("%-16s %6s %6s %6s %8s %12s\n", "bench", "fields", "array", "blob", "size", "ns/op");
+    }
+
+    for (int fields: { 8, 64, 512 }) {
+        for (int array: { 1, 16 }) {
+            for (int blob: { 0, 256 }) {
+                bench_shape({ fields, array, blob });
+            }
+        }
+    }
+    for (int fields: { 8, 64 }) {
+        bench_nested({ fields, 1, 0 });
+    }
+    bench_filter();
+    bench_json_doubles();
+    return 0;
+}
@@ -0,0 +1,16 @@
+rm -f bench bench_snap bench_ring bench_columns
+
+CFLAGS="-O2 -DNDEBUG"
+clang $CFLAGS -c sdbuf.c -o sdbuf_bench.o
+clang $CFLAGS -c sdb_snap.c -o sdb_snap_bench.o
+clang $CFLAGS -c sdb_ring.c -o sdb_ring_bench.o
+clang $CFLAGS -c sdb_columns.c -o sdb_columns_bench.o
+clang $CFLAGS -c sdb_json.c -o sdb_json_bench.o
+clang++ $CFLAGS -std=c++11 bench.cpp sdbuf_bench.o sdb_json_bench.o -o bench
+clang++ $CFLAGS -std=c++11 -pthread bench_snap.cpp sdbuf_bench.o sdb_snap_bench.o -o bench_snap
+clang++ $CFLAGS -std=c++11 bench_ring.cpp sdbuf_bench.o sdb_ring_bench.o -o bench_ring
+clang++ $CFLAGS -std=c++11 -pthread bench_columns.cpp sdbuf_bench.o sdb_columns_bench.o -o bench_columns
+./bench "$@"
+./bench_snap "$@"
+./bench_ring "$@"
+./bench_columns "$@"
@@ -0,0 +1,96 @@
+#include <chrono>
+#include <initializer_list>
+#include <random>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "sdbuf.h"
+#include "sdb_columns.h"
+
+// Not a test; how long sdb_project takes to pull four columns out of a
+// million messages, from 1 to 32 threads, against sdb_init and
+// sdb_get_unsigned on each message in turn. Build it with bench.sh.
+// With --json, results come out as one JSON object per line.
+
+#define NMSGS   (1000000)
+#define NFIELDS (32)
+
+static volatile uint64_t sink;
+static bool json = false;
+
+static void report(const char *bench, unsigned threads, double secs, double base) {
+    if (json) {
+        printf("{\"bench\": \"%s\", \"threads\": %u, \"msgs\": %d, \"msgs_per_sec\": %.0f, "
+               "\"speedup\": %.2f}\n",
+               bench, threads, NMSGS, NMSGS / secs, base / secs);
+    } else {
+        printf("%-10s %7u %14.0f %8.2f\n", bench, threads, NMSGS / secs, base / secs);
+    }
+}
+
+template <typename F>
+static double best_of_3(F f) {
+    double best = 1e30;
+    for (int i=0; i<3; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (secs < best) best = secs;
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--json")) json = true;
+    }
+    if (!json) {
+        printf("%-10s %7s %14s %8s\n", "bench", "threads", "msgs/s", "speedup");
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> log;
+    for (size_t i=0; i<NMSGS; i++) {
+        uint8_t buf[512];
+        sdb_t sdb;
+        sdb_init(&sdb, buf, sizeof(buf), true);
+        for (sdb_id_t id=0; id<NFIELDS; id++) {
+            if (rng() % 8) sdb_set_unsigned(&sdb, id, rng() >> (rng() % 32));
+        }
+        log.insert(log.end(), buf, buf + sdb_size(&sdb));
+    }
+    std::vector<const uint8_t *> msgs(NMSGS);
+    std::vector<sdb_tlen_t> lens(NMSGS);
+    sdb_index_log(log.data(), log.size(), msgs.data(), lens.data(), NMSGS);
+
+    const sdb_id_t ids[4] = { 3, 11, 17, 29 };
+    std::vector<std::vector<uint64_t>> values(4, std::vector<uint64_t>(NMSGS));
+    std::vector<std::vector<uint8_t>> present(4, std::vector<uint8_t>((NMSGS + 7) / 8));
+
+    double base = best_of_3([&] {
+        for (size_t i=0; i<NMSGS; i++) {
+            sdb_t sdb;
+            sdb_init(&sdb, (void *)msgs[i], lens[i], false);
+            for (int c=0; c<4; c++) {
+                int8_t err = 0;
+                values[c][i] = sdb_get_unsigned(&sdb, ids[c], &err);
+                if (err) present[c][i / 8] &= ~(1 << (i % 8));
+                else     present[c][i / 8] |= 1 << (i % 8);
+            }
+        }
+        sink = values[0][NMSGS / 2];
+    });
+    report("loop", 1, base, base);
+
+    sdb_column_t cols[4];
+    for (int c=0; c<4; c++) cols[c] = { ids[c], SDB_U64, values[c].data(), present[c].data() };
+    for (unsigned threads: { 1, 2, 4, 8, 16, 32 }) {
+        report("project", threads, best_of_3([&] {
+            sdb_project(msgs.data(), lens.data(), NMSGS, cols, 4, threads);
+            sink = values[0][NMSGS / 2];
+        }), base);
+    }
+    return 0;
+}
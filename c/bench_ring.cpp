@@ -0,0 +1,190 @@
+#include <chrono>
+#include <initializer_list>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sdbuf.h"
+#include "sdb_ring.h"
+
+// Not a test; messages from one process to another through sdb_ring and
+// through a Unix socket, for comparison. "stream" sends as many as it
+// can one way, and "pingpong" waits for each to be answered. Build it
+// with bench.sh. With --json, results come out as one JSON object per
+// line.
+
+#define NFIELDS   (16)
+#define SLOT_SIZE (256)
+#define NSLOTS    (256)
+
+static bool json = false;
+
+static void report(const char *bench, const char *via, int batch, uint64_t n, double secs) {
+    if (json) {
+        printf("{\"bench\": \"%s\", \"via\": \"%s\", \"batch\": %d, \"msgs\": %llu, "
+               "\"msgs_per_sec\": %.0f, \"ns_per_msg\": %.1f}\n",
+               bench, via, batch, (unsigned long long)n, n / secs, secs * 1e9 / n);
+    } else {
+        printf("%-10s %-8s %6d %10llu %14.0f %12.1f\n",
+               bench, via, batch, (unsigned long long)n, n / secs, secs * 1e9 / n);
+    }
+}
+
+static void fill(sdb_t *msg, uint64_t seq) {
+    for (sdb_id_t id=0; id<NFIELDS; id++) sdb_set_unsigned(msg, id, (uint32_t)(seq + id));
+}
+
+static uint64_t sum(const sdb_t *msg) {
+    uint64_t acc = 0;
+    for (sdb_id_t id=0; id<NFIELDS; id++) acc += sdb_get_unsigned(msg, id, NULL);
+    return acc;
+}
+
+// runs child in another process, parent in this one, and times them both
+template <typename P, typename C>
+static double two_processes(P parent, C child) {
+    auto t0 = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        child();
+        _exit(0);
+    }
+    parent();
+    waitpid(pid, NULL, 0);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void ring_send(sdb_ring_t *ring, uint64_t seq, int batch, bool last) {
+    sdb_t msg;
+    while (sdb_ring_claim(ring, &msg) == -SDB_BUSY) {
+        sdb_ring_publish(ring);
+        sched_yield();
+    }
+    fill(&msg, seq);
+    sdb_ring_commit(ring);
+    if (last || ((seq + 1) % batch == 0)) sdb_ring_publish(ring);
+}
+
+static uint64_t ring_recv(sdb_ring_t *ring, uint64_t seq, int batch) {
+    sdb_t msg;
+    while (sdb_ring_peek(ring, &msg) == -SDB_NOT_FOUND) {
+        sdb_ring_release(ring);
+        sdb_ring_wait(ring, -1);
+    }
+    uint64_t acc = sum(&msg);
+    sdb_ring_consume(ring);
+    if ((seq + 1) % batch == 0) sdb_ring_release(ring);
+    return acc;
+}
+
+static void bench_ring_stream(uint64_t n, int batch) {
+    sdb_ring_t ring;
+    sdb_ring_create(&ring, NSLOTS, SLOT_SIZE, true);
+    double secs = two_processes(
+        [&] { for (uint64_t i=0; i<n; i++) ring_send(&ring, i, batch, i == n - 1); },
+        [&] {
+            uint64_t acc = 0;
+            for (uint64_t i=0; i<n; i++) acc += ring_recv(&ring, i, batch);
+            if (acc == 1) printf("\n");
+        });
+    sdb_ring_close(&ring);
+    report("stream", "ring", batch, n, secs);
+}
+
+static void bench_socket_stream(uint64_t n) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+    double secs = two_processes(
+        [&] {
+            uint8_t buf[SLOT_SIZE];
+            for (uint64_t i=0; i<n; i++) {
+                sdb_t msg;
+                sdb_init(&msg, buf, sizeof(buf), true);
+                fill(&msg, i);
+                if (write(fds[0], buf, sdb_size(&msg)) < 0) break;
+            }
+        },
+        [&] {
+            uint8_t buf[SLOT_SIZE];
+            uint64_t acc = 0;
+            for (uint64_t i=0; i<n; i++) {
+                if (read(fds[1], buf, sizeof(buf)) <= 0) break;
+                sdb_t msg;
+                sdb_init(&msg, buf, sizeof(buf), false);
+                acc += sum(&msg);
+            }
+            if (acc == 1) printf("\n");
+        });
+    close(fds[0]);
+    close(fds[1]);
+    report("stream", "socket", 1, n, secs);
+}
+
+static void bench_ring_pingpong(uint64_t n) {
+    sdb_ring_t there, back;
+    sdb_ring_create(&there, NSLOTS, SLOT_SIZE, true);
+    sdb_ring_create(&back, NSLOTS, SLOT_SIZE, true);
+    double secs = two_processes(
+        [&] {
+            for (uint64_t i=0; i<n; i++) {
+                ring_send(&there, i, 1, true);
+                ring_recv(&back, i, 1);
+            }
+        },
+        [&] {
+            for (uint64_t i=0; i<n; i++) {
+                ring_recv(&there, i, 1);
+                ring_send(&back, i, 1, true);
+            }
+        });
+    sdb_ring_close(&there);
+    sdb_ring_close(&back);
+    report("pingpong", "ring", 1, n, secs);
+}
+
+static void bench_socket_pingpong(uint64_t n) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+    auto echo = [&](int fd, bool first) {
+        uint8_t buf[SLOT_SIZE];
+        for (uint64_t i=0; i<n; i++) {
+            sdb_t msg;
+            if (!first) {
+                if (read(fd, buf, sizeof(buf)) <= 0) break;
+                sdb_init(&msg, buf, sizeof(buf), false);
+                sum(&msg);
+            }
+            sdb_init(&msg, buf, sizeof(buf), true);
+            fill(&msg, i);
+            if (write(fd, buf, sdb_size(&msg)) < 0) break;
+            if (first) {
+                if (read(fd, buf, sizeof(buf)) <= 0) break;
+                sdb_init(&msg, buf, sizeof(buf), false);
+                sum(&msg);
+            }
+        }
+    };
+    double secs = two_processes([&] { echo(fds[0], true); }, [&] { echo(fds[1], false); });
+    close(fds[0]);
+    close(fds[1]);
+    report("pingpong", "socket", 1, n, secs);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--json")) json = true;
+    }
+    if (!json) {
+        printf("%-10s %-8s %6s %10s %14s %12s\n", "bench", "via", "batch", "msgs", "msgs/s", "ns/msg");
+    }
+    const uint64_t n = 1000000;
+    bench_socket_stream(n);
+    for (int batch: { 1, 16, 64 }) bench_ring_stream(n, batch);
+    bench_socket_pingpong(n / 10);
+    bench_ring_pingpong(n / 10);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "sdbuf.h"
+#include "sdb_snap.h"
+
+// Not a test; how reads scale with the number of reader threads while
+// one writer keeps changing the message, with sdb_snap and with one
+// mutex around a single buffer, for comparison. Build it with bench.sh.
+// With --json, results come out as one JSON object per line.
+
+#define BUF_SIZE (1 << 12)
+#define NFIELDS  (64)
+#define NREAD    (8)   // fields read each time a reader takes a look
+
+static volatile uint64_t sink;
+static bool json = false;
+
+struct result_t {
+    uint64_t reads;
+    uint64_t writes;
+    double   secs;
+};
+
+static void report(const char *bench, int readers, const result_t &r) {
+    double reads_per_sec = r.reads / r.secs;
+    double writes_per_sec = r.writes / r.secs;
+    if (json) {
+        printf("{\"bench\": \"%s\", \"readers\": %d, \"reads_per_sec\": %.0f, "
+               "\"reads_per_sec_per_reader\": %.0f, \"writes_per_sec\": %.0f}\n",
+               bench, readers, reads_per_sec, reads_per_sec / readers, writes_per_sec);
+    } else {
+        printf("%-8s %7d %14.0f %14.0f %14.0f\n",
+               bench, readers, reads_per_sec, reads_per_sec / readers, writes_per_sec);
+    }
+}
+
+static void fill(sdb_t *sdb, uint32_t gen) {
+    for (sdb_id_t id=0; id<NFIELDS; id++) sdb_set_unsigned(sdb, id, gen + id);
+}
+
+// each reader reads NREAD fields under one lock or snapshot, and the
+// writer changes them all, as fast as each can, for a while
+template <typename R, typename W>
+static result_t run(int readers, R read, W write) {
+    std::atomic<bool> go(false), stop(false);
+    std::vector<uint64_t> counts(readers * 8);  // a cache line apart
+    std::vector<std::thread> threads;
+    for (int i=0; i<readers; i++) {
+        threads.emplace_back([&, i] {
+            while (!go) std::this_thread::yield();
+            uint64_t n = 0;
+            uint64_t acc = 0;
+            while (!stop) {
+                acc += read(i + n);
+                n++;
+            }
+            counts[i * 8] = n;
+            sink = acc;
+        });
+    }
+    uint64_t writes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    auto t1 = t0;
+    go = true;
+    do {
+        write(writes++);
+        t1 = std::chrono::steady_clock::now();
+    } while (t1 - t0 < std::chrono::milliseconds(200));
+    stop = true;
+    result_t r = { 0, writes, std::chrono::duration<double>(t1 - t0).count() };
+    for (int i=0; i<readers; i++) {
+        threads[i].join();
+        r.reads += counts[i * 8];
+    }
+    return r;
+}
+
+static uint64_t read_some(const sdb_t *sdb, uint64_t start) {
+    uint64_t acc = 0;
+    for (int i=0; i<NREAD; i++) acc += sdb_get_unsigned(sdb, (start + i * 7) % NFIELDS, NULL);
+    return acc;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--json")) json = true;
+    }
+    if (!json) {
+        printf("%-8s %7s %14s %14s %14s\n", "bench", "readers", "reads/s", "reads/s/reader", "writes/s");
+    }
+
+    for (int readers: { 1, 2, 4, 8, 16, 32, 64 }) {
+        std::vector<uint8_t> buf(BUF_SIZE);
+        sdb_t sdb;
+        sdb_init(&sdb, buf.data(), BUF_SIZE, true);
+        fill(&sdb, 0);
+        std::mutex m;
+        report("mutex", readers, run(readers,
+            [&](uint64_t start) {
+                std::lock_guard<std::mutex> lock(m);
+                return read_some(&sdb, start);
+            },
+            [&](uint64_t gen) {
+                std::lock_guard<std::mutex> lock(m);
+                // a remove moves everything after it while readers wait
+                sdb_remove(&sdb, gen % NFIELDS);
+                fill(&sdb, gen);
+            }));
+
+        std::vector<uint8_t> bufs(3 * BUF_SIZE);
+        sdb_snap_t snap;
+        sdb_snap_init(&snap, bufs.data(), BUF_SIZE, 3);
+        report("snap", readers, run(readers,
+            [&](uint64_t start) {
+                sdb_t view;
+                sdb_snap_acquire(&snap, &view);
+                uint64_t acc = read_some(&view, start);
+                sdb_snap_release(&snap, &view);
+                return acc;
+            },
+            [&](uint64_t gen) {
+                sdb_t draft;
+                if (sdb_snap_begin(&snap, &draft)) return;
+                sdb_remove(&draft, gen % NFIELDS);
+                fill(&draft, gen);
+                sdb_snap_publish(&snap, &draft);
+            }));
+    }
+    return 0;
+}
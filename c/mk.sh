@@ -1,4 +1,4 @@
-rm -f *.o test1 test2
+rm -f *.o test1 test2 test3 test4 test5 test6 test1_stats sdbtool
 
 CFLAGS="-g -Og -Wall -fsanitize=memory -fno-omit-frame-pointer"
 LDFLAGS="--stdlib=libc++ -rdynamic"
@@ -11,3 +11,43 @@ clang++ $CFLAGS -std=c++11 -stdlib=libc++ -c test_example_2.cpp -o test_example_
 clang++ $CFLAGS -std=c++11 -stdlib=libc++ sdbuf.o test_example_2.o -o test2
 ./test2
 
+clang $CFLAGS -c sdb_snap.c -o sdb_snap.o
+clang++ $CFLAGS -std=c++11 -stdlib=libc++ -pthread sdbuf.o sdb_snap.o test_example_3.cpp -o test3
+./test3
+
+clang $CFLAGS -c sdb_ring.c -o sdb_ring.o
+clang++ $CFLAGS -std=c++11 -stdlib=libc++ sdbuf.o sdb_ring.o test_example_4.cpp -o test4
+./test4
+
+clang $CFLAGS -c sdb_columns.c -o sdb_columns.o
+clang++ $CFLAGS -std=c++11 -stdlib=libc++ -pthread sdbuf.o sdb_columns.o test_example_5.cpp -o test5
+./test5
+
+clang $CFLAGS -c sdb_json.c -o sdb_json.o
+clang++ $CFLAGS -std=c++11 -stdlib=libc++ sdbuf.o sdb_json.o test_example_6.cpp -o test6
+./test6
+
+clang $CFLAGS -pthread sdbtool.c sdbuf.c sdb_columns.c sdb_json.c -lm -o sdbtool
+# what test1 wrote, to JSON and back, comes out the same
+# in separate steps, so that a crash or an empty result is a failure
+failed=""
+[ -x sdbtool ] || failed=" (not built)"
+[ -n "$(ls t*.dat 2>/dev/null)" ] || failed="$failed (no t*.dat)"
+for f in t*.dat; do
+    [ -f "$f" ] || continue
+    if ./sdbtool convert $f > $f.json && [ -s $f.json ] &&
+       ./sdbtool convert --from-json $f.json > $f.back &&
+       ./sdbtool convert $f.back > $f.json2 &&
+       cmp -s $f.json $f.json2; then
+        :
+    else
+        failed="$failed $f"
+    fi
+    rm -f $f.json $f.back $f.json2
+done
+if [ -n "$failed" ]; then echo "FAIL.  (sdbtool)$failed"; else echo "PASS!  (sdbtool) Yay!"; fi
+
+# again with the statistics built in
+clang $CFLAGS -DSDB_INCL_STATS=1 -c sdbuf.c -o sdbuf_stats.o
+clang++ $CFLAGS -DSDB_INCL_STATS=1 -std=c++11 -stdlib=libc++ sdbuf_stats.o test_example_1.cpp -o test1_stats
+./test1_stats
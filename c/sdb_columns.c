@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "sdb_columns.h"
+
+// Messages go out in chunks. Each worker starts with an even share of
+// the chunks as a range, takes chunks from the front of its own, and
+// when that is empty takes the back half of someone else's. A range is
+// two 32 bit halves of one word, so both are changed together. Chunks
+// are a whole number of bytes of the presence bitmaps, so no two
+// workers ever write the same byte.
+
+#define SDB_COL_CHUNK (1024)
+#define SDB_COL_MAX_THREADS (256)
+
+typedef struct sdb_col_worker_t {
+    uint64_t range __attribute__((aligned(64)));  // next chunk, and end
+} sdb_col_worker_t;
+
+typedef struct sdb_col_job_t {
+    const uint8_t *const *msgs;
+    const sdb_tlen_t *lens;
+    size_t            n;
+    sdb_column_t     *cols;
+    size_t            ncols;
+    const sdb_id_t   *ids;    // of the columns, in ascending order
+    const size_t     *order;  // which column each of ids is
+    sdb_col_worker_t *workers;
+    unsigned          nworkers;
+} sdb_col_job_t;
+
+typedef struct sdb_col_start_t {
+    sdb_col_job_t *job;
+    unsigned       self;
+} sdb_col_start_t;
+
+static uint8_t sdb_col_size(sdbtypes_t t) {
+    switch (t) {
+        case SDB_S8:  case SDB_U8:  return 1;
+        case SDB_S16: case SDB_U16: return 2;
+        case SDB_S32: case SDB_U32: case SDB_FLOAT:  return 4;
+        case SDB_S64: case SDB_U64: case SDB_DOUBLE: return 8;
+        default: return 0;
+    }
+}
+
+// store one value, if it fits
+static bool sdb_col_put(const sdb_column_t *col, size_t i, const sdb_member_info_t *mi) {
+    if ((mi->elemcount != 1) || (mi->type == SDB_BLOB)) return false;
+    sdb_val_t in = {};
+    memcpy(&in, mi->data, mi->elemsize);
+
+    int64_t  s = 0;
+    uint64_t u = 0;
+    double   d = 0;
+    bool is_float = false;
+    bool negative = false;
+    switch (mi->type) {
+        case SDB_S8:     s = in.s8;  break;
+        case SDB_S16:    s = in.s16; break;
+        case SDB_S32:    s = in.s32; break;
+        case SDB_S64:    s = in.s64; break;
+        case SDB_U8:     u = in.u8;  break;
+        case SDB_U16:    u = in.u16; break;
+        case SDB_U32:    u = in.u32; break;
+        case SDB_U64:    u = in.u64; break;
+        case SDB_FLOAT:  d = in.f; is_float = true; break;
+        case SDB_DOUBLE: d = in.d; is_float = true; break;
+        case SDB_HALF:   d = sdb_half_to_float(in.u16); is_float = true; break;
+        default: return false;
+    }
+    if (sdb_is_signed(mi->type)) {
+        negative = s < 0;
+        u = (uint64_t)s;
+        d = (double)s;
+    } else if (!is_float) {
+        s = (int64_t)u;
+        d = (double)u;
+    }
+
+    sdb_val_t out = {};
+    uint8_t bits = 8 * sdb_col_size(col->type);
+    if (sdb_is_signed(col->type)) {
+        if (is_float) return false;
+        int64_t max = (int64_t)(UINT64_MAX >> (65 - bits));
+        if (negative ? (s < -max - 1) : (u > (uint64_t)max)) return false;
+        out.s64 = s;
+    } else if (sdb_is_unsigned(col->type)) {
+        if (is_float || negative) return false;
+        if ((bits < 64) && (u >> bits)) return false;
+        out.u64 = u;
+    } else if (col->type == SDB_FLOAT) {
+        // infinities and NaNs go over, but nothing finite that won't fit
+        if (!isinf(d) && ((d > FLT_MAX) || (d < -FLT_MAX))) return false;
+        out.f = (float)d;
+    } else {
+        out.d = d;
+    }
+    // and narrow it to the column's type
+    uint8_t *dst = (uint8_t *)col->values + i * sdb_col_size(col->type);
+    switch (col->type) {
+        case SDB_S8:  case SDB_U8:  { uint8_t  v = (uint8_t)out.u64;  memcpy(dst, &v, 1); break; }
+        case SDB_S16: case SDB_U16: { uint16_t v = (uint16_t)out.u64; memcpy(dst, &v, 2); break; }
+        case SDB_S32: case SDB_U32: { uint32_t v = (uint32_t)out.u64; memcpy(dst, &v, 4); break; }
+        case SDB_FLOAT:             memcpy(dst, &out.f, 4); break;
+        default:                    memcpy(dst, &out.u64, 8); break;
+    }
+    return true;
+}
+
+static void sdb_col_chunk(sdb_col_job_t *job, size_t chunk) {
+    size_t lo = chunk * SDB_COL_CHUNK;
+    size_t hi = lo + SDB_COL_CHUNK;
+    if (hi > job->n) hi = job->n;
+    for (size_t c=0; c<job->ncols; c++) {
+        sdb_column_t *col = &job->cols[c];
+        memset((uint8_t *)col->values + lo * sdb_col_size(col->type), 0, (hi - lo) * sdb_col_size(col->type));
+        memset(col->present + lo / 8, 0, (hi - lo + 7) / 8);
+    }
+    sdb_member_info_t mis[job->ncols];
+    for (size_t i=lo; i<hi; i++) {
+        sdb_t sdb;
+        if (sdb_init(&sdb, (void *)job->msgs[i], job->lens[i], false)) continue;
+        if ((sdb_size(&sdb) > job->lens[i]) || (sdb_size(&sdb) < sdb.vals_size)) continue;
+        // in one pass, if the message is sorted
+        if (!sdb_find_many(&sdb, job->ids, job->ncols, mis)) continue;
+        for (size_t k=0; k<job->ncols; k++) {
+            sdb_column_t *col = &job->cols[job->order[k]];
+            if (mis[k].valid && sdb_col_put(col, i, &mis[k])) {
+                col->present[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+}
+
+static uint64_t sdb_col_range(uint32_t next, uint32_t end) {
+    return ((uint64_t)end << 32) | next;
+}
+
+// the next chunk from the front of a worker's own range
+static bool sdb_col_take(sdb_col_worker_t *w, uint32_t *chunk) {
+    uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t)r, end = (uint32_t)(r >> 32);
+        if (next >= end) return false;
+        if (__atomic_compare_exchange_n(&w->range, &r, sdb_col_range(next + 1, end),
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = next;
+            return true;
+        }
+    }
+}
+
+// the back half of the first range that has anything left, made ours
+static bool sdb_col_steal(sdb_col_job_t *job, unsigned self) {
+    for (unsigned k=1; k<job->nworkers; k++) {
+        sdb_col_worker_t *victim = &job->workers[(self + k) % job->nworkers];
+        uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+        for (;;) {
+            uint32_t next = (uint32_t)r, end = (uint32_t)(r >> 32);
+            if (next >= end) break;
+            uint32_t half = (end - next + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim->range, &r, sdb_col_range(next, end - half),
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                // nobody takes from an empty range, so ours is ours to set
+                __atomic_store_n(&job->workers[self].range, sdb_col_range(end - half, end), __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void *sdb_col_work(void *arg) {
+    sdb_col_start_t *start = (sdb_col_start_t *)arg;
+    uint32_t chunk;
+    do {
+        while (sdb_col_take(&start->job->workers[start->self], &chunk)) {
+            sdb_col_chunk(start->job, chunk);
+        }
+    } while (sdb_col_steal(start->job, start->self));
+    return NULL;
+}
+
+int8_t sdb_project(const uint8_t *const *msgs, const sdb_tlen_t *lens, size_t n,
+                   sdb_column_t *cols, size_t ncols, unsigned nthreads) {
+    for (size_t c=0; c<ncols; c++) {
+        if (!sdb_col_size(cols[c].type) || !cols[c].values || !cols[c].present) return -SDB_BAD_HANDLE;
+    }
+    size_t nchunks = (n + SDB_COL_CHUNK - 1) / SDB_COL_CHUNK;
+    if (nchunks > UINT32_MAX) return -SDB_ITEM_TOO_BIG;
+    if (ncols > SDB_COL_MAX_COLS) return -SDB_ITEM_TOO_BIG;
+    if (!ncols || !nchunks) return SDB_OK;
+    if (!nthreads) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? ncpu : 1;
+    }
+    if (nthreads > SDB_COL_MAX_THREADS) nthreads = SDB_COL_MAX_THREADS;
+    if (nthreads > nchunks) nthreads = nchunks;
+
+    sdb_col_worker_t workers[nthreads];
+    sdb_col_start_t starts[nthreads];
+    pthread_t threads[nthreads];
+    // ids in order, for sdb_find_many's sake; there won't be many
+    sdb_id_t ids[ncols];
+    size_t order[ncols];
+    for (size_t c=0; c<ncols; c++) {
+        size_t k = c;
+        for (; k && (ids[k-1] > cols[c].id); k--) {
+            ids[k] = ids[k-1];
+            order[k] = order[k-1];
+        }
+        ids[k] = cols[c].id;
+        order[k] = c;
+    }
+    sdb_col_job_t job = { msgs, lens, n, cols, ncols, ids, order, workers, nthreads };
+    for (unsigned w=0; w<nthreads; w++) {
+        workers[w].range = sdb_col_range(nchunks * w / nthreads, nchunks * (w + 1) / nthreads);
+        starts[w].job = &job;
+        starts[w].self = w;
+    }
+    // this thread is worker 0. If a thread can't be started, its share
+    // gets stolen by the others.
+    bool started[nthreads];
+    for (unsigned w=1; w<nthreads; w++) {
+        started[w] = !pthread_create(&threads[w], NULL, sdb_col_work, &starts[w]);
+    }
+    sdb_col_work(&starts[0]);
+    for (unsigned w=1; w<nthreads; w++) {
+        if (started[w]) pthread_join(threads[w], NULL);
+    }
+    return SDB_OK;
+}
+
+size_t sdb_index_log(const void *log, size_t len, const uint8_t **msgs, sdb_tlen_t *lens, size_t max) {
+    const uint8_t *p = (const uint8_t *)log;
+    size_t count = 0;
+    while (len) {
+        sdb_t sdb;
+        sdb_tlen_t room = len > UINT32_MAX ? UINT32_MAX : len;
+        if (sdb_init(&sdb, (void *)p, room, false)) break;
+        sdb_tlen_t size = sdb_size(&sdb);
+        if ((size > room) || (size < sdb.vals_size)) break;
+        if (count < max) {
+            msgs[count] = p;
+            lens[count] = size;
+        }
+        count++;
+        p += size;
+        len -= size;
+    }
+    return count;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "sdbuf.h"
+
+// Pulling a few ids out of a great many messages at once, into one array
+// per id (struct of arrays) that can be handed straight to numpy or
+// Arrow: values are packed native types, and which messages had a value
+// is a bitmap, least significant bit first, as Arrow lays out validity.
+// The messages are split across threads, which take work from each
+// other when they run out.
+
+// the most columns one call takes, since each thread keeps a lookup per
+// column on its stack; take more in several calls
+#define SDB_COL_MAX_COLS (256)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sdb_column_t {
+    sdb_id_t   id;
+    sdbtypes_t type;     // what to store values as; not a blob
+    void      *values;   // room for one value of type per message
+    uint8_t   *present;  // room for one bit per message
+} sdb_column_t;
+
+// Only single values are taken, not arrays or blobs, and only if they
+// fit: an integer must be in range for the column's type, and floats
+// only go into float or double columns. Anything else, and messages
+// that can't be read, count as absent, and their values are zero.
+// nthreads of 0 means one per processor. More than SDB_COL_MAX_COLS
+// columns gives SDB_ITEM_TOO_BIG.
+int8_t sdb_project(const uint8_t *const *msgs, const sdb_tlen_t *lens, size_t n,
+                   sdb_column_t *cols, size_t ncols, unsigned nthreads);
+
+// find the messages in a log of them written one after another. Fills
+// in the first max and returns how many there are, stopping at anything
+// that isn't a whole message.
+size_t sdb_index_log(const void *log, size_t len, const uint8_t **msgs, sdb_tlen_t *lens, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,431 @@
+#include <string.h>
+#include "sdb_json.h"
+
+#define SDB_JSON_ARRAY_FLAG (0x80)
+#define SDB_JSON_VALS_OFFSET (sizeof(sdb_hdr_t) + sizeof(sdb_tlen_t))
+
+// where the JSON goes. n keeps counting once the buffer is full, so
+// that the caller can find out how much room it needs.
+typedef struct sdb_json_out_t {
+    char  *buf;
+    size_t len;
+    size_t n;
+} sdb_json_out_t;
+
+static void sdb_json_put(sdb_json_out_t *o, const char *s, size_t len) {
+    if (o->n < o->len) {
+        size_t room = o->len - o->n;
+        memcpy(o->buf + o->n, s, len < room ? len : room);
+    }
+    o->n += len;
+}
+
+static void sdb_json_putc(sdb_json_out_t *o, char c) {
+    if (o->n < o->len) o->buf[o->n] = c;
+    o->n++;
+}
+
+static const char sdb_json_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void sdb_json_unsigned(sdb_json_out_t *o, uint64_t v) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, sdb_json_pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, sdb_json_pairs + 2 * v, 2);
+    } else {
+        *--p = '0' + v;
+    }
+    sdb_json_put(o, p, digits + sizeof(digits) - p);
+}
+
+static void sdb_json_signed(sdb_json_out_t *o, int64_t v) {
+    if (v < 0) {
+        sdb_json_putc(o, '-');
+        sdb_json_unsigned(o, -(uint64_t)v);
+    } else {
+        sdb_json_unsigned(o, v);
+    }
+}
+
+// Floats are turned into decimal exactly, with big integers, and then
+// cut to the fewest digits that still fall between the halfway points
+// to the floats either side, so they read back as the same value.
+
+// Limbs are base 10^9, so that the digits fall straight out. Enough
+// of them for the smallest double, scaled up to an integer, and digits
+// for its 1076 places after the point.
+#define SDB_JSON_BASE   (1000000000u)
+#define SDB_JSON_LIMBS  (96)
+#define SDB_JSON_DIGITS (1088)
+
+typedef struct sdb_json_big_t {
+    uint32_t limb[SDB_JSON_LIMBS];  // least significant first
+    uint8_t  n;
+} sdb_json_big_t;
+
+static void sdb_json_big_mul(sdb_json_big_t *b, uint32_t f) {
+    uint64_t carry = 0;
+    for (uint8_t i=0; i<b->n; i++) {
+        uint64_t x = (uint64_t)b->limb[i] * f + carry;
+        b->limb[i] = x % SDB_JSON_BASE;
+        carry = x / SDB_JSON_BASE;
+    }
+    for (; carry; carry /= SDB_JSON_BASE) b->limb[b->n++] = carry % SDB_JSON_BASE;
+}
+
+// n * 2^shift, or n * 5^-shift if shift is negative
+static void sdb_json_big_set(sdb_json_big_t *b, uint64_t n, int shift) {
+    for (b->n = 0; n; n /= SDB_JSON_BASE) b->limb[b->n++] = n % SDB_JSON_BASE;
+    for (; shift >= 31; shift -= 31) sdb_json_big_mul(b, 1u << 31);
+    if (shift > 0) sdb_json_big_mul(b, 1u << shift);
+    static const uint32_t fives[13] = {
+        1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125, 9765625, 48828125, 244140625,
+    };
+    for (; shift <= -13; shift += 13) sdb_json_big_mul(b, 1220703125u);  // 5^13
+    if (shift < 0) sdb_json_big_mul(b, fives[-shift]);
+}
+
+// a += sign * d, where a is never less than d
+static void sdb_json_big_add(sdb_json_big_t *a, const sdb_json_big_t *d, int sign) {
+    int32_t carry = 0;
+    for (uint8_t i=0; (i < d->n) || carry; i++) {
+        if (i == a->n) a->limb[a->n++] = 0;
+        int64_t x = (int64_t)a->limb[i] + carry + (i < d->n ? sign * (int64_t)d->limb[i] : 0);
+        carry = x < 0 ? -1 : x >= SDB_JSON_BASE ? 1 : 0;
+        a->limb[i] = x - carry * (int64_t)SDB_JSON_BASE;
+    }
+    while (a->n && !a->limb[a->n-1]) a->n--;
+}
+
+static size_t sdb_json_big_width(const sdb_json_big_t *b) {
+    if (!b->n) return 1;
+    size_t width = 9 * (b->n - 1);
+    for (uint32_t top = b->limb[b->n-1]; top; top /= 10) width++;
+    return width;
+}
+
+// the digits of b, right aligned in width, which is wide enough
+static void sdb_json_big_digits(const sdb_json_big_t *b, char *digits, size_t width) {
+    char *p = digits + width;
+    for (uint8_t i=0; i+1<b->n; i++) {
+        uint32_t x = b->limb[i];
+        for (int k=0; k<4; k++) {
+            p -= 2;
+            memcpy(p, sdb_json_pairs + 2 * (x % 100), 2);
+            x /= 100;
+        }
+        *--p = '0' + x;
+    }
+    // no zeros in front of the top one
+    for (uint32_t x = b->n ? b->limb[b->n-1] : 0; x; x /= 10) *--p = '0' + x % 10;
+    memset(digits, '0', p - digits);
+}
+
+// a finite, positive float that is m * 2^e
+static void sdb_json_float_digits(sdb_json_out_t *o, uint64_t m, int e, bool boundary, int max_digits) {
+    // everything in quarters of the least significant bit, so that the
+    // halfway points are integers too. Just above a power of two, the
+    // float below is closer.
+    int shift = e - 2;
+    sdb_json_big_t bv, bq, blo, bhi;
+    sdb_json_big_set(&bv, 4 * m, shift);
+    sdb_json_big_set(&bq, 1, shift);
+    blo = bv;
+    bhi = bv;
+    sdb_json_big_add(&blo, &bq, -1);
+    if (!boundary) sdb_json_big_add(&blo, &bq, -1);
+    sdb_json_big_add(&bhi, &bq, 1);
+    sdb_json_big_add(&bhi, &bq, 1);
+
+    // room for the point and a carry in front
+    size_t width = sdb_json_big_width(&bhi);
+    size_t frac = shift < 0 ? -shift : 0;
+    size_t lead = (width > frac ? width : frac + 1) + 1;
+    char hi[SDB_JSON_DIGITS], lo[SDB_JSON_DIGITS], v[SDB_JSON_DIGITS], c[SDB_JSON_DIGITS];
+    sdb_json_big_digits(&bhi, hi, lead);
+    sdb_json_big_digits(&blo, lo, lead);
+    sdb_json_big_digits(&bv, v, lead);
+
+    size_t first = 0;
+    while ((first < lead) && (v[first] == '0')) first++;
+
+    // the fewest significant digits that land between lo and hi. A value
+    // right on the halfway point reads back as the even one of the two.
+    bool even = !(m & 1);
+    // Cut short of where lo and hi part, rounding up lands past hi, and
+    // rounding down short of lo unless lo is all zeros from there on.
+    size_t part = 0;
+    while ((part < lead) && (lo[part] == hi[part])) part++;
+    size_t zeros = lead;
+    while ((zeros > 0) && (lo[zeros-1] == '0')) zeros--;
+    int shortest = 1;
+    if ((part > first + 1) && !(even && (zeros <= part))) shortest = part - first;
+    if (shortest > max_digits) shortest = max_digits;
+    for (int p=shortest; p<=max_digits; p++) {
+        size_t cut = first + p;
+        memcpy(c, v, lead);
+        if (cut < lead) {
+            bool up = c[cut] > '5';
+            if (c[cut] == '5') {
+                // a tie goes to the even digit
+                size_t k = cut + 1;
+                while ((k < lead) && (c[k] == '0')) k++;
+                up = (k < lead) || ((c[cut-1] - '0') & 1);
+            }
+            memset(c + cut, '0', lead - cut);
+            for (size_t i=cut; up && i--; ) {
+                if (c[i] == '9') {
+                    c[i] = '0';
+                } else {
+                    c[i]++;
+                    up = false;
+                }
+            }
+        }
+        int above = memcmp(c, lo, lead);
+        int below = memcmp(c, hi, lead);
+        if (((above > 0) || (even && !above)) && ((below < 0) || (even && !below))) break;
+        if (p == max_digits) break;
+    }
+
+    // c now holds the digits, with the point frac from the end
+    size_t point = lead - frac;
+    size_t start = 0;
+    while ((start < point - 1) && (c[start] == '0')) start++;
+    size_t end = lead;
+    while ((end > point) && (c[end-1] == '0')) end--;
+    size_t sig = start;
+    while ((sig < end) && (c[sig] == '0')) sig++;
+    // where the first significant digit is, as a power of ten
+    int exp10 = (int)point - (int)sig - 1;
+
+    if ((exp10 < -4) || (exp10 >= 16)) {
+        size_t last = end;
+        while ((last > sig + 1) && (c[last-1] == '0')) last--;
+        sdb_json_putc(o, c[sig]);
+        if (last > sig + 1) {
+            sdb_json_putc(o, '.');
+            sdb_json_put(o, c + sig + 1, last - sig - 1);
+        }
+        sdb_json_putc(o, 'e');
+        sdb_json_putc(o, exp10 < 0 ? '-' : '+');
+        if ((exp10 > -10) && (exp10 < 10)) sdb_json_putc(o, '0');
+        sdb_json_unsigned(o, exp10 < 0 ? -exp10 : exp10);
+    } else {
+        sdb_json_put(o, c + start, point - start);
+        sdb_json_putc(o, '.');
+        if (end > point) sdb_json_put(o, c + point, end - point);
+        else             sdb_json_putc(o, '0');
+    }
+}
+
+static void sdb_json_double(sdb_json_out_t *o, double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    uint64_t frac = bits & ((1ull << 52) - 1);
+    int biased = (bits >> 52) & 0x7ff;
+    if (biased == 0x7ff) {
+        sdb_json_put(o, "null", 4);
+        return;
+    }
+    if (bits >> 63) sdb_json_putc(o, '-');
+    if (!biased && !frac) {
+        sdb_json_put(o, "0.0", 3);
+        return;
+    }
+    double a = d < 0 ? -d : d;
+    // whole numbers are common, and easy
+    if ((a < 9007199254740992.0) && (a == (double)(uint64_t)a)) {
+        sdb_json_unsigned(o, (uint64_t)a);
+        sdb_json_put(o, ".0", 2);
+        return;
+    }
+    if (biased) sdb_json_float_digits(o, frac | (1ull << 52), biased - 1075, !frac && (biased > 1), 17);
+    else        sdb_json_float_digits(o, frac, -1074, false, 17);
+}
+
+static void sdb_json_float(sdb_json_out_t *o, float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t frac = bits & ((1u << 23) - 1);
+    int biased = (bits >> 23) & 0xff;
+    bool whole = (f > -2147483648.0f) && (f < 2147483648.0f) && (f == (float)(int32_t)f);
+    if ((biased == 0xff) || (!biased && !frac) || whole) {
+        // the same as a double would be
+        sdb_json_double(o, f);
+        return;
+    }
+    if (bits >> 31) sdb_json_putc(o, '-');
+    if (biased) sdb_json_float_digits(o, frac | (1u << 23), biased - 150, !frac && (biased > 1), 9);
+    else        sdb_json_float_digits(o, frac, -149, false, 9);
+}
+
+static void sdb_json_half(sdb_json_out_t *o, uint16_t h) {
+    uint16_t frac = h & 0x3ff;
+    int biased = (h >> 10) & 0x1f;
+    float f = sdb_half_to_float(h);
+    if ((biased == 0x1f) || (!biased && !frac) || (f == (float)(int32_t)f)) {
+        sdb_json_double(o, f);
+        return;
+    }
+    if (h >> 15) sdb_json_putc(o, '-');
+    if (biased) sdb_json_float_digits(o, frac | (1u << 10), biased - 25, !frac && (biased > 1), 5);
+    else        sdb_json_float_digits(o, frac, -24, false, 5);
+}
+
+static void sdb_json_blob(sdb_json_out_t *o, const uint8_t *p, size_t len, bool hex) {
+    static const char hexdigits[] = "0123456789abcdef";
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    sdb_json_putc(o, '"');
+    if (hex) {
+        for (size_t i=0; i<len; i++) {
+            char two[2] = { hexdigits[p[i] >> 4], hexdigits[p[i] & 0xf] };
+            sdb_json_put(o, two, 2);
+        }
+    } else {
+        for (size_t i=0; i<len; i+=3) {
+            uint32_t x = (uint32_t)p[i] << 16;
+            if (i + 1 < len) x |= (uint32_t)p[i+1] << 8;
+            if (i + 2 < len) x |= p[i+2];
+            char four[4] = {
+                b64[(x >> 18) & 0x3f], b64[(x >> 12) & 0x3f],
+                i + 1 < len ? b64[(x >> 6) & 0x3f] : '=',
+                i + 2 < len ? b64[x & 0x3f] : '=',
+            };
+            sdb_json_put(o, four, 4);
+        }
+    }
+    sdb_json_putc(o, '"');
+}
+
+static uint8_t sdb_json_type_size(uint8_t t) {
+    switch (t) {
+        case SDB_S8:  case SDB_U8:  return 1;
+        case SDB_S16: case SDB_U16: case SDB_HALF: return 2;
+        case SDB_S32: case SDB_U32: case SDB_FLOAT:  return 4;
+        case SDB_S64: case SDB_U64: case SDB_DOUBLE: return 8;
+        default: return 0;
+    }
+}
+
+// every record fits in the message, and the message in its buffer, so
+// that none of what follows reads off the end of anything
+static bool sdb_json_holds_together(const sdb_t *sdb) {
+    // blobs held by reference are only ever our own
+    if (sdb->nrefs) return true;
+    const uint8_t *b = (const uint8_t *)sdb->buf;
+    size_t off = SDB_JSON_VALS_OFFSET;
+    size_t end = off + (size_t)sdb->vals_size;
+    if (end > sdb->len) return false;
+    while (off < end) {
+        if (end - off < sizeof(sdb_id_t) + 1) return false;
+        uint8_t type = b[off + sizeof(sdb_id_t)];
+        off += sizeof(sdb_id_t) + 1;
+        bool is_array = type & SDB_JSON_ARRAY_FLAG;
+        type &= ~SDB_JSON_ARRAY_FLAG;
+        if (type >= _SDB_INVALID_TYPE) return false;
+        sdb_len_t size = sdb_json_type_size(type);
+        sdb_len_t count = 1;
+        if (type == SDB_BLOB) {
+            if (end - off < sizeof(size)) return false;
+            memcpy(&size, b + off, sizeof(size));
+            off += sizeof(size);
+        }
+        if (is_array) {
+            if (end - off < sizeof(count)) return false;
+            memcpy(&count, b + off, sizeof(count));
+            off += sizeof(count);
+        }
+        if (end - off < (size_t)size * count) return false;
+        off += (size_t)size * count;
+    }
+    return true;
+}
+
+static int8_t sdb_json_object(sdb_json_out_t *o, const sdb_t *sdb, uint8_t flags, int depth);
+
+static void sdb_json_value(sdb_json_out_t *o, const sdb_member_info_t *mi, const uint8_t *p, uint8_t flags, int depth) {
+    sdb_val_t v = {};
+    if (mi->type != SDB_BLOB) memcpy(&v, p, mi->elemsize);
+    switch (mi->type) {
+        case SDB_S8:     sdb_json_signed(o, v.s8);  break;
+        case SDB_S16:    sdb_json_signed(o, v.s16); break;
+        case SDB_S32:    sdb_json_signed(o, v.s32); break;
+        case SDB_S64:    sdb_json_signed(o, v.s64); break;
+        case SDB_U8:     sdb_json_unsigned(o, v.u8);  break;
+        case SDB_U16:    sdb_json_unsigned(o, v.u16); break;
+        case SDB_U32:    sdb_json_unsigned(o, v.u32); break;
+        case SDB_U64:    sdb_json_unsigned(o, v.u64); break;
+        case SDB_FLOAT:  sdb_json_float(o, v.f);  break;
+        case SDB_DOUBLE: sdb_json_double(o, v.d); break;
+        case SDB_HALF:   sdb_json_half(o, v.u16); break;
+        case SDB_BLOB: {
+            if ((flags & SDB_JSON_NESTED) && (depth < SDB_JSON_MAX_DEPTH)) {
+                sdb_member_info_t one = *mi;
+                one.data = p;
+                one.elemcount = 1;
+                one.minsize = mi->elemsize;
+                sdb_t inner;
+                if ((mi->elemsize >= SDB_JSON_VALS_OFFSET) &&
+                    (sdb_init_nested(&inner, &one) == SDB_OK) &&
+                    (sdb_size(&inner) == mi->elemsize) &&
+                    sdb_json_holds_together(&inner)) {
+                    sdb_json_object(o, &inner, flags, depth + 1);
+                    break;
+                }
+            }
+            sdb_json_blob(o, p, mi->elemsize, flags & SDB_JSON_HEX);
+            break;
+        }
+        default:
+            sdb_json_put(o, "null", 4);
+            break;
+    }
+}
+
+static int8_t sdb_json_object(sdb_json_out_t *o, const sdb_t *sdb, uint8_t flags, int depth) {
+    if (!sdb_json_holds_together(sdb)) return -SDB_SCAN_ERROR;
+    sdb_json_putc(o, '{');
+    bool first = true;
+    for (sdb_member_info_t mi = sdb_iter(sdb, NULL); mi.valid; mi = sdb_iter(sdb, &mi)) {
+        if (!first) sdb_json_putc(o, ',');
+        first = false;
+        sdb_json_putc(o, '"');
+        sdb_json_unsigned(o, mi.id);
+        sdb_json_put(o, "\":", 2);
+        if (mi.elemcount == 1) {
+            sdb_json_value(o, &mi, mi.data, flags, depth);
+            continue;
+        }
+        sdb_json_putc(o, '[');
+        for (sdb_len_t i=0; i<mi.elemcount; i++) {
+            if (i) sdb_json_putc(o, ',');
+            sdb_json_value(o, &mi, mi.data + (size_t)i * mi.elemsize, flags, depth);
+        }
+        sdb_json_putc(o, ']');
+    }
+    sdb_json_putc(o, '}');
+    return SDB_OK;
+}
+
+int8_t sdb_to_json(const sdb_t *sdb, char *out, size_t len, size_t *written, uint8_t flags) {
+    sdb_json_out_t o = { out, len, 0 };
+    int8_t err = sdb_json_object(&o, sdb, flags, 0);
+    if (written) *written = o.n;
+    if (err) return err;
+    if (o.n >= len) {
+        if (len) out[len - 1] = 0;
+        return -SDB_BUFFER_TOO_SMALL;
+    }
+    out[o.n] = 0;
+    return SDB_OK;
+}
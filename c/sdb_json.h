@@ -0,0 +1,34 @@
+#pragma once
+
+#include "sdbuf.h"
+
+// A message as a JSON object, written into the caller's buffer without
+// allocating or calling printf. Keys are the ids, in decimal. A single
+// value is a number, an array a list, and a blob a string, base64 unless
+// asked for hex. Floats come out in the fewest digits that read back as
+// the same value, NaNs and infinities as null.
+
+// flags for sdb_to_json
+// blobs that hold whole messages are written as objects in turn
+#define SDB_JSON_NESTED (0x01)
+// blobs in hex rather than base64
+#define SDB_JSON_HEX    (0x02)
+
+// how deep SDB_JSON_NESTED goes; blobs below that are written as strings
+#ifndef SDB_JSON_MAX_DEPTH
+#define SDB_JSON_MAX_DEPTH 8
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// *written is set to the length of the JSON, not counting the NUL on the
+// end, even when it doesn't fit, in which case this returns
+// SDB_BUFFER_TOO_SMALL. Messages that don't hold together give
+// SDB_SCAN_ERROR.
+int8_t sdb_to_json(const sdb_t *sdb, char *out, size_t len, size_t *written, uint8_t flags);
+
+#ifdef __cplusplus
+}
+#endif
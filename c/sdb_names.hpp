@@ -0,0 +1,71 @@
+#pragma once
+
+// Field names for C++, turned into ids at compile time, so that
+//
+//   sdb_set_unsigned(&sdb, SDB_NAME("speed"), 30);
+//
+// costs exactly what sdb_set_unsigned(&sdb, 48128, 30) does. An id is a
+// hash of the name, the same one sdb_name_id gives in C and name_id in
+// sdbuf.py, so two names can land on the same id. Declare the names a
+// message uses together with SDB_NAMES, and the build fails if they do:
+//
+//   SDB_NAMES(gps_fields, "speed", "heading", "fix");
+
+#include <stddef.h>
+#include <type_traits>
+
+#include "sdbuf.h"
+
+namespace sdb {
+
+// written as single returns so that C++11 takes them
+constexpr uint32_t fnv1a(const char *s, uint32_t h = 2166136261u) {
+    return *s ? fnv1a(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+constexpr sdb_id_t fold(uint32_t h) {
+    return (sdb_id_t)(((h >> 16) ^ (h & 0xffff)) % SDB_ID_RESERVED);
+}
+
+constexpr sdb_id_t name_id(const char *s) {
+    return fold(fnv1a(s));
+}
+
+template <size_t N>
+constexpr bool differs_from(const char *const (&t)[N], size_t i, size_t j) {
+    return (j >= N) || ((name_id(t[i]) != name_id(t[j])) && differs_from(t, i, j + 1));
+}
+
+// no two names in t have the same id. The same name twice counts too.
+template <size_t N>
+constexpr bool names_distinct(const char *const (&t)[N], size_t i = 0) {
+    return (i >= N) || (differs_from(t, i, i + 1) && names_distinct(t, i + 1));
+}
+
+#ifndef NDEBUG
+// the name in t for id, or NULL. A scan, so for debugging only.
+template <size_t N>
+const char *name_of(const char *const (&t)[N], sdb_id_t id) {
+    for (size_t i=0; i<N; i++) {
+        if (name_id(t[i]) == id) return t[i];
+    }
+    return NULL;
+}
+
+// have sdb_debug show the names in t beside their ids
+template <size_t N>
+void debug_names(const char *const (&t)[N]) {
+    sdb_debug_names(t, N);
+}
+#endif
+
+} // namespace sdb
+
+// the id for a string literal, always worked out by the compiler
+#define SDB_NAME(s) (std::integral_constant<sdb_id_t, ::sdb::name_id(s)>::value)
+
+// a table of names that must all have different ids, at namespace or
+// function scope
+#define SDB_NAMES(table, ...) \
+    static constexpr const char *table[] = { __VA_ARGS__ }; \
+    static_assert(::sdb::names_distinct(table), "two names in " #table " have the same id")
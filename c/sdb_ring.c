@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sdb_ring.h"
+
+// Each side owns one cursor in shared memory and only reads the other's
+// when its own copy says there is no room, or nothing new. Publishing
+// stores the head before checking whether the consumer is asleep, and
+// the consumer says it is asleep before checking the head, so a wakeup
+// is never missed. Failures of the system calls come back as
+// SDB_BAD_HANDLE, with errno as they left it.
+
+#define SDB_RING_MAGIC (0x73646272)
+// slots start on their own cache lines
+#define SDB_RING_ALIGN (64)
+// an empty message is just the header and the size
+#define SDB_RING_EMPTY (sizeof(sdb_hdr_t) + sizeof(sdb_tlen_t))
+
+static size_t sdb_ring_header_size(void) {
+    return (sizeof(sdb_ring_shared_t) + SDB_RING_ALIGN - 1) & ~(size_t)(SDB_RING_ALIGN - 1);
+}
+
+static uint8_t *sdb_ring_slot(const sdb_ring_t *ring, uint64_t pos) {
+    return ring->slots + (size_t)(pos & (ring->nslots - 1)) * ring->slot_size;
+}
+
+static int8_t sdb_ring_map(sdb_ring_t *ring, int fd, int efd, size_t size) {
+    void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) return -SDB_BAD_HANDLE;
+    ring->shared = (sdb_ring_shared_t *)m;
+    ring->slots = (uint8_t *)m + sdb_ring_header_size();
+    ring->map_size = size;
+    ring->fd = fd;
+    ring->efd = efd;
+    ring->pos = 0;
+    ring->seen = 0;
+    return SDB_OK;
+}
+
+int8_t sdb_ring_create(sdb_ring_t *ring, uint32_t nslots, sdb_tlen_t slot_size, bool wakeup) {
+    if (!nslots || (nslots & (nslots - 1))) return -SDB_BAD_HANDLE;
+    slot_size = (slot_size + SDB_RING_ALIGN - 1) & ~(sdb_tlen_t)(SDB_RING_ALIGN - 1);
+    size_t size = sdb_ring_header_size() + (size_t)nslots * slot_size;
+    int fd = memfd_create("sdb_ring", MFD_CLOEXEC);
+    if (fd < 0) return -SDB_BAD_HANDLE;
+    int efd = -1;
+    if ((ftruncate(fd, size) < 0) ||
+        (wakeup && ((efd = eventfd(0, EFD_CLOEXEC)) < 0)) ||
+        sdb_ring_map(ring, fd, efd, size)) {
+        if (efd >= 0) close(efd);
+        close(fd);
+        return -SDB_BAD_HANDLE;
+    }
+    // the memfd starts out zeroed, cursors and all
+    ring->shared->nslots = ring->nslots = nslots;
+    ring->shared->slot_size = ring->slot_size = slot_size;
+    __atomic_store_n(&ring->shared->magic, SDB_RING_MAGIC, __ATOMIC_RELEASE);
+    return SDB_OK;
+}
+
+int8_t sdb_ring_attach(sdb_ring_t *ring, int fd, int efd, bool producer) {
+    // the descriptors are ours from here on, so that sdb_ring_close is
+    // right to close them whatever happens
+    ring->shared = NULL;
+    ring->fd = fd;
+    ring->efd = efd;
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -SDB_BAD_HANDLE;
+    if ((size_t)st.st_size < sdb_ring_header_size()) return -SDB_BUFFER_TOO_SMALL;
+    int8_t err = sdb_ring_map(ring, fd, efd, st.st_size);
+    if (err) return err;
+    const sdb_ring_shared_t *sh = ring->shared;
+    if ((__atomic_load_n(&sh->magic, __ATOMIC_ACQUIRE) != SDB_RING_MAGIC) ||
+        !sh->nslots || (sh->nslots & (sh->nslots - 1)) ||
+        (sdb_ring_header_size() + (size_t)sh->nslots * sh->slot_size > ring->map_size)) {
+        munmap(ring->shared, ring->map_size);
+        ring->shared = NULL;
+        return -SDB_WRONG_VERSION;
+    }
+    ring->nslots = sh->nslots;
+    ring->slot_size = sh->slot_size;
+    uint64_t head = __atomic_load_n(&sh->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&sh->tail, __ATOMIC_ACQUIRE);
+    ring->pos  = producer ? head : tail;
+    ring->seen = producer ? tail : head;
+    return SDB_OK;
+}
+
+void sdb_ring_close(sdb_ring_t *ring) {
+    if (ring->shared) munmap(ring->shared, ring->map_size);
+    if (ring->efd >= 0) close(ring->efd);
+    if (ring->fd >= 0) close(ring->fd);
+    ring->shared = NULL;
+    ring->efd = -1;
+    ring->fd = -1;
+}
+
+int8_t sdb_ring_claim(sdb_ring_t *ring, sdb_t *msg) {
+    sdb_ring_shared_t *sh = ring->shared;
+    if (ring->pos - ring->seen >= ring->nslots) {
+        ring->seen = __atomic_load_n(&sh->tail, __ATOMIC_ACQUIRE);
+        if (ring->pos - ring->seen >= ring->nslots) return -SDB_BUSY;
+    }
+    // clear just the header rather than the whole slot
+    int8_t err = sdb_init(msg, sdb_ring_slot(ring, ring->pos), SDB_RING_EMPTY, true);
+    msg->len = ring->slot_size;
+    return err;
+}
+
+void sdb_ring_commit(sdb_ring_t *ring) {
+    ring->pos++;
+}
+
+void sdb_ring_publish(sdb_ring_t *ring) {
+    sdb_ring_shared_t *sh = ring->shared;
+    __atomic_store_n(&sh->head, ring->pos, __ATOMIC_SEQ_CST);
+    if ((ring->efd >= 0) && __atomic_load_n(&sh->waiting, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(ring->efd, &one, sizeof(one)) < 0) {
+            // the counter is full, so the consumer is awake anyway
+        }
+    }
+}
+
+int8_t sdb_ring_peek(sdb_ring_t *ring, sdb_t *msg) {
+    sdb_ring_shared_t *sh = ring->shared;
+    if (ring->pos == ring->seen) {
+        ring->seen = __atomic_load_n(&sh->head, __ATOMIC_ACQUIRE);
+        if (ring->pos == ring->seen) return -SDB_NOT_FOUND;
+    }
+    int8_t err = sdb_init(msg, sdb_ring_slot(ring, ring->pos), ring->slot_size, false);
+    if (err) return err;
+    // the other process may not be one we trust, so every record has to
+    // lie inside the slot. The first test keeps sdb_size from wrapping
+    // around. A producer still writing to a slot after publishing it
+    // can change it after this, which nothing here can stop.
+    if ((msg->vals_size > ring->slot_size) || (sdb_size(msg) > ring->slot_size)) return -SDB_SCAN_ERROR;
+    err = sdb_check(msg);
+    if (err) return err;
+    msg->readonly = true;
+    return SDB_OK;
+}
+
+void sdb_ring_consume(sdb_ring_t *ring) {
+    ring->pos++;
+}
+
+void sdb_ring_release(sdb_ring_t *ring) {
+    __atomic_store_n(&ring->shared->tail, ring->pos, __ATOMIC_RELEASE);
+}
+
+int8_t sdb_ring_wait(sdb_ring_t *ring, int timeout_ms) {
+    sdb_ring_shared_t *sh = ring->shared;
+    if (ring->efd < 0) return -SDB_BAD_HANDLE;
+    __atomic_store_n(&sh->waiting, 1, __ATOMIC_SEQ_CST);
+    int8_t rv = SDB_OK;
+    if (__atomic_load_n(&sh->head, __ATOMIC_SEQ_CST) == ring->pos) {
+        struct pollfd pfd = { ring->efd, POLLIN, 0 };
+        int n = poll(&pfd, 1, timeout_ms);
+        if (n > 0) {
+            uint64_t count;
+            if (read(ring->efd, &count, sizeof(count)) < 0) rv = -SDB_BAD_HANDLE;
+        } else {
+            rv = n ? -SDB_BAD_HANDLE : -SDB_NOT_FOUND;
+        }
+    }
+    __atomic_store_n(&sh->waiting, 0, __ATOMIC_SEQ_CST);
+    return rv;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "sdbuf.h"
+
+// A ring of message slots in shared memory, for one producer and one
+// consumer, usually in different processes. The producer builds each
+// message in place in the next free slot with the usual sdb_set_*
+// calls, and the consumer reads it in place with sdb_find and sdb_get,
+// so a message is never copied. Linux only: the memory is a memfd, and
+// the optional wakeup an eventfd. Hand both descriptors to the other
+// process (by fork, or over a Unix socket) for sdb_ring_attach.
+//
+// Neither side tells the other about each message on its own:
+// sdb_ring_commit and sdb_ring_consume only move a private cursor, and
+// sdb_ring_publish and sdb_ring_release share it, so that a batch of
+// messages costs one cache line going back and forth rather than one
+// each.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// at the front of the shared memory
+typedef struct sdb_ring_shared_t {
+    uint32_t   magic;
+    uint32_t   nslots;
+    sdb_tlen_t slot_size;
+    uint64_t   head    __attribute__((aligned(64))); // slots published
+    uint32_t   waiting;                              // consumer is asleep
+    uint64_t   tail    __attribute__((aligned(64))); // slots released
+} sdb_ring_shared_t;
+
+typedef struct sdb_ring_t {
+    sdb_ring_shared_t *shared;
+    uint8_t   *slots;
+    size_t     map_size;
+    int        fd;
+    int        efd;       // eventfd for sdb_ring_wait, or -1
+    uint32_t   nslots;    // as checked when mapped, whatever the other
+    sdb_tlen_t slot_size; // side writes into shared later
+    uint64_t   pos;       // next slot to claim or to read
+    uint64_t   seen;      // the other side's cursor, as last read
+} sdb_ring_t;
+
+// nslots must be a power of two. With wakeup, the consumer can sleep in
+// sdb_ring_wait rather than poll.
+int8_t sdb_ring_create (sdb_ring_t *ring, uint32_t nslots, sdb_tlen_t slot_size, bool wakeup);
+// fd and efd (or -1) as they were in the creator's sdb_ring_t. Takes
+// them over, even if it fails; sdb_ring_close closes them either way.
+int8_t sdb_ring_attach (sdb_ring_t *ring, int fd, int efd, bool producer);
+void   sdb_ring_close  (sdb_ring_t *ring);
+
+// producer: an empty message in the next free slot, or SDB_BUSY if
+// the consumer hasn't released one
+int8_t sdb_ring_claim  (sdb_ring_t *ring, sdb_t *msg);
+void   sdb_ring_commit (sdb_ring_t *ring);
+void   sdb_ring_publish(sdb_ring_t *ring);
+
+// consumer: a read only view of the next message, or SDB_NOT_FOUND if
+// nothing more has been published. The view is good until released.
+int8_t sdb_ring_peek   (sdb_ring_t *ring, sdb_t *msg);
+void   sdb_ring_consume(sdb_ring_t *ring);
+void   sdb_ring_release(sdb_ring_t *ring);
+// sleep until something is published, for up to timeout_ms (-1 for
+// ever). Needs the wakeup.
+int8_t sdb_ring_wait   (sdb_ring_t *ring, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "sdb_snap.h"
+
+// Readers say which slot they hold by counting themselves in before
+// they look at it, then checking that it is still the current one.
+// The writer only reuses a slot that is not current and that nobody
+// has counted themselves into. Everything is sequentially consistent
+// so that one of the two always sees the other.
+
+static uint8_t *sdb_snap_buf(sdb_snap_t *snap, uint8_t slot) {
+    return snap->bufs + (size_t)slot * snap->len;
+}
+
+int8_t sdb_snap_init(sdb_snap_t *snap, void *bufs, sdb_tlen_t len, uint8_t nslots) {
+    if (!bufs || (nslots < 2) || (nslots > SDB_SNAP_MAX_SLOTS)) return -SDB_BAD_HANDLE;
+    snap->bufs = (uint8_t *)bufs;
+    snap->len = len;
+    snap->nslots = nslots;
+    snap->draft = nslots;
+    for (uint8_t i=0; i<nslots; i++) {
+        snap->slots[i].readers = 0;
+    }
+    int8_t err = sdb_init(&snap->slots[0].view, bufs, len, true);
+    if (err) return err;
+    snap->slots[0].view.readonly = true;
+    __atomic_store_n(&snap->current, 0, __ATOMIC_SEQ_CST);
+    return SDB_OK;
+}
+
+int8_t sdb_snap_begin(sdb_snap_t *snap, sdb_t *draft) {
+    uint8_t cur = __atomic_load_n(&snap->current, __ATOMIC_SEQ_CST);
+    for (uint8_t i=1; i<snap->nslots; i++) {
+        uint8_t slot = (cur + i) % snap->nslots;
+        if (__atomic_load_n(&snap->slots[slot].readers, __ATOMIC_SEQ_CST)) continue;
+        // only the writer changes the current slot, so it can read it
+        // without counting itself in
+        const sdb_t *latest = &snap->slots[cur].view;
+        *draft = *latest;
+        draft->buf = sdb_snap_buf(snap, slot);
+        draft->readonly = false;
+        memcpy(draft->buf, latest->buf, sdb_size(latest));
+        snap->draft = slot;
+        return SDB_OK;
+    }
+    return -SDB_BUSY;
+}
+
+int8_t sdb_snap_publish(sdb_snap_t *snap, sdb_t *draft) {
+    uint8_t slot = snap->draft;
+    if ((slot >= snap->nslots) || (draft->buf != sdb_snap_buf(snap, slot))) return -SDB_BAD_HANDLE;
+    // blobs held by reference live outside the slot
+    if (draft->nrefs) return -SDB_BAD_HANDLE;
+    snap->slots[slot].view = *draft;
+    snap->slots[slot].view.readonly = true;
+    snap->draft = snap->nslots;
+    __atomic_store_n(&snap->current, slot, __ATOMIC_SEQ_CST);
+    return SDB_OK;
+}
+
+int8_t sdb_snap_acquire(sdb_snap_t *snap, sdb_t *view) {
+    for (;;) {
+        uint8_t slot = __atomic_load_n(&snap->current, __ATOMIC_SEQ_CST);
+        uint32_t *readers = &snap->slots[slot].readers;
+        __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&snap->current, __ATOMIC_SEQ_CST) == slot) {
+            *view = snap->slots[slot].view;
+            return SDB_OK;
+        }
+        // published over while counting in; the writer may already be
+        // reusing it
+        __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void sdb_snap_release(sdb_snap_t *snap, const sdb_t *view) {
+    size_t slot = ((uint8_t *)view->buf - snap->bufs) / snap->len;
+    __atomic_sub_fetch(&snap->slots[slot].readers, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "sdbuf.h"
+
+// One writer publishes whole messages and any number of readers take
+// the latest one, without locks. Each snapshot lives in its own slot,
+// and a slot is not reused while anyone still holds it, so what a
+// reader sees never changes under it. The writer never waits: if every
+// other slot is still held, sdb_snap_begin says SDB_BUSY and it can
+// try again later. Three slots are enough unless readers hold on to
+// snapshots for a long time.
+
+#ifndef SDB_SNAP_MAX_SLOTS
+#define SDB_SNAP_MAX_SLOTS 8
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// each on its own cache line, so that readers of one slot don't slow
+// down readers of another
+typedef struct sdb_snap_slot_t {
+    uint32_t readers;  // how many hold this slot right now
+    sdb_t    view;     // the message as it was published
+} __attribute__((aligned(64))) sdb_snap_slot_t;
+
+typedef struct sdb_snap_t {
+    uint8_t        *bufs;    // nslots buffers of len bytes, one after another
+    sdb_tlen_t      len;
+    uint8_t         nslots;
+    uint8_t         draft;   // the slot the writer has begun, or nslots
+    uint8_t         current __attribute__((aligned(64)));
+    sdb_snap_slot_t slots[SDB_SNAP_MAX_SLOTS];
+} sdb_snap_t;
+
+// bufs is nslots * len bytes. Starts out with an empty message published.
+int8_t sdb_snap_init   (sdb_snap_t *snap, void *bufs, sdb_tlen_t len, uint8_t nslots);
+
+// for the writer only: a copy of the latest message to change, in a
+// free slot. Nothing else sees it until it is published.
+int8_t sdb_snap_begin  (sdb_snap_t *snap, sdb_t *draft);
+int8_t sdb_snap_publish(sdb_snap_t *snap, sdb_t *draft);
+
+// for readers: a read only view of the latest message, good until it
+// is released
+int8_t sdb_snap_acquire(sdb_snap_t *snap, sdb_t *view);
+void   sdb_snap_release(sdb_snap_t *snap, const sdb_t *view);
+
+#ifdef __cplusplus
+}
+#endif
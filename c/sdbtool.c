@@ -0,0 +1,936 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sdbuf.h"
+#include "sdb_columns.h"
+#include "sdb_json.h"
+
+// sdbtool: a look inside files of messages written one after another,
+// as a capture or a log would have them. The file is memory mapped and
+// the messages shared out between threads; whatever they print comes
+// out in the order of the file all the same.
+
+static const char *usage =
+    "usage: sdbtool [options] command file\n"
+    "\n"
+    "  dump             every record of every message\n"
+    "  stats            how often each id turns up, types, sizes and overhead\n"
+    "  grep ID[=VALUE]  messages with that id, or with that value in it, as JSON\n"
+    "  convert          messages to JSON, one per line\n"
+    "  convert --from-json\n"
+    "                   JSON, one message per line, back to messages\n"
+    "\n"
+    "  -j N             threads to use (default: one per processor)\n"
+    "  -o FILE          write to FILE rather than stdout\n"
+    "  -n N             ids to list in stats (default 20)\n"
+    "  --nested         JSON for blobs that hold messages is an object\n"
+    "  --hex            JSON blobs are hex rather than base64\n"
+    "\n"
+    "file can be - for stdin.\n";
+
+static const char *type_names[] = {
+    "s8", "s16", "s32", "s64", "u8", "u16", "u32", "u64", "float", "double", "blob",
+    "half",
+};
+
+// messages handed to each thread at a time, so that what they print
+// doesn't all have to be held at once
+#define SDBTOOL_BATCH (1 << 16)
+#define SDBTOOL_MAX_THREADS (256)
+
+typedef struct options_t {
+    unsigned    threads;
+    const char *out_path;
+    size_t      top;
+    uint8_t     json_flags;
+    bool        from_json;
+} options_t;
+
+static void die(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "sdbtool: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+// text (or bytes) that grows as needed
+typedef struct text_t {
+    char  *p;
+    size_t len;
+    size_t cap;
+} text_t;
+
+static char *text_room(text_t *t, size_t more) {
+    if (t->len + more > t->cap) {
+        size_t cap = t->cap ? t->cap : 4096;
+        while (cap < t->len + more) cap *= 2;
+        t->p = realloc(t->p, cap);
+        if (!t->p) die("out of memory");
+        t->cap = cap;
+    }
+    return t->p + t->len;
+}
+
+static void text_put(text_t *t, const void *s, size_t len) {
+    memcpy(text_room(t, len), s, len);
+    t->len += len;
+}
+
+static void text_printf(text_t *t, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(text_room(t, 256), 256, fmt, ap);
+    va_end(ap);
+    if (n >= 256) {
+        va_start(ap, fmt);
+        vsnprintf(text_room(t, n + 1), n + 1, fmt, ap);
+        va_end(ap);
+    }
+    t->len += n;
+}
+
+// the whole input, mapped if it's a file and read in if it isn't
+typedef struct input_t {
+    const uint8_t *p;
+    size_t         len;
+    bool           mapped;
+} input_t;
+
+static void open_input(const char *path, input_t *in) {
+    memset(in, 0, sizeof(*in));
+    int fd = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) die("can't open %s", path);
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        in->len = st.st_size;
+        if (in->len) {
+            void *p = mmap(NULL, in->len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) die("can't map %s", path);
+            madvise(p, in->len, MADV_SEQUENTIAL);
+            in->p = p;
+            in->mapped = true;
+        }
+    } else {
+        text_t t = {};
+        ssize_t n;
+        while ((n = read(fd, text_room(&t, 1 << 16), 1 << 16)) > 0) t.len += n;
+        in->p = (const uint8_t *)t.p;
+        in->len = t.len;
+    }
+    if (fd != STDIN_FILENO) close(fd);
+}
+
+static void close_input(input_t *in) {
+    if (in->mapped) munmap((void *)in->p, in->len);
+    else            free((void *)in->p);
+}
+
+// where each message starts, and how long it is
+typedef struct msglog_t {
+    const uint8_t **msgs;
+    sdb_tlen_t     *lens;
+    size_t          n;
+} msglog_t;
+
+static void index_messages(const input_t *in, msglog_t *log) {
+    log->n = sdb_index_log(in->p, in->len, NULL, NULL, 0);
+    log->msgs = malloc((log->n ? log->n : 1) * sizeof(*log->msgs));
+    log->lens = malloc((log->n ? log->n : 1) * sizeof(*log->lens));
+    if (!log->msgs || !log->lens) die("out of memory");
+    sdb_index_log(in->p, in->len, log->msgs, log->lens, log->n);
+    size_t used = log->n ? (size_t)(log->msgs[log->n-1] + log->lens[log->n-1] - in->p) : 0;
+    if (used < in->len) {
+        fprintf(stderr, "sdbtool: %zu bytes after message %zu at %zu aren't a message\n",
+                in->len - used, log->n, used);
+    }
+}
+
+// fn(ctx, self, lo, hi) for a contiguous share of n things per thread;
+// this thread does the first share
+typedef void (*work_fn_t)(void *ctx, unsigned self, size_t lo, size_t hi);
+
+typedef struct work_t {
+    work_fn_t fn;
+    void     *ctx;
+    unsigned  self;
+    size_t    lo;
+    size_t    hi;
+} work_t;
+
+static void *run_work(void *arg) {
+    work_t *w = (work_t *)arg;
+    w->fn(w->ctx, w->self, w->lo, w->hi);
+    return NULL;
+}
+
+static void run_parallel(unsigned nthreads, size_t n, work_fn_t fn, void *ctx) {
+    work_t work[SDBTOOL_MAX_THREADS];
+    pthread_t threads[SDBTOOL_MAX_THREADS];
+    bool started[SDBTOOL_MAX_THREADS] = {};
+    for (unsigned w=0; w<nthreads; w++) {
+        work[w] = (work_t){ fn, ctx, w, n * w / nthreads, n * (w + 1) / nthreads };
+    }
+    for (unsigned w=1; w<nthreads; w++) {
+        started[w] = !pthread_create(&threads[w], NULL, run_work, &work[w]);
+        // do it here if there's no thread to do it
+        if (!started[w]) run_work(&work[w]);
+    }
+    run_work(&work[0]);
+    for (unsigned w=1; w<nthreads; w++) {
+        if (started[w]) pthread_join(threads[w], NULL);
+    }
+}
+
+// a message that holds together, or false
+static bool open_message(const msglog_t *log, size_t i, sdb_t *sdb) {
+    return !sdb_init(sdb, (void *)log->msgs[i], log->lens[i], false) &&
+           (sdb_size(sdb) <= log->lens[i]);
+}
+
+static void write_out(FILE *out, const void *p, size_t len) {
+    if (len && (fwrite(p, 1, len, out) != len)) die("can't write output");
+}
+
+// Each of the commands that print something per message fills one text
+// per thread with what its share of a batch prints, and they go out in
+// order once the batch is done.
+typedef void (*render_fn_t)(const msglog_t *log, size_t i, text_t *t, const void *arg);
+
+typedef struct render_job_t {
+    const msglog_t *log;
+    size_t          base;
+    render_fn_t     fn;
+    const void     *arg;
+    text_t         *texts;
+} render_job_t;
+
+static void render_range(void *ctx, unsigned self, size_t lo, size_t hi) {
+    render_job_t *job = (render_job_t *)ctx;
+    for (size_t i=lo; i<hi; i++) {
+        job->fn(job->log, job->base + i, &job->texts[self], job->arg);
+    }
+}
+
+static void render_all(const msglog_t *log, unsigned nthreads, FILE *out, render_fn_t fn, const void *arg) {
+    text_t texts[SDBTOOL_MAX_THREADS] = {};
+    for (size_t base=0; base<log->n; base+=SDBTOOL_BATCH) {
+        size_t n = log->n - base < SDBTOOL_BATCH ? log->n - base : SDBTOOL_BATCH;
+        render_job_t job = { log, base, fn, arg, texts };
+        run_parallel(nthreads, n, render_range, &job);
+        for (unsigned w=0; w<nthreads; w++) {
+            write_out(out, texts[w].p, texts[w].len);
+            texts[w].len = 0;
+        }
+    }
+    for (unsigned w=0; w<nthreads; w++) free(texts[w].p);
+}
+
+// dump
+
+static void dump_value(text_t *t, const sdb_member_info_t *mi, const uint8_t *p) {
+    sdb_val_t v = {};
+    memcpy(&v, p, mi->type == SDB_BLOB ? 0 : mi->elemsize);
+    switch (mi->type) {
+        case SDB_S8:     text_printf(t, " %d", v.s8); break;
+        case SDB_S16:    text_printf(t, " %d", v.s16); break;
+        case SDB_S32:    text_printf(t, " %" PRId32, v.s32); break;
+        case SDB_S64:    text_printf(t, " %" PRId64, v.s64); break;
+        case SDB_U8:     text_printf(t, " %u", v.u8); break;
+        case SDB_U16:    text_printf(t, " %u", v.u16); break;
+        case SDB_U32:    text_printf(t, " %" PRIu32, v.u32); break;
+        case SDB_U64:    text_printf(t, " %" PRIu64, v.u64); break;
+        case SDB_FLOAT:  text_printf(t, " %.9g", v.f); break;
+        case SDB_DOUBLE: text_printf(t, " %.17g", v.d); break;
+        case SDB_HALF:   text_printf(t, " %.5g", sdb_half_to_float(v.u16)); break;
+        case SDB_BLOB: {
+            // enough to tell blobs apart
+            sdb_len_t show = mi->elemsize < 32 ? mi->elemsize : 32;
+            text_put(t, " ", 1);
+            for (sdb_len_t i=0; i<show; i++) text_printf(t, "%02x", p[i]);
+            if (show < mi->elemsize) text_put(t, "...", 3);
+            break;
+        }
+        default: break;
+    }
+}
+
+static void dump_one(const msglog_t *log, size_t i, text_t *t, const void *arg) {
+    (void)arg;
+    sdb_t sdb;
+    size_t offset = log->msgs[i] - log->msgs[0];
+    text_printf(t, "message %zu at %zu, %" PRIu32 " bytes\n", i, offset, log->lens[i]);
+    if (!open_message(log, i, &sdb)) {
+        text_printf(t, "  doesn't hold together\n");
+        return;
+    }
+    const uint8_t *end = log->msgs[i] + log->lens[i];
+    for (sdb_member_info_t mi = sdb_iter(&sdb, NULL); mi.valid; mi = sdb_iter(&sdb, &mi)) {
+        if ((mi.type >= _SDB_INVALID_TYPE) || (mi.data + mi.minsize > end)) {
+            text_printf(t, "  %04x runs off the end\n", mi.id);
+            return;
+        }
+        text_printf(t, "  %04x %s", mi.id, type_names[mi.type]);
+        if (mi.type == SDB_BLOB) text_printf(t, "(%u)", mi.elemsize);
+        if (mi.elemcount != 1)   text_printf(t, "[%u]", mi.elemcount);
+        for (sdb_len_t k=0; k<mi.elemcount; k++) {
+            dump_value(t, &mi, mi.data + (size_t)k * mi.elemsize);
+        }
+        text_put(t, "\n", 1);
+    }
+}
+
+// convert and grep print JSON
+
+static void json_one(const msglog_t *log, size_t i, text_t *t, const uint8_t *flags) {
+    sdb_t sdb;
+    if (!open_message(log, i, &sdb)) {
+        fprintf(stderr, "sdbtool: message %zu doesn't hold together\n", i);
+        return;
+    }
+    // what fits in the room left over usually does it in one go
+    size_t n = 0;
+    text_room(t, 1024);
+    int8_t err = sdb_to_json(&sdb, t->p + t->len, t->cap - t->len, &n, *flags);
+    if (err == -SDB_BUFFER_TOO_SMALL) {
+        text_room(t, n + 1);
+        err = sdb_to_json(&sdb, t->p + t->len, n + 1, &n, *flags);
+    }
+    if (err) {
+        fprintf(stderr, "sdbtool: message %zu doesn't hold together\n", i);
+        return;
+    }
+    t->len += n;
+    text_put(t, "\n", 1);
+}
+
+static void convert_one(const msglog_t *log, size_t i, text_t *t, const void *arg) {
+    json_one(log, i, t, (const uint8_t *)arg);
+}
+
+typedef struct grep_t {
+    sdb_id_t id;
+    bool     any;      // just the id, whatever its value
+    bool     is_float;
+    bool     negative;
+    uint64_t u;
+    int64_t  s;
+    double   d;
+    uint8_t  flags;
+} grep_t;
+
+static bool grep_element(const grep_t *g, const sdb_member_info_t *mi, const uint8_t *p) {
+    sdb_val_t v = {};
+    memcpy(&v, p, mi->elemsize);
+    switch (mi->type) {
+        case SDB_S8:     return g->negative ? v.s8  == g->s : !g->is_float && (v.s8  >= 0) && ((uint64_t)v.s8  == g->u);
+        case SDB_S16:    return g->negative ? v.s16 == g->s : !g->is_float && (v.s16 >= 0) && ((uint64_t)v.s16 == g->u);
+        case SDB_S32:    return g->negative ? v.s32 == g->s : !g->is_float && (v.s32 >= 0) && ((uint64_t)v.s32 == g->u);
+        case SDB_S64:    return g->negative ? v.s64 == g->s : !g->is_float && (v.s64 >= 0) && ((uint64_t)v.s64 == g->u);
+        case SDB_U8:     return !g->negative && !g->is_float && (v.u8  == g->u);
+        case SDB_U16:    return !g->negative && !g->is_float && (v.u16 == g->u);
+        case SDB_U32:    return !g->negative && !g->is_float && (v.u32 == g->u);
+        case SDB_U64:    return !g->negative && !g->is_float && (v.u64 == g->u);
+        case SDB_FLOAT:  return v.f == g->d;
+        case SDB_DOUBLE: return v.d == g->d;
+        case SDB_HALF:   return sdb_half_to_float(v.u16) == g->d;
+        default:         return false;
+    }
+}
+
+static bool grep_match(const grep_t *g, const sdb_t *sdb, const uint8_t *end) {
+    sdb_member_info_t mi = sdb_find(sdb, g->id);
+    if (!mi.valid || (mi.data + mi.minsize > end)) return false;
+    if (g->any) return true;
+    if (mi.type == SDB_BLOB) return false;
+    for (sdb_len_t k=0; k<mi.elemcount; k++) {
+        if (grep_element(g, &mi, mi.data + (size_t)k * mi.elemsize)) return true;
+    }
+    return false;
+}
+
+static void grep_one(const msglog_t *log, size_t i, text_t *t, const void *arg) {
+    const grep_t *g = (const grep_t *)arg;
+    sdb_t sdb;
+    if (!open_message(log, i, &sdb) || !grep_match(g, &sdb, log->msgs[i] + log->lens[i])) return;
+    json_one(log, i, t, &g->flags);
+}
+
+static void parse_grep(const char *arg, grep_t *g) {
+    char *end;
+    unsigned long id = strtoul(arg, &end, 0);
+    if ((end == arg) || (id > 0xffff) || (*end && (*end != '='))) die("bad id in %s", arg);
+    g->id = id;
+    g->any = !*end;
+    if (g->any) return;
+    const char *v = end + 1;
+    g->negative = *v == '-';
+    errno = 0;
+    if (g->negative) g->s = strtoll(v, &end, 0);
+    else             g->u = strtoull(v, &end, 0);
+    if (*v && !*end && !errno) return;
+    // not an integer, so a float
+    g->is_float = true;
+    g->negative = false;
+    g->d = strtod(v, &end);
+    if ((end == v) || *end) die("bad value in %s", arg);
+}
+
+// stats
+
+typedef struct stats_t {
+    uint64_t msgs;
+    uint64_t bad;
+    uint64_t bytes;
+    uint64_t payload;   // what a packed struct would have held
+    uint64_t fill;      // directories and padding
+    uint64_t records;
+    uint64_t min_size;
+    uint64_t max_size;
+    uint64_t sizes[33];                       // messages by power of two
+    uint64_t types[_SDB_INVALID_TYPE][2];     // records by type, single or array
+    uint64_t *ids;                            // messages with each id
+} stats_t;
+
+typedef struct stats_job_t {
+    const msglog_t *log;
+    stats_t        *stats;
+} stats_job_t;
+
+static unsigned log2_bucket(uint64_t v) {
+    unsigned b = 0;
+    while ((b < 32) && (v >> (b + 1))) b++;
+    return b;
+}
+
+static void stats_range(void *ctx, unsigned self, size_t lo, size_t hi) {
+    stats_job_t *job = (stats_job_t *)ctx;
+    stats_t *st = &job->stats[self];
+    st->min_size = UINT64_MAX;
+    st->ids = calloc(0x10000, sizeof(uint64_t));
+    if (!st->ids) die("out of memory");
+    for (size_t i=lo; i<hi; i++) {
+        sdb_t sdb;
+        st->msgs++;
+        st->bytes += job->log->lens[i];
+        if (job->log->lens[i] < st->min_size) st->min_size = job->log->lens[i];
+        if (job->log->lens[i] > st->max_size) st->max_size = job->log->lens[i];
+        st->sizes[log2_bucket(job->log->lens[i])]++;
+        if (!open_message(job->log, i, &sdb)) {
+            st->bad++;
+            continue;
+        }
+        const uint8_t *end = job->log->msgs[i] + job->log->lens[i];
+        uint64_t held = 0;
+        for (sdb_member_info_t mi = sdb_iter(&sdb, NULL); mi.valid; mi = sdb_iter(&sdb, &mi)) {
+            if ((mi.type >= _SDB_INVALID_TYPE) || (mi.data + mi.minsize > end)) {
+                st->bad++;
+                break;
+            }
+            st->records++;
+            st->ids[mi.id]++;
+            st->types[mi.type][mi.elemcount != 1]++;
+            st->payload += mi.minsize;
+            held += (mi.data + mi.minsize) - mi.handle;
+        }
+        // whatever sdb_iter skipped over
+        st->fill += sdb.vals_size - held;
+    }
+}
+
+static void stats_merge(stats_t *into, const stats_t *from) {
+    into->msgs += from->msgs;
+    into->bad += from->bad;
+    into->bytes += from->bytes;
+    into->payload += from->payload;
+    into->fill += from->fill;
+    into->records += from->records;
+    if (from->min_size < into->min_size) into->min_size = from->min_size;
+    if (from->max_size > into->max_size) into->max_size = from->max_size;
+    for (int b=0; b<33; b++) into->sizes[b] += from->sizes[b];
+    for (int t=0; t<_SDB_INVALID_TYPE; t++) {
+        into->types[t][0] += from->types[t][0];
+        into->types[t][1] += from->types[t][1];
+    }
+    for (size_t id=0; id<0x10000; id++) into->ids[id] += from->ids[id];
+}
+
+static void print_stats(FILE *out, const stats_t *st, size_t top) {
+    fprintf(out, "messages  %" PRIu64 "", st->msgs);
+    if (st->bad) fprintf(out, " (%" PRIu64 " that don't hold together)", st->bad);
+    fprintf(out, "\nbytes     %" PRIu64 "\n", st->bytes);
+    if (!st->msgs) return;
+    fprintf(out, "size      min %" PRIu64 ", mean %.1f, max %" PRIu64 "\n",
+            st->min_size, (double)st->bytes / st->msgs, st->max_size);
+    fprintf(out, "records   %" PRIu64 ", %.1f per message\n", st->records, (double)st->records / st->msgs);
+    // the same figure sdb_debug gives for one message
+    fprintf(out, "overhead  a packed struct would have been %" PRIu64 " bytes, %.1f%% overhead\n",
+            st->payload, st->payload ? 100.0 * st->bytes / st->payload - 100 : 0.0);
+    fprintf(out, "          %.1f bytes per message, of which directory and padding %.1f\n",
+            (double)(st->bytes - st->payload) / st->msgs, (double)st->fill / st->msgs);
+
+    fprintf(out, "\nmessage sizes\n");
+    for (int b=0; b<33; b++) {
+        if (!st->sizes[b]) continue;
+        fprintf(out, "  %10" PRIu64 " - %-10" PRIu64 " %12" PRIu64 "\n",
+                (uint64_t)1 << b, ((uint64_t)2 << b) - 1, st->sizes[b]);
+    }
+
+    fprintf(out, "\ntypes         single        array\n");
+    for (int t=0; t<_SDB_INVALID_TYPE; t++) {
+        if (!st->types[t][0] && !st->types[t][1]) continue;
+        fprintf(out, "  %-6s %12" PRIu64 " %12" PRIu64 "\n", type_names[t], st->types[t][0], st->types[t][1]);
+    }
+
+    // the most common ids, most first
+    fprintf(out, "\nids           count   of messages\n");
+    bool *shown = calloc(0x10000, sizeof(bool));
+    if (!shown) die("out of memory");
+    for (size_t k=0; k<top; k++) {
+        size_t best = 0x10000;
+        for (size_t id=0; id<0x10000; id++) {
+            if (st->ids[id] && !shown[id] && ((best == 0x10000) || (st->ids[id] > st->ids[best]))) best = id;
+        }
+        if (best == 0x10000) break;
+        shown[best] = true;
+        fprintf(out, "  %04zx %12" PRIu64 " %12.1f%%\n", best, st->ids[best], 100.0 * st->ids[best] / st->msgs);
+    }
+    free(shown);
+}
+
+static void run_stats(const msglog_t *log, unsigned nthreads, FILE *out, size_t top) {
+    stats_t stats[SDBTOOL_MAX_THREADS] = {};
+    stats_job_t job = { log, stats };
+    run_parallel(nthreads, log->n, stats_range, &job);
+    stats_t all = {};
+    all.min_size = UINT64_MAX;
+    all.ids = calloc(0x10000, sizeof(uint64_t));
+    if (!all.ids) die("out of memory");
+    for (unsigned w=0; w<nthreads; w++) {
+        stats_merge(&all, &stats[w]);
+        free(stats[w].ids);
+    }
+    print_stats(out, &all, top);
+    free(all.ids);
+}
+
+// from JSON: one object per line, as convert writes them. Integers go
+// in the smallest type that holds them, the same as sdb_set_unsigned
+// and sdb_set_signed pick, other numbers and null as doubles, strings
+// as blobs, and objects as nested messages.
+
+typedef struct json_in_t {
+    const char *p;
+    const char *end;
+    bool        hex;
+    const char *err;
+} json_in_t;
+
+static void json_ws(json_in_t *in) {
+    while ((in->p < in->end) && ((*in->p == ' ') || (*in->p == '\t') || (*in->p == '\r'))) in->p++;
+}
+
+static bool json_take(json_in_t *in, char c) {
+    json_ws(in);
+    if ((in->p < in->end) && (*in->p == c)) {
+        in->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool json_fail(json_in_t *in, const char *err) {
+    if (!in->err) in->err = err;
+    return false;
+}
+
+typedef struct json_num_t {
+    bool     is_float;
+    bool     negative;
+    uint64_t u;
+    int64_t  s;
+    double   d;
+} json_num_t;
+
+static bool json_number(json_in_t *in, json_num_t *num) {
+    json_ws(in);
+    memset(num, 0, sizeof(*num));
+    if ((in->end - in->p >= 4) && !memcmp(in->p, "null", 4)) {
+        in->p += 4;
+        num->is_float = true;
+        num->d = NAN;
+        return true;
+    }
+    const char *start = in->p;
+    if ((in->p < in->end) && (*in->p == '-')) in->p++;
+    while ((in->p < in->end) && strchr("0123456789.eE+-", *in->p)) {
+        if (strchr(".eE", *in->p)) num->is_float = true;
+        in->p++;
+    }
+    char tmp[64];
+    size_t len = in->p - start;
+    if (!len || (len >= sizeof(tmp))) return json_fail(in, "bad number");
+    memcpy(tmp, start, len);
+    tmp[len] = 0;
+    char *end;
+    num->negative = tmp[0] == '-';
+    if (num->is_float) {
+        num->d = strtod(tmp, &end);
+    } else if (num->negative) {
+        errno = 0;
+        num->s = strtoll(tmp, &end, 10);
+        if (errno) return json_fail(in, "integer out of range");
+    } else {
+        errno = 0;
+        num->u = strtoull(tmp, &end, 10);
+        if (errno) return json_fail(in, "integer out of range");
+    }
+    if (*end) return json_fail(in, "bad number");
+    return true;
+}
+
+static int8_t json_digit(char c) {
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+static int8_t json_b64(char c) {
+    if ((c >= 'A') && (c <= 'Z')) return c - 'A';
+    if ((c >= 'a') && (c <= 'z')) return c - 'a' + 26;
+    if ((c >= '0') && (c <= '9')) return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// a string of base64 or hex into a blob
+static bool json_blob(json_in_t *in, sdb_t *sdb, sdb_id_t id) {
+    const char *s = ++in->p;
+    while ((in->p < in->end) && (*in->p != '"')) in->p++;
+    if (in->p == in->end) return json_fail(in, "unterminated string");
+    size_t len = in->p++ - s;
+    size_t max = in->hex ? len / 2 : len / 4 * 3;
+    if (max > 0xffff) return json_fail(in, "blob too big");
+    int8_t err = 0;
+    uint8_t *b = sdb_reserve_blob(sdb, id, max, &err);
+    if (!b) return json_fail(in, "message too big");
+    size_t n = 0;
+    if (in->hex) {
+        if (len % 2) return json_fail(in, "bad hex");
+        for (size_t i=0; i<len; i+=2) {
+            int8_t hi = json_digit(s[i]), lo = json_digit(s[i+1]);
+            if ((hi < 0) || (lo < 0)) return json_fail(in, "bad hex");
+            b[n++] = (hi << 4) | lo;
+        }
+    } else {
+        if (len % 4) return json_fail(in, "bad base64");
+        for (size_t i=0; i<len; i+=4) {
+            uint32_t x = 0;
+            int pad = 0;
+            for (int k=0; k<4; k++) {
+                int8_t d = json_b64(s[i+k]);
+                if ((s[i+k] == '=') && (i + 4 == len) && (k >= 2)) {
+                    pad++;
+                    d = 0;
+                } else if ((d < 0) || pad) {
+                    return json_fail(in, "bad base64");
+                }
+                x = (x << 6) | d;
+            }
+            b[n++] = x >> 16;
+            if (pad < 2) b[n++] = x >> 8;
+            if (pad < 1) b[n++] = x;
+        }
+    }
+    if (sdb_shrink(sdb, id, n)) return json_fail(in, "message too big");
+    return true;
+}
+
+static bool json_object(json_in_t *in, sdb_t *sdb, int depth);
+
+// a list of numbers, in the narrowest type that holds them all
+static bool json_list(json_in_t *in, sdb_t *sdb, sdb_id_t id) {
+    size_t cap = 16, n = 0;
+    json_num_t *nums = malloc(cap * sizeof(*nums));
+    if (!nums) die("out of memory");
+    bool ok = true;
+    if (!json_take(in, ']')) {
+        do {
+            if (n == cap) {
+                cap *= 2;
+                nums = realloc(nums, cap * sizeof(*nums));
+                if (!nums) die("out of memory");
+            }
+            json_ws(in);
+            if ((in->p < in->end) && ((*in->p == '"') || (*in->p == '{'))) {
+                ok = json_fail(in, "lists of blobs can't be written from C");
+                break;
+            }
+            if (!(ok = json_number(in, &nums[n++]))) break;
+        } while (json_take(in, ','));
+        if (ok && !json_take(in, ']')) ok = json_fail(in, "expected ]");
+    }
+    if (ok && (n > 0xffff)) ok = json_fail(in, "list too long");
+    if (!ok) {
+        free(nums);
+        return false;
+    }
+
+    bool any_float = false, any_negative = false;
+    uint64_t umax = 0;
+    int64_t smin = 0, smax = 0;
+    for (size_t i=0; i<n; i++) {
+        if (nums[i].is_float) {
+            any_float = true;
+        } else if (nums[i].negative) {
+            any_negative = true;
+            if (nums[i].s < smin) smin = nums[i].s;
+        } else {
+            if (nums[i].u > umax) umax = nums[i].u;
+        }
+    }
+    sdbtypes_t type;
+    if (any_float) {
+        type = SDB_DOUBLE;
+    } else if (any_negative) {
+        if (umax > INT64_MAX) {
+            free(nums);
+            return json_fail(in, "list doesn't fit a signed type");
+        }
+        smax = umax;
+        type = ((smin >= INT8_MIN) && (smax <= INT8_MAX))   ? SDB_S8 :
+               ((smin >= INT16_MIN) && (smax <= INT16_MAX)) ? SDB_S16 :
+               ((smin >= INT32_MIN) && (smax <= INT32_MAX)) ? SDB_S32 : SDB_S64;
+    } else {
+        type = umax <= UINT8_MAX ? SDB_U8 : umax <= UINT16_MAX ? SDB_U16 : umax <= UINT32_MAX ? SDB_U32 : SDB_U64;
+    }
+    int8_t err = 0;
+    uint8_t *p = sdb_reserve_array(sdb, id, type, n, &err);
+    if (!p) {
+        free(nums);
+        return json_fail(in, "message too big");
+    }
+    for (size_t i=0; i<n; i++) {
+        sdb_val_t v = {};
+        const json_num_t *x = &nums[i];
+        if (type == SDB_DOUBLE) v.d = x->is_float ? x->d : x->negative ? (double)x->s : (double)x->u;
+        else if (x->negative)   v.s64 = x->s;
+        else                    v.u64 = x->u;
+        // little end first, as sdb writes it on the hosts this runs on
+        uint8_t size = (type == SDB_DOUBLE) ? 8 : (uint8_t)(1 << (type % 4));
+        memcpy(p + i * size, &v, size);
+    }
+    free(nums);
+    return true;
+}
+
+static bool json_value(json_in_t *in, sdb_t *sdb, sdb_id_t id, int depth) {
+    json_ws(in);
+    if (in->p == in->end) return json_fail(in, "expected a value");
+    if (*in->p == '"') return json_blob(in, sdb, id);
+    if (json_take(in, '[')) return json_list(in, sdb, id);
+    if (*in->p == '{') {
+        if (depth >= SDB_JSON_MAX_DEPTH) return json_fail(in, "nested too deep");
+        sdb_t child;
+        if (sdb_begin_nested(sdb, id, &child)) return json_fail(in, "message too big");
+        if (!json_object(in, &child, depth + 1)) return false;
+        if (sdb_end_nested(sdb, &child)) return json_fail(in, "message too big");
+        return true;
+    }
+    json_num_t num;
+    if (!json_number(in, &num)) return false;
+    int8_t err;
+    if (num.is_float)      err = sdb_set_val(sdb, id, SDB_DOUBLE, &num.d);
+    else if (num.negative) err = sdb_set_signed(sdb, id, num.s);
+    else                   err = sdb_set_unsigned(sdb, id, num.u);
+    return err ? json_fail(in, "message too big") : true;
+}
+
+static bool json_object(json_in_t *in, sdb_t *sdb, int depth) {
+    if (!json_take(in, '{')) return json_fail(in, "expected {");
+    if (json_take(in, '}')) return true;
+    do {
+        if (!json_take(in, '"')) return json_fail(in, "expected an id");
+        unsigned long id = 0;
+        const char *start = in->p;
+        while ((in->p < in->end) && (*in->p >= '0') && (*in->p <= '9') && (id <= 0xffff)) {
+            id = id * 10 + (*in->p++ - '0');
+        }
+        if ((in->p == start) || (id > 0xffff) || !json_take(in, '"')) return json_fail(in, "ids are numbers up to 65535");
+        if (!json_take(in, ':')) return json_fail(in, "expected :");
+        if (!json_value(in, sdb, id, depth)) return false;
+    } while (json_take(in, ','));
+    if (!json_take(in, '}')) return json_fail(in, "expected }");
+    return true;
+}
+
+typedef struct lines_t {
+    const char **starts;
+    size_t      *lens;
+    size_t       n;
+} lines_t;
+
+typedef struct from_json_job_t {
+    const lines_t *lines;
+    size_t         base;
+    bool           hex;
+    text_t        *outs;
+    text_t        *scratch;
+    size_t        *failed;  // first line that failed, per thread
+    const char   **errs;
+} from_json_job_t;
+
+static void from_json_range(void *ctx, unsigned self, size_t lo, size_t hi) {
+    from_json_job_t *job = (from_json_job_t *)ctx;
+    text_t *out = &job->outs[self];
+    text_t *scratch = &job->scratch[self];
+    for (size_t i=lo; i<hi; i++) {
+        size_t line = job->base + i;
+        json_in_t in = { job->lines->starts[line], job->lines->starts[line] + job->lines->lens[line], job->hex, NULL };
+        // a message never needs more than four bytes per character of
+        // its JSON, which is eight digit u64s in a list of "0,"s
+        size_t room = 4 * job->lines->lens[line] + 64;
+        if (room > UINT32_MAX) room = UINT32_MAX;
+        scratch->len = 0;
+        text_room(scratch, room);
+        sdb_t sdb;
+        sdb_init(&sdb, scratch->p, room, true);
+        bool ok = json_object(&in, &sdb, 0);
+        json_ws(&in);
+        if (ok && (in.p != in.end)) ok = json_fail(&in, "junk after the object");
+        if (!ok) {
+            job->failed[self] = line;
+            job->errs[self] = in.err;
+            return;
+        }
+        text_put(out, scratch->p, sdb_size(&sdb));
+    }
+}
+
+static void run_from_json(const input_t *in, unsigned nthreads, FILE *out, bool hex) {
+    lines_t lines = {};
+    size_t cap = 1024;
+    lines.starts = malloc(cap * sizeof(*lines.starts));
+    lines.lens = malloc(cap * sizeof(*lines.lens));
+    const char *p = (const char *)in->p, *end = p + in->len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        const char *q = p;
+        while ((q < nl) && ((*q == ' ') || (*q == '\t') || (*q == '\r'))) q++;
+        if (q < nl) {
+            if (lines.n == cap) {
+                cap *= 2;
+                lines.starts = realloc(lines.starts, cap * sizeof(*lines.starts));
+                lines.lens = realloc(lines.lens, cap * sizeof(*lines.lens));
+            }
+            if (!lines.starts || !lines.lens) die("out of memory");
+            lines.starts[lines.n] = p;
+            lines.lens[lines.n++] = nl - p;
+        }
+        p = nl + 1;
+    }
+
+    text_t outs[SDBTOOL_MAX_THREADS] = {}, scratch[SDBTOOL_MAX_THREADS] = {};
+    size_t failed[SDBTOOL_MAX_THREADS];
+    const char *errs[SDBTOOL_MAX_THREADS];
+    for (size_t base=0; base<lines.n; base+=SDBTOOL_BATCH) {
+        size_t n = lines.n - base < SDBTOOL_BATCH ? lines.n - base : SDBTOOL_BATCH;
+        for (unsigned w=0; w<nthreads; w++) failed[w] = SIZE_MAX;
+        from_json_job_t job = { &lines, base, hex, outs, scratch, failed, errs };
+        run_parallel(nthreads, n, from_json_range, &job);
+        for (unsigned w=0; w<nthreads; w++) {
+            write_out(out, outs[w].p, outs[w].len);
+            outs[w].len = 0;
+            if (failed[w] != SIZE_MAX) {
+                // the line number, counting blank ones too
+                size_t lineno = 1;
+                for (const char *c = (const char *)in->p; c < lines.starts[failed[w]]; c++) lineno += *c == '\n';
+                die("line %zu: %s", lineno, errs[w] ? errs[w] : "can't be made into a message");
+            }
+        }
+    }
+    for (unsigned w=0; w<nthreads; w++) {
+        free(outs[w].p);
+        free(scratch[w].p);
+    }
+    free(lines.starts);
+    free(lines.lens);
+}
+
+int main(int argc, char *argv[]) {
+    options_t opt = { 0, NULL, 20, 0, false };
+    const char *args[3];
+    int nargs = 0;
+    for (int i=1; i<argc; i++) {
+        const char *a = argv[i];
+        if (!strcmp(a, "-j") && (i + 1 < argc))      opt.threads = atoi(argv[++i]);
+        else if (!strcmp(a, "-o") && (i + 1 < argc)) opt.out_path = argv[++i];
+        else if (!strcmp(a, "-n") && (i + 1 < argc)) opt.top = atoi(argv[++i]);
+        else if (!strcmp(a, "--nested"))            opt.json_flags |= SDB_JSON_NESTED;
+        else if (!strcmp(a, "--hex"))               opt.json_flags |= SDB_JSON_HEX;
+        else if (!strcmp(a, "--from-json"))         opt.from_json = true;
+        else if (!strcmp(a, "-h") || !strcmp(a, "--help")) {
+            fputs(usage, stdout);
+            return 0;
+        } else if (((a[0] != '-') || !a[1]) && (nargs < 3)) {
+            args[nargs++] = a;
+        } else {
+            fputs(usage, stderr);
+            return 1;
+        }
+    }
+    const char *cmd = nargs ? args[0] : "";
+    bool is_grep = !strcmp(cmd, "grep");
+    if (nargs != (is_grep ? 3 : 2)) {
+        fputs(usage, stderr);
+        return 1;
+    }
+    if (!opt.threads) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        opt.threads = ncpu > 0 ? ncpu : 1;
+    }
+    if (opt.threads > SDBTOOL_MAX_THREADS) opt.threads = SDBTOOL_MAX_THREADS;
+
+    grep_t g = {};
+    if (is_grep) {
+        parse_grep(args[1], &g);
+        g.flags = opt.json_flags;
+    }
+    FILE *out = stdout;
+    if (opt.out_path && !(out = fopen(opt.out_path, "wb"))) die("can't write %s", opt.out_path);
+
+    input_t in;
+    open_input(args[nargs - 1], &in);
+    if (!strcmp(cmd, "convert") && opt.from_json) {
+        run_from_json(&in, opt.threads, out, opt.json_flags & SDB_JSON_HEX);
+    } else {
+        msglog_t log;
+        index_messages(&in, &log);
+        if (!strcmp(cmd, "dump"))          render_all(&log, opt.threads, out, dump_one, NULL);
+        else if (!strcmp(cmd, "convert"))  render_all(&log, opt.threads, out, convert_one, &opt.json_flags);
+        else if (is_grep)                  render_all(&log, opt.threads, out, grep_one, &g);
+        else if (!strcmp(cmd, "stats"))    run_stats(&log, opt.threads, out, opt.top);
+        else die("no such command: %s", cmd);
+        free(log.msgs);
+        free(log.lens);
+    }
+    close_input(&in);
+    if (fclose(out)) die("can't write output");
+    return 0;
+}
@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <float.h>
+#include <math.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
 #include "sdbuf.h"
 
-#define SDB_LEN_SZ       (sizeof(sdb_len_t))
 #define SDB_TLEN_SZ      (sizeof(sdb_tlen_t))
 #define SDB_HDR_SZ       (sizeof(sdb_hdr_t))
 #define SDB_HDR_OFFSET   (0)
@@ -13,6 +17,75 @@
 #define SDB_COUNT_T_SZ   (sizeof(sdb_len_t))
 #define SDB_ARRAY_T_FLAG (0x80)
 #define SDB_ID_SZ        (sizeof(sdb_id_t))
+#define SDB_DIR_ENTRY_SZ (SDB_ID_SZ + SDB_TLEN_SZ)
+
+#if SDB_INCL_STATS
+static _Thread_local sdb_stats_t sdb_stats;
+
+static void sdb_stat_scan(uint32_t n) {
+    uint8_t b = 0;
+    while (n && (b < SDB_STATS_SCAN_BUCKETS - 1)) {
+        n >>= 1;
+        b++;
+    }
+    sdb_stats.scans[b]++;
+}
+
+static void sdb_stat_lookup(sdb_id_t id, bool hit) {
+    // open addressing, with no room to grow; once the table is full, ids
+    // not already in it are only counted in other_hits and other_misses
+    uint16_t h = (uint16_t)(id * 40503u) % SDB_STATS_IDS;
+    for (uint16_t i=0; i<SDB_STATS_IDS; i++) {
+        uint16_t j = (h + i) % SDB_STATS_IDS;
+        if (!sdb_stats.ids[j].hits && !sdb_stats.ids[j].misses) {
+            sdb_stats.ids[j].id = id;
+        }
+        if (sdb_stats.ids[j].id == id) {
+            if (hit) sdb_stats.ids[j].hits++;
+            else     sdb_stats.ids[j].misses++;
+            return;
+        }
+    }
+    if (hit) sdb_stats.other_hits++;
+    else     sdb_stats.other_misses++;
+}
+
+void sdb_stats_get(sdb_stats_t *stats) {
+    memcpy(stats, &sdb_stats, sizeof(sdb_stats));
+}
+
+void sdb_stats_reset(void) {
+    memset(&sdb_stats, 0, sizeof(sdb_stats));
+}
+
+size_t sdb_stats_hot_ids(sdb_id_t *ids, size_t max) {
+    bool taken[SDB_STATS_IDS] = {};
+    size_t n = 0;
+    while (n < max) {
+        int best = -1;
+        for (int i=0; i<SDB_STATS_IDS; i++) {
+            if (taken[i] || !sdb_stats.ids[i].hits) continue;
+            if ((best < 0) || (sdb_stats.ids[i].hits > sdb_stats.ids[best].hits)) best = i;
+        }
+        if (best < 0) break;
+        taken[best] = true;
+        ids[n++] = sdb_stats.ids[best].id;
+    }
+    return n;
+}
+
+#define SDB_STAT(x) x
+#else
+#define SDB_STAT(x)
+#endif
+
+// every error starts here, so that it can be counted
+static int8_t sdb_err(int8_t err) {
+#if SDB_INCL_STATS
+    if ((err < 0) && (-err < SDB_STATS_ERRORS)) sdb_stats.errors[-err]++;
+#endif
+    return err;
+}
 
 // Struct description:
 //
@@ -59,14 +132,14 @@ static const uint8_t sdbtype_sizes[] = {
     sizeof(int8_t), sizeof(int16_t), sizeof(int32_t), sizeof(int64_t),
     sizeof(uint8_t), sizeof(uint16_t), sizeof(uint32_t), sizeof(uint64_t),
     sizeof(float), sizeof(double),
-    0, 0,
+    0, sizeof(uint16_t), 0,
 };
 
 static const char *sdbtype_names[] = {
     "s8","s16","s32","s64",
     "u8","u16","u32","u64",
     "float", "double",
-    "blob", "_invalid",
+    "blob", "half", "_invalid",
 };
 
 static void sdb_rewrite_sizes(sdb_t *sdb) {
@@ -76,14 +149,92 @@ static void sdb_rewrite_sizes(sdb_t *sdb) {
     memcpy(&sdb->vals_size,(uint8_t *)sdb->buf + SDB_TLEN_OFFSET, SDB_TLEN_SZ);
 }
 
+// end of the values actually held in the buffer. This is short of
+// what vals_size says when blobs are held by reference.
+static uint8_t *sdb_vals_end(const sdb_t *sdb) {
+    return (uint8_t *)sdb->buf + SDB_VALS_OFFSET + sdb->vals_size - sdb->ext_size;
+}
+
+static uint8_t *sdb_parse_record(uint8_t *p, sdb_member_info_t *mi);
+static uint8_t *sdb_record_at(const sdb_t *sdb, uint8_t *p, sdb_member_info_t *mi);
+static sdb_tlen_t sdb_record_header_size(const uint8_t *p);
+
+// step over one record, pointing mi->data at the caller's memory if
+// the payload is held by reference. "ref" tracks the next ref to expect
+// and should start at zero.
+static uint8_t *sdb_next_record(const sdb_t *sdb, uint8_t *p, sdb_member_info_t *mi, uint16_t *ref) {
+    uint8_t *next = sdb_parse_record(p, mi);
+    if ((*ref < sdb->nrefs) &&
+        (sdb->refs[*ref].offset == (sdb_tlen_t)(mi->data - (uint8_t *)sdb->buf))) {
+        next = (uint8_t *)mi->data;
+        mi->data = (const uint8_t *)sdb->refs[*ref].data;
+        *ref += 1;
+    }
+    return next;
+}
+
+// a set of ids, one bit per possible id
+typedef struct sdb_idset_t {
+    uint32_t bits[((sdb_id_t)(0 - 1) + 1) / 32];
+} sdb_idset_t;
+
+static void sdb_idset_clear(sdb_idset_t *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+static bool sdb_idset_has(const sdb_idset_t *set, sdb_id_t id) {
+    return (set->bits[id >> 5] >> (id & 0x1f)) & 1;
+}
+
+// add id, and report whether it was already there
+static bool sdb_idset_add(sdb_idset_t *set, sdb_id_t id) {
+    bool had = sdb_idset_has(set, id);
+    set->bits[id >> 5] |= (uint32_t)1 << (id & 0x1f);
+    return had;
+}
+
+// remove id, and report whether it was there
+static bool sdb_idset_take(sdb_idset_t *set, sdb_id_t id) {
+    bool had = sdb_idset_has(set, id);
+    set->bits[id >> 5] &= ~((uint32_t)1 << (id & 0x1f));
+    return had;
+}
+
+// up to this many ids are looked for by scanning them; clearing an
+// sdb_idset_t only pays off for more
+#define SDB_ID_SCAN_MAX (32)
+
+// ids in a bitmap if there is one, otherwise in a short list
+typedef struct sdb_idlist_t {
+    const sdb_idset_t *set;
+    const sdb_id_t    *ids;
+    size_t             n;
+} sdb_idlist_t;
+
+static bool sdb_idlist_has(const sdb_idlist_t *l, sdb_id_t id) {
+    if (l->set) return sdb_idset_has(l->set, id);
+    for (size_t i=0; i<l->n; i++) {
+        if (l->ids[i] == id) return true;
+    }
+    return false;
+}
+
 static uint32_t u64_32h(uint64_t u) { return (u >> 32); }   
 static uint32_t u64_32l(uint64_t u) { return (u & 0xffffffff); }   
 
 int8_t sdb_init(sdb_t *sdb, void *b, const sdb_tlen_t l, bool clear) {
     sdb->buf = b;
     sdb->len = l;
+    sdb->readonly = false;
+    sdb->refs = NULL;
+    sdb->nrefs = 0;
+    sdb->max_refs = 0;
+    sdb->ext_size = 0;
+    memset(sdb->filter, 0, sizeof(sdb->filter));
+    // nothing in it yet, so the empty filter is right
+    sdb->filtered = clear;
     if (l < SDB_VALS_OFFSET) {
-        return -SDB_BUFFER_TOO_SMALL;
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
     }
     const sdb_hdr_t vheader = SDB_ID_VAL;
     if (clear) {
@@ -94,16 +245,45 @@ int8_t sdb_init(sdb_t *sdb, void *b, const sdb_tlen_t l, bool clear) {
         sdb_hdr_t iheader;
         memcpy(&iheader, (uint8_t *)b + SDB_HDR_OFFSET, SDB_HDR_SZ);
         // only check major and endianness
-        if ((iheader & 0xf8) != (vheader & 0xf8)) return -SDB_WRONG_VERSION;
+        if ((iheader & 0xf8) != (vheader & 0xf8)) return sdb_err(-SDB_WRONG_VERSION);
     }
     sdb_rewrite_sizes(sdb);
     return SDB_OK;
 }
 
+// records that are about the layout of the message rather than in it
+static bool sdb_is_filler(sdb_id_t id) {
+    return (id == SDB_ID_DIRECTORY) || (id == SDB_ID_PAD);
+}
+
 void sdb_show_mi(const sdb_member_info_t *mi) {
     printf("mi: id %04x type %01x size %02x count %04x tsize %08"PRIx32" handle %p %s\n",
         mi->id, mi->type, mi->elemsize, mi->elemcount, mi->minsize, mi->handle, mi->valid ? "valid" : "not valid");
 }
+static const char *const *sdb_names = NULL;
+static size_t sdb_nnames = 0;
+
+void sdb_debug_names(const char *const *names, size_t n) {
+    sdb_names = names;
+    sdb_nnames = names ? n : 0;
+}
+
+// FNV-1a, folded to 16 bits and kept below the reserved ids
+sdb_id_t sdb_name_id(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    }
+    return (sdb_id_t)(((h >> 16) ^ (h & 0xffff)) % SDB_ID_RESERVED);
+}
+
+static const char *sdb_debug_name(sdb_id_t id) {
+    for (size_t i=0; i<sdb_nnames; i++) {
+        if (sdb_name_id(sdb_names[i]) == id) return sdb_names[i];
+    }
+    return "";
+}
+
 void sdb_debug(const sdb_t *sdb) {
     printf("-d- sdb DEBUG\n");
     printf("-d- ---------\n");
@@ -112,37 +292,30 @@ void sdb_debug(const sdb_t *sdb) {
         sdb->vals_size, total_size);
     printf("-d- ---------\n");
     uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
     sdb_tlen_t total_dsize = 0;
-    while ((p < ((uint8_t *)sdb->buf + sdb->len)) && 
-           (p < ((uint8_t *)sdb->buf + SDB_VALS_OFFSET + sdb->vals_size))) {
-        sdb_id_t id = 0;
-        memcpy(&id, p, SDB_ID_SZ);
-        p += SDB_ID_SZ;
-        sdbtypes_t type = _SDB_INVALID_TYPE;
-        memcpy(&type,p,sizeof(sdbtypes_t));
-        uint8_t is_array = type & SDB_ARRAY_T_FLAG;
-        type &= ~SDB_ARRAY_T_FLAG;
-        p += sizeof(sdbtypes_t);
-        sdb_len_t count = 1;
-        sdb_len_t dsize = 0;
-        if (type == SDB_BLOB) {
-            memcpy(&dsize, p, SDB_BLOB_T_SZ);
-            p += SDB_BLOB_T_SZ;
-        } else {
-            dsize = sdbtype_sizes[type];
+    sdb_tlen_t total_fill = 0;
+    while ((p < ((uint8_t *)sdb->buf + sdb->len)) && (p < pend)) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(sdb, p, &mi, &ref);
+        sdb_id_t id = mi.id;
+        sdbtypes_t type = mi.type;
+        sdb_len_t count = mi.elemcount;
+        sdb_len_t dsize = mi.elemsize;
+        const uint8_t *pd = mi.data;
+        if (sdb_is_filler(id)) {
+            total_fill += p - mi.handle;
+            continue;
         }
-        if (is_array) {
-            memcpy(&count,p,SDB_COUNT_T_SZ);
-            p += SDB_COUNT_T_SZ;
-        };
         total_dsize += count * dsize;
 
         for (sdb_len_t i=0; i<count; i++) {
             sdb_val_t d = {};
             if (type != SDB_BLOB) {
-                memcpy(&d, p, dsize);
+                memcpy(&d, pd, dsize);
             }
-            p += dsize;
+            pd += dsize;
             char nstr[30];
             memset(nstr,0,30);
             switch (type) {
@@ -160,12 +333,14 @@ void sdb_debug(const sdb_t *sdb) {
 #if SDB_INCL_FLOAT
                 case SDB_FLOAT:  sprintf(nstr,"%f",d.f); break;
                 case SDB_DOUBLE: sprintf(nstr,"%f",d.d); break;
+                case SDB_HALF:   sprintf(nstr,"%f",sdb_half_to_float(d.u16)); break;
 #endif
                 case SDB_BLOB:   sprintf(nstr,"%u bytes",dsize); break;
                 default: break;
             }                 
-            printf("-d- %04"PRIx16": %4s : %"PRIu16"/%"PRIu16" : %-20s : 0x%08"PRIx32"_%08"PRIx32"\n",
-                id, sdbtype_names[type], i, count, nstr,
+            const char *name = sdb_debug_name(id);
+            printf("-d- %04"PRIx16"%s%s: %4s : %"PRIu16"/%"PRIu16" : %-20s : 0x%08"PRIx32"_%08"PRIx32"\n",
+                id, *name ? " " : "", name, sdbtype_names[type], i, count, nstr,
                 type == SDB_BLOB ? 0     : u64_32h(d.u64),
                 type == SDB_BLOB ? dsize : u64_32l(d.u64)
             );
@@ -176,64 +351,224 @@ void sdb_debug(const sdb_t *sdb) {
     overhead_pct -= 100;
     printf("-d- packed struct would have been: %u bytes. %u%% overhead\n",
         total_dsize, overhead_pct);
+    if (total_fill) {
+        printf("-d- of which directory and padding: %u bytes\n", total_fill);
+    }
 
 };
 
 
-static uint8_t *sdb_find_internal(const sdb_t *sdb, sdb_id_t id, sdb_member_info_t *mi, uint8_t **next) {
-    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
-    uint8_t *pfound = 0;
-    while (!pfound && ((uint8_t *)p < (uint8_t *)sdb->buf + SDB_VALS_OFFSET + sdb->vals_size)) {
-        memcpy(&mi->id, p, SDB_ID_SZ);
-        if (mi->id == id) {
-            mi->handle = p;
-            pfound = p;
-        }
-        p += SDB_ID_SZ;
-        memcpy(&mi->type,p,sizeof(sdbtypes_t));
-        p += sizeof(sdbtypes_t);
-        bool is_array = mi->type & SDB_ARRAY_T_FLAG;
-        mi->type &= ~SDB_ARRAY_T_FLAG;
-        
-        if (mi->type == SDB_BLOB) {
-            memcpy(&mi->elemsize,p,SDB_BLOB_T_SZ);
-            p += SDB_BLOB_T_SZ;
+// decode the record header at p into mi and return a pointer to
+// the record that follows it
+static uint8_t *sdb_parse_record(uint8_t *p, sdb_member_info_t *mi) {
+    mi->handle = p;
+    memcpy(&mi->id, p, SDB_ID_SZ);
+    p += SDB_ID_SZ;
+    memcpy(&mi->type,p,sizeof(sdbtypes_t));
+    p += sizeof(sdbtypes_t);
+    bool is_array = mi->type & SDB_ARRAY_T_FLAG;
+    mi->type &= ~SDB_ARRAY_T_FLAG;
+
+    if (mi->type == SDB_BLOB) {
+        memcpy(&mi->elemsize,p,SDB_BLOB_T_SZ);
+        p += SDB_BLOB_T_SZ;
+    } else {
+        mi->elemsize = sdbtype_sizes[mi->type];
+    }
+
+    mi->elemcount = 1;
+    if (is_array) {
+        memcpy(&mi->elemcount,p,SDB_COUNT_T_SZ);
+        p += SDB_COUNT_T_SZ;
+    }
+
+    mi->data = p;
+    mi->minsize = mi->elemcount * mi->elemsize;
+    return p + mi->minsize;
+}
+
+// two bits per id out of 256
+static uint16_t sdb_filter_hash(sdb_id_t id) {
+    return (uint16_t)(id * 40503u);
+}
+
+static void sdb_filter_add(sdb_t *sdb, sdb_id_t id) {
+    uint16_t h = sdb_filter_hash(id);
+    sdb->filter[(h & 0xff) >> 5] |= 1u << (h & 0x1f);
+    sdb->filter[h >> 13]         |= 1u << ((h >> 8) & 0x1f);
+}
+
+static bool sdb_filter_may_have(const sdb_t *sdb, sdb_id_t id) {
+    if (!sdb->filtered) return true;
+    uint16_t h = sdb_filter_hash(id);
+    return (sdb->filter[(h & 0xff) >> 5] & (1u << (h & 0x1f))) &&
+           (sdb->filter[h >> 13]         & (1u << ((h >> 8) & 0x1f)));
+}
+
+// binary search the directory. Offsets are to where records are on the
+// wire, which is only where they are in the buffer if nothing is held by
+// reference.
+static uint8_t *sdb_find_directory(const sdb_t *sdb, sdb_id_t id, sdb_member_info_t *mi, uint8_t **next) {
+    uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    *next = pend;
+    sdb_member_info_t dmi = {};
+    if (pvals + SDB_ID_SZ > pend) return NULL;
+    sdb_parse_record(pvals, &dmi);
+    if ((dmi.id != SDB_ID_DIRECTORY) || (dmi.type != SDB_BLOB)) return NULL;
+
+    size_t lo = 0, hi = dmi.minsize / SDB_DIR_ENTRY_SZ;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const uint8_t *pentry = dmi.data + mid * SDB_DIR_ENTRY_SZ;
+        sdb_id_t eid;
+        memcpy(&eid, pentry, SDB_ID_SZ);
+        if (eid < id) {
+            lo = mid + 1;
+        } else if (eid > id) {
+            hi = mid;
         } else {
-            mi->elemsize = sdbtype_sizes[mi->type];
+            sdb_tlen_t offset;
+            memcpy(&offset, pentry + SDB_ID_SZ, SDB_TLEN_SZ);
+            uint8_t *p = pvals + offset;
+            if (p + SDB_ID_SZ > pend) return NULL;
+            *next = sdb_parse_record(p, mi);
+            if (mi->id != id) return NULL;
+            mi->valid = true;
+            return p;
         }
+    }
+    return NULL;
+}
 
-        mi->elemcount = 1;
-        if (is_array) {
-            memcpy(&mi->elemcount,p,SDB_COUNT_T_SZ);
-            p += SDB_COUNT_T_SZ;
+static uint8_t *sdb_find_internal(const sdb_t *sdb, sdb_id_t id, sdb_member_info_t *mi, uint8_t **next) {
+    if ((sdb->header & SDB_HDR_DIRECTORY) && !sdb->nrefs) {
+        uint8_t *pfound = sdb_find_directory(sdb, id, mi, next);
+        SDB_STAT(sdb_stat_scan(1));
+        if (!pfound) {
+            mi->handle = NULL;
+            mi->data = NULL;
+            mi->type = _SDB_INVALID_TYPE;
         }
+        return pfound;
+    }
 
-        mi->minsize = mi->elemcount * mi->elemsize;
-        p += mi->minsize;
-
-        if (pfound) {
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
+    bool sorted = sdb->header & SDB_HDR_SORTED;
+    uint32_t scanned = 0;
+    while (p < pend) {
+        uint8_t *pthis = p;
+        p = sdb_next_record(sdb, p, mi, &ref);
+        scanned++;
+        if (mi->id == id) {
+            SDB_STAT(sdb_stat_scan(scanned));
             *next = p;
             mi->valid = true;
-            return pfound;
+            return pthis;
+        }
+        if (sorted && (mi->id > id) && !sdb_is_filler(mi->id)) {
+            // not here. Point at where it would go instead.
+            p = pthis;
+            break;
         }
     }
+    SDB_STAT(sdb_stat_scan(scanned));
     *next = p;
+    mi->handle = NULL;
+    mi->data = NULL;
     mi->type = _SDB_INVALID_TYPE;
     return NULL;
 }
 
 sdb_member_info_t sdb_find(const sdb_t *sdb, sdb_id_t id) {
     sdb_member_info_t mi = {};
+    if (!sdb_filter_may_have(sdb, id)) {
+        SDB_STAT(sdb_stat_scan(0));
+        SDB_STAT(sdb_stat_lookup(id, false));
+        mi.type = _SDB_INVALID_TYPE;
+        return mi;
+    }
     uint8_t *next = 0;
     sdb_find_internal(sdb, id, &mi, &next);
+    SDB_STAT(sdb_stat_lookup(id, mi.valid));
+    return mi;
+}
+
+sdb_member_info_t sdb_iter(const sdb_t *sdb, const sdb_member_info_t *prev) {
+    sdb_member_info_t mi = {};
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    if (prev && prev->valid && prev->handle) {
+        p = sdb_record_at(sdb, (uint8_t *)prev->handle, &mi);
+    }
+    while (p < pend) {
+        p = sdb_record_at(sdb, p, &mi);
+        if (!sdb_is_filler(mi.id)) {
+            mi.valid = true;
+            return mi;
+        }
+    }
+    memset(&mi, 0, sizeof(mi));
+    mi.type = _SDB_INVALID_TYPE;
     return mi;
 }
 
+// the record at p, or NULL if its header or payload would run past pend
+static uint8_t *sdb_checked_record(uint8_t *p, uint8_t *pend, sdb_member_info_t *mi) {
+    if (pend - p < (ptrdiff_t)(SDB_ID_SZ + sizeof(sdbtypes_t))) return NULL;
+    if ((p[SDB_ID_SZ] & ~SDB_ARRAY_T_FLAG) >= _SDB_INVALID_TYPE) return NULL;
+    if (pend - p < (ptrdiff_t)sdb_record_header_size(p)) return NULL;
+    sdb_parse_record(p, mi);
+    if ((size_t)(pend - mi->data) < mi->minsize) return NULL;
+    return (uint8_t *)mi->data + mi->minsize;
+}
+
+int8_t sdb_check(const sdb_t *sdb) {
+    if (sdb->nrefs) return sdb_err(-SDB_BAD_HANDLE);
+    if ((sdb_tlen_t)SDB_VALS_OFFSET + sdb->vals_size > sdb->len) return sdb_err(-SDB_SCAN_ERROR);
+    uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    sdb_member_info_t mi = {};
+    for (uint8_t *p = pvals; p < pend; ) {
+        p = sdb_checked_record(p, pend, &mi);
+        if (!p) return sdb_err(-SDB_SCAN_ERROR);
+    }
+    // lookups go straight to where the directory says, so that has to
+    // be somewhere a whole record fits too
+    if (sdb->header & SDB_HDR_DIRECTORY) {
+        sdb_member_info_t dmi = {};
+        if (!sdb_checked_record(pvals, pend, &dmi)) return SDB_OK;
+        if ((dmi.id != SDB_ID_DIRECTORY) || (dmi.type != SDB_BLOB)) return SDB_OK;
+        for (sdb_len_t i=0; i<dmi.minsize / SDB_DIR_ENTRY_SZ; i++) {
+            sdb_tlen_t offset;
+            memcpy(&offset, dmi.data + i * SDB_DIR_ENTRY_SZ + SDB_ID_SZ, SDB_TLEN_SZ);
+            if ((offset >= sdb->vals_size) || !sdb_checked_record(pvals + offset, pend, &mi)) {
+                return sdb_err(-SDB_SCAN_ERROR);
+            }
+        }
+    }
+    return SDB_OK;
+}
+
+void sdb_build_filter(sdb_t *sdb) {
+    memset(sdb->filter, 0, sizeof(sdb->filter));
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_record_at(sdb, p, &mi);
+        sdb_filter_add(sdb, mi.id);
+    }
+    sdb->filtered = true;
+}
+
 int8_t sdb_get(const sdb_member_info_t *abt, void *data) {
-    if (!abt)  return -SDB_BAD_HANDLE;
+    if (!abt)  return sdb_err(-SDB_BAD_HANDLE);
     const uint8_t *p = abt->handle;
-    if (!p) return -SDB_BAD_HANDLE;
-    if (!abt->valid) return -SDB_BAD_HANDLE;
+    if (!p) return sdb_err(-SDB_BAD_HANDLE);
+    if (!abt->valid) return sdb_err(-SDB_BAD_HANDLE);
 
     p += SDB_ID_SZ;
 
@@ -243,121 +578,351 @@ int8_t sdb_get(const sdb_member_info_t *abt, void *data) {
     uint8_t is_array = type & SDB_ARRAY_T_FLAG;
     type &= ~SDB_ARRAY_T_FLAG;
     p += sizeof(sdbtypes_t);
-    if (type != abt->type) return -SDB_DIFFERENT_TYPE;
+    if (type != abt->type) return sdb_err(-SDB_DIFFERENT_TYPE);
     if (type == SDB_BLOB) {
         memcpy(&dsize,p,SDB_BLOB_T_SZ);
         p += SDB_BLOB_T_SZ;
     } else {
         dsize = sdbtype_sizes[type];
     }
-    if (dsize != abt->elemsize) return -SDB_DIFFERENT_SIZE;
+    if (dsize != abt->elemsize) return sdb_err(-SDB_DIFFERENT_SIZE);
 
     sdb_len_t dcount = 1;
     if (is_array) {
         memcpy(&dcount,p,SDB_COUNT_T_SZ);
         p += SDB_COUNT_T_SZ;
     }
-    if (dcount != abt->elemcount) return -SDB_DIFFERENT_COUNT;
+    if (dcount != abt->elemcount) return sdb_err(-SDB_DIFFERENT_COUNT);
+
+    // the payload may be held by reference rather than follow the header
+    if (dsize && dcount) {
+        memcpy(data, abt->data ? abt->data : p, dsize * dcount);
+    }
+    return SDB_OK;
+}
+
+const void *sdb_get_ptr(const sdb_member_info_t *abt) {
+    if (!abt || !abt->valid) return NULL;
+    return abt->data;
+}
+
+const void *sdb_get_aligned(const sdb_t *sdb, sdb_id_t id, sdbtypes_t type, size_t align, sdb_len_t *count, int8_t *error) {
+    sdb_member_info_t about = sdb_find(sdb, id);
+    int8_t err = SDB_OK;
+    const void *rv = NULL;
+    if (!about.valid) {
+        err = sdb_err(-SDB_NOT_FOUND);
+    } else if (about.type != type) {
+        err = sdb_err(-SDB_DIFFERENT_TYPE);
+    } else {
+        if (!align) align = (type == SDB_BLOB) ? 1 : about.elemsize;
+        if ((uintptr_t)about.data % align) {
+            err = sdb_err(-SDB_MISALIGNED);
+        } else {
+            rv = about.data;
+            if (count) *count = (type == SDB_BLOB) ? about.elemsize : about.elemcount;
+        }
+    }
+    if (error) {
+        *error = err;
+    }
+    return rv;
+}
 
-    memcpy(data, p, dsize * dcount);
+int8_t sdb_init_nested(sdb_t *inner, const sdb_member_info_t *abt) {
+    if (!abt || !abt->valid || !abt->data) return sdb_err(-SDB_BAD_HANDLE);
+    if (abt->type != SDB_BLOB) return sdb_err(-SDB_DIFFERENT_TYPE);
+    // the parent is not ours to modify, so never clear
+    int8_t rv = sdb_init(inner, (void *)abt->data, abt->minsize, false);
+    if (rv != SDB_OK) return rv;
+    inner->readonly = true;
+    if ((sdb_tlen_t)SDB_VALS_OFFSET + inner->vals_size > inner->len) {
+        return sdb_err(-SDB_SCAN_ERROR);
+    }
     return SDB_OK;
 }
 
+size_t sdb_find_many(const sdb_t *sdb, const sdb_id_t *ids, size_t n, sdb_member_info_t *mis) {
+    bool ascending = true;
+    for (size_t i=1; i<n; i++) {
+        if (ids[i] <= ids[i-1]) ascending = false;
+    }
+    size_t found = 0;
+    if (!(sdb->header & SDB_HDR_SORTED) || (sdb->header & SDB_HDR_DIRECTORY) || !ascending) {
+        for (size_t i=0; i<n; i++) {
+            mis[i] = sdb_find(sdb, ids[i]);
+            found += mis[i].valid;
+        }
+        return found;
+    }
+
+    // both in order, so one pass over each does it
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
+    size_t i = 0;
+    sdb_member_info_t mi = {};
+    while ((i < n) && (p < pend)) {
+        p = sdb_next_record(sdb, p, &mi, &ref);
+        if (sdb_is_filler(mi.id)) continue;
+        while ((i < n) && (ids[i] < mi.id)) {
+            memset(&mis[i], 0, sizeof(mis[i]));
+            mis[i++].type = _SDB_INVALID_TYPE;
+        }
+        if ((i < n) && (ids[i] == mi.id)) {
+            mi.valid = true;
+            mis[i++] = mi;
+            found++;
+        }
+    }
+    while (i < n) {
+        memset(&mis[i], 0, sizeof(mis[i]));
+        mis[i++].type = _SDB_INVALID_TYPE;
+    }
+    return found;
+}
+
+sdb_member_info_t sdb_find_path(const sdb_t *sdb, const sdb_id_t *path, size_t depth) {
+    sdb_member_info_t mi = {};
+    sdb_t level = *sdb;
+    for (size_t i=0; i<depth; i++) {
+        mi = sdb_find(&level, path[i]);
+        if (!mi.valid) break;
+        if ((i + 1 < depth) && (sdb_init_nested(&level, &mi) != SDB_OK)) {
+            mi.valid = false;
+            break;
+        }
+    }
+    return mi;
+}
+
+static void sdb_write_sizes(sdb_t *sdb) {
+    memcpy((uint8_t *)sdb->buf + SDB_TLEN_OFFSET, &sdb->vals_size, SDB_TLEN_SZ);
+    sdb_rewrite_sizes(sdb);
+}
+
 static int8_t sdb_remove_internal(sdb_t *sdb, uint8_t *pelem, uint8_t *pnext) {
     if (pelem) {
         if (pnext > pelem) {
-            uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
             size_t elem_size = pnext - pelem;
-            uint8_t *pend = pvals + sdb->vals_size;
+            uint8_t *pend = sdb_vals_end(sdb);
             size_t rem_len = pend - pnext;
             memmove(pelem, pnext, rem_len);
+            SDB_STAT(sdb_stats.moved += rem_len);
             sdb->vals_size -= elem_size;
-            memcpy((uint8_t *)sdb->buf + SDB_TLEN_OFFSET, &sdb->vals_size, SDB_LEN_SZ);
-            sdb_rewrite_sizes(sdb);
+
+            // refs after this record move with it; a ref to this
+            // record goes away, along with its share of the size
+            sdb_tlen_t oelem = pelem - (uint8_t *)sdb->buf;
+            sdb_tlen_t onext = pnext - (uint8_t *)sdb->buf;
+            uint16_t kept = 0;
+            for (uint16_t i=0; i<sdb->nrefs; i++) {
+                sdb_ref_t r = sdb->refs[i];
+                if ((r.offset > oelem) && (r.offset <= onext)) {
+                    sdb->vals_size -= r.len;
+                    sdb->ext_size  -= r.len;
+                    continue;
+                }
+                if (r.offset > onext) {
+                    r.offset -= elem_size;
+                }
+                sdb->refs[kept++] = r;
+            }
+            sdb->nrefs = kept;
+            sdb_write_sizes(sdb);
             return SDB_OK;
         } else {
-            return -SDB_SCAN_ERROR;
+            return sdb_err(-SDB_SCAN_ERROR);
         } 
     }
-    return -SDB_NOT_FOUND;
+    return sdb_err(-SDB_NOT_FOUND);
 }
 
-int8_t sdb_add_blob (sdb_t *sdb, sdb_id_t id, const void *ib, const sdb_len_t ilen) {
-    uint8_t *next;
-    sdb_member_info_t mi = {};
-    uint8_t *pfound = sdb_find_internal(sdb, id, &mi, &next);
-
-    if (pfound) {
-        sdb_remove_internal(sdb, pfound, next);
-    }
+static void sdb_update_flags(sdb_t *sdb, sdb_hdr_t set, sdb_hdr_t clear) {
+    sdb_hdr_t header = (sdb->header & ~clear) | set;
+    memcpy((uint8_t *)sdb->buf + SDB_HDR_OFFSET, &header, SDB_HDR_SZ);
+    sdb_rewrite_sizes(sdb);
+}
 
-    uint8_t *ptarget = (uint8_t *)sdb->buf + SDB_VALS_OFFSET + sdb->vals_size;
-    sdb_tlen_t bytes_reqd = SDB_ID_SZ + SDB_BLOB_T_SZ + ilen;
-    sdb_tlen_t bytes_avail = sdb->len - sdb->vals_size - SDB_VALS_OFFSET;
-    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
-    if (bytes_reqd > max_item_len) {
-        return -SDB_ITEM_TOO_BIG;
+// every change starts here. The directory would be out of date after
+// any change, so it goes.
+static int8_t sdb_writable(sdb_t *sdb) {
+    if (sdb->readonly) return sdb_err(-SDB_READ_ONLY);
+    if (sdb->header & SDB_HDR_DIRECTORY) {
+        uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_record_at(sdb, pvals, &mi);
+        if (mi.id == SDB_ID_DIRECTORY) {
+            sdb_remove_internal(sdb, pvals, next);
+        }
+        sdb_update_flags(sdb, 0, SDB_HDR_DIRECTORY);
     }
-    if (bytes_reqd > bytes_avail) {
-        printf("total len %u vals_size %u avail %u\n", sdb->len, sdb->vals_size, bytes_avail);
-        return -SDB_BUFFER_TOO_SMALL;
+    if (sdb->header & SDB_HDR_ALIGNED) {
+        // never any refs in an aligned message
+        uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+        while (p < sdb_vals_end(sdb)) {
+            sdb_member_info_t mi = {};
+            uint8_t *next = sdb_parse_record(p, &mi);
+            if (mi.id == SDB_ID_PAD) {
+                sdb_remove_internal(sdb, p, next);
+            } else {
+                p = next;
+            }
+        }
+        sdb_update_flags(sdb, 0, SDB_HDR_ALIGNED);
     }
-
-    memcpy((void*)ptarget, &id, SDB_ID_SZ);
-    ptarget += SDB_ID_SZ;
-    const sdbtypes_t type = SDB_BLOB;
-    memcpy(ptarget,&type,sizeof(type));
-    ptarget += sizeof(type);
-    memcpy(ptarget,&ilen,SDB_BLOB_T_SZ);
-    ptarget += SDB_BLOB_T_SZ;
-    memcpy(ptarget,ib,ilen);
-    ptarget += ilen;
-
-    sdb->vals_size += SDB_ID_SZ + sizeof(type) + SDB_BLOB_T_SZ + ilen;
-    memcpy((uint8_t *)sdb->buf + SDB_TLEN_OFFSET, &sdb->vals_size, SDB_LEN_SZ);
-    sdb_rewrite_sizes(sdb);
     return SDB_OK;
 }
 
+// move the values from p onwards up by n bytes, to make room for a
+// record at p. The caller accounts for the size.
+static void sdb_open_gap(sdb_t *sdb, uint8_t *p, sdb_tlen_t n) {
+    uint8_t *pend = sdb_vals_end(sdb);
+    memmove(p + n, p, pend - p);
+    SDB_STAT(sdb_stats.moved += pend - p);
+    sdb_tlen_t op = p - (uint8_t *)sdb->buf;
+    for (uint16_t i=0; i<sdb->nrefs; i++) {
+        if (sdb->refs[i].offset > op) sdb->refs[i].offset += n;
+    }
+}
 
+static void sdb_reverse(uint8_t *a, uint8_t *b) {
+    while (a + 1 < b) {
+        uint8_t t = *a;
+        *a++ = *--b;
+        *b = t;
+    }
+}
 
+static void sdb_reverse_refs(sdb_ref_t *a, sdb_ref_t *b) {
+    while (a + 1 < b) {
+        sdb_ref_t t = *a;
+        *a++ = *--b;
+        *b = t;
+    }
+}
 
-int8_t sdb_remove(sdb_t *sdb, sdb_id_t id) {
-    uint8_t    *next = 0;
-    sdb_member_info_t mi = {};
-    uint8_t *p = sdb_find_internal(sdb, id, &mi, &next);
-    if (p) {
-        return sdb_remove_internal(sdb, p, next);
+// swap the neighbouring spans [a,b) and [b,c) of the values without
+// any scratch space, keeping refs in step
+static void sdb_rotate(sdb_t *sdb, uint8_t *a, uint8_t *b, uint8_t *c) {
+    if ((a == b) || (b == c)) return;
+    sdb_reverse(a, b);
+    sdb_reverse(b, c);
+    sdb_reverse(a, c);
+    if (!sdb->nrefs) return;
+
+    sdb_tlen_t oa = a - (uint8_t *)sdb->buf;
+    sdb_tlen_t ob = b - (uint8_t *)sdb->buf;
+    sdb_tlen_t oc = c - (uint8_t *)sdb->buf;
+    uint16_t ia = 0, ib, ic;
+    while ((ia < sdb->nrefs) && (sdb->refs[ia].offset <= oa)) ia++;
+    for (ib = ia; (ib < sdb->nrefs) && (sdb->refs[ib].offset <= ob); ib++) {
+        sdb->refs[ib].offset += oc - ob;
+    }
+    for (ic = ib; (ic < sdb->nrefs) && (sdb->refs[ic].offset <= oc); ic++) {
+        sdb->refs[ic].offset -= ob - oa;
     }
-    return -SDB_NOT_FOUND;
+    sdb_reverse_refs(sdb->refs + ia, sdb->refs + ib);
+    sdb_reverse_refs(sdb->refs + ib, sdb->refs + ic);
+    sdb_reverse_refs(sdb->refs + ia, sdb->refs + ic);
 }
 
-int8_t sdb_set_val(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const void *data) {
-    return sdb_set_vala(sdb, id,type, 1, data);
+// like sdb_next_record, for a record found other than by walking
+static uint8_t *sdb_record_at(const sdb_t *sdb, uint8_t *p, sdb_member_info_t *mi) {
+    uint8_t *next = sdb_parse_record(p, mi);
+    sdb_tlen_t od = mi->data - (uint8_t *)sdb->buf;
+    uint16_t lo = 0, hi = sdb->nrefs;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (sdb->refs[mid].offset < od) lo = mid + 1;
+        else hi = mid;
+    }
+    if ((lo < sdb->nrefs) && (sdb->refs[lo].offset == od)) {
+        next = (uint8_t *)mi->data;
+        mi->data = (const uint8_t *)sdb->refs[lo].data;
+    }
+    return next;
 }
 
-int8_t sdb_set_vala(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, const void *data) {
-    uint8_t *next;
-    sdb_member_info_t mi = {};
-    uint8_t *pfound = sdb_find_internal(sdb, id, &mi, &next);
-    uint8_t is_array = count != 1;
+// where a record with this id belongs in a sorted message, looking no
+// further than plimit
+static uint8_t *sdb_sorted_position(const sdb_t *sdb, sdb_id_t id, uint8_t *plimit) {
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    while (p < plimit) {
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_record_at(sdb, p, &mi);
+        if (mi.id > id) break;
+        p = next;
+    }
+    return p;
+}
 
-    if (pfound) {
-        sdb_remove_internal(sdb, pfound, next);
+// insertion sort, by rotating each record that is out of place back to
+// where it belongs. Nearly sorted messages take a single pass.
+static void sdb_sort_internal(sdb_t *sdb) {
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    bool any = false;
+    sdb_id_t last = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_record_at(sdb, p, &mi);
+        if (any && (mi.id < last)) {
+            uint8_t *pto = sdb_sorted_position(sdb, mi.id, p);
+            sdb_rotate(sdb, pto, p, next);
+        } else {
+            last = mi.id;
+            any = true;
+        }
+        p = next;
     }
+}
 
-    uint8_t *ptarget = ((uint8_t *)sdb->buf + SDB_VALS_OFFSET + sdb->vals_size);
-    sdb_len_t dsize = sdbtype_sizes[type];
-    sdb_tlen_t bytes_needed = SDB_ID_SZ + sizeof(type) + count * dsize;
-    if (is_array) bytes_needed += SDB_COUNT_T_SZ;
-    sdb_tlen_t bytes_avail  = sdb->len - sdb->vals_size - SDB_VALS_OFFSET;
-    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
-    if (bytes_needed > max_item_len) {
-        return -SDB_ITEM_TOO_BIG;
+int8_t sdb_canonicalize(sdb_t *sdb) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    sdb_sort_internal(sdb);
+    sdb_update_flags(sdb, SDB_HDR_SORTED, 0);
+    return SDB_OK;
+}
+
+int8_t sdb_reorder(sdb_t *sdb, const sdb_id_t *ids, size_t n) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t *pfront = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    bool moved = false;
+    for (size_t i=0; i<n; i++) {
+        // anything already placed is in front, so a repeat is not found
+        for (uint8_t *p = pfront; p < pend; ) {
+            sdb_member_info_t mi = {};
+            uint8_t *next = sdb_record_at(sdb, p, &mi);
+            if (mi.id == ids[i]) {
+                moved |= p != pfront;
+                sdb_rotate(sdb, pfront, p, next);
+                pfront += next - p;
+                break;
+            }
+            p = next;
+        }
     }
-    if (bytes_avail < bytes_needed) {
-        return -SDB_BUFFER_TOO_SMALL;
+    if (moved) {
+        sdb_update_flags(sdb, 0, SDB_HDR_SORTED);
     }
+    return SDB_OK;
+}
+
+static sdb_tlen_t sdb_header_size(const sdbtypes_t type, const sdb_len_t count) {
+    sdb_tlen_t hsize = SDB_ID_SZ + sizeof(sdbtypes_t);
+    if (type == SDB_BLOB) hsize += SDB_BLOB_T_SZ;
+    if (count != 1)       hsize += SDB_COUNT_T_SZ;
+    return hsize;
+}
+
+// write a record header at ptarget and return a pointer to where its
+// payload goes. The size is not accounted for here.
+static uint8_t *sdb_write_header(uint8_t *ptarget, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, const sdb_len_t dsize) {
+    uint8_t is_array = count != 1;
 
     memcpy((void *)ptarget, &id, SDB_ID_SZ);
     ptarget += SDB_ID_SZ;
@@ -367,41 +932,988 @@ int8_t sdb_set_vala(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_le
     }
     memcpy(ptarget,&stype,sizeof(type));
     ptarget += sizeof(type);
+    if (type == SDB_BLOB) {
+        memcpy(ptarget,&dsize,SDB_BLOB_T_SZ);
+        ptarget += SDB_BLOB_T_SZ;
+    }
     if (is_array) {
         memcpy(ptarget,&count,SDB_COUNT_T_SZ);
         ptarget += SDB_COUNT_T_SZ;
     }
-    memcpy(ptarget, data, count * dsize);
-
-    sdb->vals_size += SDB_ID_SZ + sizeof(type) + count * dsize;
-    if (is_array) sdb->vals_size += SDB_COUNT_T_SZ;
-    memcpy((uint8_t *)sdb->buf + SDB_TLEN_OFFSET, &sdb->vals_size, SDB_LEN_SZ);
-    sdb_rewrite_sizes(sdb);
-    return SDB_OK;
+    return ptarget;
 }
 
+// common front half of every setter: drop any existing item with
+// this id, make sure the new one fits, and write its header
+static int8_t sdb_append_internal(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, const sdb_len_t dsize, uint8_t **payload) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t *next;
+    sdb_member_info_t mi = {};
+    uint8_t *pfound = sdb_find_internal(sdb, id, &mi, &next);
+    sdb_filter_add(sdb, id);
+    // on a miss, next is where a sorted message wants the new item
+    uint8_t *pinsert = pfound ? pfound : next;
 
-sdb_len_t sdb_size(const sdb_t *sdb) {
-    return SDB_VALS_OFFSET + sdb->vals_size;
-}
-
+    if (pfound) {
+        sdb_remove_internal(sdb, pfound, next);
+    }
 
-int8_t sdb_set_unsigned(sdb_t *sdb, sdb_id_t id, uint64_t uv) {
-    sdb_val_t v;
-    if (uv <= UINT8_MAX) {
-       v.u8 = uv;
-       return sdb_set_val(sdb, id, SDB_U8, &v);
+    sdb_tlen_t bytes_needed = sdb_header_size(type, count) + (sdb_tlen_t)count * dsize;
+    sdb_tlen_t bytes_avail  = sdb->len - (sdb_vals_end(sdb) - (uint8_t *)sdb->buf);
+    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
+    if (bytes_needed > max_item_len) {
+        return sdb_err(-SDB_ITEM_TOO_BIG);
     }
-    if (uv <= UINT16_MAX) {
-       v.u16 = uv;
-       return sdb_set_val(sdb, id, SDB_U16, &v);
+    if (bytes_avail < bytes_needed) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
     }
-    if (uv <= UINT32_MAX) {
-       v.u32 = uv;
-       return sdb_set_val(sdb, id, SDB_U32, &v);
+
+    if (sdb->header & SDB_HDR_SORTED) {
+        sdb_open_gap(sdb, pinsert, bytes_needed);
+    } else {
+        pinsert = sdb_vals_end(sdb);
     }
-    v.u64 = uv;
-    return sdb_set_val(sdb, id, SDB_U64, &v);
+    *payload = sdb_write_header(pinsert, id, type, count, dsize);
+    sdb->vals_size += bytes_needed;
+    sdb_write_sizes(sdb);
+    return SDB_OK;
+}
+
+int8_t sdb_add_blob (sdb_t *sdb, sdb_id_t id, const void *ib, const sdb_len_t ilen) {
+    uint8_t *ptarget = 0;
+    int8_t rv = sdb_append_internal(sdb, id, SDB_BLOB, 1, ilen, &ptarget);
+    // an empty blob may come with no source at all
+    if ((rv == SDB_OK) && ilen) {
+        memcpy(ptarget,ib,ilen);
+    }
+    return rv;
+}
+
+int8_t sdb_attach_refs(sdb_t *sdb, sdb_ref_t *refs, uint16_t max_refs) {
+    if (sdb->readonly) return sdb_err(-SDB_READ_ONLY);
+    if (sdb->nrefs) return sdb_err(-SDB_BAD_HANDLE);
+    sdb->refs = refs;
+    sdb->max_refs = max_refs;
+    return SDB_OK;
+}
+
+int8_t sdb_add_blob_ref(sdb_t *sdb, sdb_id_t id, const void *ib, const sdb_len_t ilen) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t *next;
+    sdb_member_info_t mi = {};
+    uint8_t *pfound = sdb_find_internal(sdb, id, &mi, &next);
+    uint8_t *pinsert = pfound ? pfound : next;
+    sdb_filter_add(sdb, id);
+
+    if (pfound) {
+        sdb_remove_internal(sdb, pfound, next);
+    }
+
+    if (sdb->nrefs >= sdb->max_refs) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+    // only the header takes space in the buffer
+    sdb_tlen_t hsize = sdb_header_size(SDB_BLOB, 1);
+    sdb_tlen_t bytes_avail = sdb->len - (sdb_vals_end(sdb) - (uint8_t *)sdb->buf);
+    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
+    if (hsize + ilen > max_item_len) {
+        return sdb_err(-SDB_ITEM_TOO_BIG);
+    }
+    if (bytes_avail < hsize) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+
+    if (sdb->header & SDB_HDR_SORTED) {
+        sdb_open_gap(sdb, pinsert, hsize);
+    } else {
+        pinsert = sdb_vals_end(sdb);
+    }
+    uint8_t *ptarget = sdb_write_header(pinsert, id, SDB_BLOB, 1, ilen);
+
+    // keep the table in buffer order
+    sdb_tlen_t offset = ptarget - (uint8_t *)sdb->buf;
+    uint16_t i = sdb->nrefs;
+    while (i && (sdb->refs[i-1].offset > offset)) {
+        sdb->refs[i] = sdb->refs[i-1];
+        i--;
+    }
+    sdb->nrefs++;
+    sdb_ref_t *r = &sdb->refs[i];
+    r->offset = offset;
+    r->data = ib;
+    r->len = ilen;
+    sdb->vals_size += hsize + ilen;
+    sdb->ext_size += ilen;
+    sdb_write_sizes(sdb);
+    return SDB_OK;
+}
+
+int sdb_to_iov(const sdb_t *sdb, sdb_iov_t *iov, int max_iov) {
+    int n = 0;
+    sdb_tlen_t done = 0;
+    uint8_t *pbuf = (uint8_t *)sdb->buf;
+    for (uint16_t i=0; i<=sdb->nrefs; i++) {
+        // the buffer up to the next ref (or the end), then the ref itself
+        sdb_tlen_t upto = (i < sdb->nrefs) ? sdb->refs[i].offset :
+                          (sdb_tlen_t)(sdb_vals_end(sdb) - pbuf);
+        if (upto > done) {
+            if (n >= max_iov) return sdb_err(-SDB_BUFFER_TOO_SMALL);
+            iov[n].iov_base = pbuf + done;
+            iov[n].iov_len  = upto - done;
+            n++;
+            done = upto;
+        }
+        if ((i < sdb->nrefs) && sdb->refs[i].len) {
+            if (n >= max_iov) return sdb_err(-SDB_BUFFER_TOO_SMALL);
+            iov[n].iov_base = (void *)sdb->refs[i].data;
+            iov[n].iov_len  = sdb->refs[i].len;
+            n++;
+        }
+    }
+    return n;
+}
+
+void *sdb_reserve_blob(sdb_t *sdb, sdb_id_t id, const sdb_len_t size, int8_t *error) {
+    uint8_t *ptarget = 0;
+    int8_t rv = sdb_append_internal(sdb, id, SDB_BLOB, 1, size, &ptarget);
+    if (error) {
+        *error = rv;
+    }
+    return rv == SDB_OK ? ptarget : NULL;
+}
+
+void *sdb_reserve_array(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, int8_t *error) {
+    uint8_t *ptarget = 0;
+    int8_t rv = sdb_append_internal(sdb, id, type, count, sdbtype_sizes[type], &ptarget);
+    if (error) {
+        *error = rv;
+    }
+    return rv == SDB_OK ? ptarget : NULL;
+}
+
+int8_t sdb_shrink(sdb_t *sdb, sdb_id_t id, const sdb_len_t used) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t *next;
+    sdb_member_info_t mi = {};
+    uint8_t *pfound = sdb_find_internal(sdb, id, &mi, &next);
+    if (!pfound) return sdb_err(-SDB_NOT_FOUND);
+    if (next != mi.data + mi.minsize) return sdb_err(-SDB_BAD_HANDLE); // held by reference
+
+    uint8_t *pfield = pfound + SDB_ID_SZ + sizeof(sdbtypes_t);
+    sdb_tlen_t new_size = 0;
+    if (mi.type == SDB_BLOB) {
+        if (used > mi.elemsize) return sdb_err(-SDB_DIFFERENT_SIZE);
+        memcpy(pfield, &used, SDB_BLOB_T_SZ);
+        pfield += SDB_BLOB_T_SZ;
+        new_size = (sdb_tlen_t)used * mi.elemcount;
+    } else {
+        if (used > mi.elemcount) return sdb_err(-SDB_DIFFERENT_COUNT);
+        // a scalar has nowhere to put a count
+        if (!(*(pfound + SDB_ID_SZ) & SDB_ARRAY_T_FLAG)) {
+            return used == 1 ? SDB_OK : sdb_err(-SDB_DIFFERENT_COUNT);
+        }
+        memcpy(pfield, &used, SDB_COUNT_T_SZ);
+        new_size = (sdb_tlen_t)used * mi.elemsize;
+    }
+
+    sdb_tlen_t unused = mi.minsize - new_size;
+    if (unused) {
+        uint8_t *pend = sdb_vals_end(sdb);
+        memmove(next - unused, next, pend - next);
+        SDB_STAT(sdb_stats.moved += pend - next);
+        // and refs to records after this one move with them
+        sdb_tlen_t onext = next - (uint8_t *)sdb->buf;
+        for (uint16_t i=0; i<sdb->nrefs; i++) {
+            if (sdb->refs[i].offset >= onext) sdb->refs[i].offset -= unused;
+        }
+        sdb->vals_size -= unused;
+        sdb_write_sizes(sdb);
+    }
+    return SDB_OK;
+}
+
+int8_t sdb_begin_nested(sdb_t *parent, sdb_id_t id, sdb_t *child) {
+    int8_t wrv = sdb_writable(parent);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t *next;
+    sdb_member_info_t mi = {};
+    uint8_t *pfound = sdb_find_internal(parent, id, &mi, &next);
+    sdb_filter_add(parent, id);
+
+    if (pfound) {
+        sdb_remove_internal(parent, pfound, next);
+    }
+
+    // the child gets all the free space, up to the most a blob can hold
+    sdb_tlen_t hsize = sdb_header_size(SDB_BLOB, 1);
+    sdb_tlen_t bytes_avail = parent->len - (sdb_vals_end(parent) - (uint8_t *)parent->buf);
+    sdb_tlen_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
+    if (bytes_avail < hsize + SDB_VALS_OFFSET) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+    sdb_tlen_t child_len = bytes_avail - hsize;
+    if (child_len > max_item_len - hsize) {
+        child_len = max_item_len - hsize;
+    }
+
+    // the header is written with a zero length now and patched when the
+    // child is closed. The parent's size is left alone until then, so a
+    // child that is never closed leaves the parent as it was.
+    uint8_t *ptarget = sdb_write_header(sdb_vals_end(parent), id, SDB_BLOB, 1, 0);
+
+    // no need to clear the whole space; just the child's own header
+    const sdb_hdr_t vheader = SDB_ID_VAL;
+    const sdb_tlen_t vals_size = 0;
+    memcpy(ptarget + SDB_HDR_OFFSET, &vheader, SDB_HDR_SZ);
+    memcpy(ptarget + SDB_TLEN_OFFSET, &vals_size, SDB_TLEN_SZ);
+    int8_t rv = sdb_init(child, ptarget, child_len, false);
+    child->filtered = true;
+    return rv;
+}
+
+int8_t sdb_end_nested(sdb_t *parent, sdb_t *child) {
+    if (parent->readonly) return sdb_err(-SDB_READ_ONLY);
+    sdb_tlen_t hsize = sdb_header_size(SDB_BLOB, 1);
+    uint8_t *phdr = sdb_vals_end(parent);
+    if ((uint8_t *)child->buf != phdr + hsize) {
+        return sdb_err(-SDB_BAD_HANDLE);
+    }
+
+    sdb_len_t csize = sdb_size(child);
+    memcpy(phdr + SDB_ID_SZ + sizeof(sdbtypes_t), &csize, SDB_BLOB_T_SZ);
+    if (parent->header & SDB_HDR_SORTED) {
+        // it was built at the end, so move it to where it belongs
+        sdb_id_t id;
+        memcpy(&id, phdr, SDB_ID_SZ);
+        uint8_t *pto = sdb_sorted_position(parent, id, phdr);
+        sdb_rotate(parent, pto, phdr, phdr + hsize + csize);
+    }
+    parent->vals_size += hsize + csize;
+    sdb_write_sizes(parent);
+    return SDB_OK;
+}
+
+int8_t sdb_remove(sdb_t *sdb, sdb_id_t id) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    uint8_t    *next = 0;
+    sdb_member_info_t mi = {};
+    uint8_t *p = sdb_find_internal(sdb, id, &mi, &next);
+    if (p) {
+        return sdb_remove_internal(sdb, p, next);
+    }
+    return sdb_err(-SDB_NOT_FOUND);
+}
+
+// size of the record a field would make, or zero if it is not valid
+static sdb_tlen_t sdb_field_size(const sdb_field_t *f) {
+    if (f->type >= _SDB_INVALID_TYPE) return 0;
+    if (f->type == SDB_BLOB) {
+        return sdb_header_size(SDB_BLOB, 1) + f->count;
+    }
+    return sdb_header_size(f->type, f->count) + (sdb_tlen_t)f->count * sdbtype_sizes[f->type];
+}
+
+// whether a field after fields[i] has the same id
+static bool sdb_field_repeated(const sdb_field_t *fields, size_t n, size_t i) {
+    for (size_t j=i+1; j<n; j++) {
+        if (fields[j].id == fields[i].id) return true;
+    }
+    return false;
+}
+
+// whether any of the fields has this id
+static bool sdb_fields_have(const sdb_field_t *fields, size_t n, const sdb_idset_t *ids, sdb_id_t id) {
+    if (ids) return sdb_idset_has(ids, id);
+    for (size_t j=0; j<n; j++) {
+        if (fields[j].id == id) return true;
+    }
+    return false;
+}
+
+// ids is a cleared set to note ids in, or NULL to scan the fields instead
+static sdb_tlen_t sdb_measure_internal(const sdb_field_t *fields, size_t n, sdb_idset_t *ids) {
+    sdb_tlen_t total = SDB_VALS_OFFSET;
+    // walk backwards so that only the last of any repeated id counts
+    for (size_t i=n; i-- > 0; ) {
+        if (ids ? sdb_idset_add(ids, fields[i].id) : sdb_field_repeated(fields, n, i)) continue;
+        total += sdb_field_size(&fields[i]);
+    }
+    return total;
+}
+
+sdb_tlen_t sdb_measure(const sdb_field_t *fields, size_t n) {
+    if (n <= SDB_ID_SCAN_MAX) return sdb_measure_internal(fields, n, NULL);
+    sdb_idset_t ids;
+    sdb_idset_clear(&ids);
+    return sdb_measure_internal(fields, n, &ids);
+}
+
+// ids as for sdb_measure_internal
+static int8_t sdb_set_many_internal(sdb_t *sdb, const sdb_field_t *fields, size_t n, sdb_idset_t *ids) {
+    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
+    sdb_tlen_t bytes_needed = 0;
+    for (size_t i=n; i-- > 0; ) {
+        if (ids ? sdb_idset_add(ids, fields[i].id) : sdb_field_repeated(fields, n, i)) continue;
+        sdb_filter_add(sdb, fields[i].id);
+        sdb_tlen_t fsize = sdb_field_size(&fields[i]);
+        if (!fsize) return sdb_err(-SDB_DIFFERENT_TYPE);
+        if (fsize > max_item_len) return sdb_err(-SDB_ITEM_TOO_BIG);
+        bytes_needed += fsize;
+    }
+
+    // whatever is being replaced makes room, so count that before
+    // deciding whether it all fits
+    uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend  = sdb_vals_end(sdb);
+    sdb_tlen_t bytes_freed = 0;
+    uint16_t ref = 0;
+    for (uint8_t *p = pvals; p < pend; ) {
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_next_record(sdb, p, &mi, &ref);
+        if (sdb_fields_have(fields, n, ids, mi.id)) bytes_freed += next - p;
+        p = next;
+    }
+    sdb_tlen_t bytes_avail = sdb->len - (pend - (uint8_t *)sdb->buf) + bytes_freed;
+    if (bytes_avail < bytes_needed) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+
+    if (bytes_freed && sdb->nrefs) {
+        // refs need their offsets fixed up; let remove do it
+        for (size_t i=0; i<n; i++) {
+            uint8_t *next;
+            sdb_member_info_t mi = {};
+            uint8_t *pfound = sdb_find_internal(sdb, fields[i].id, &mi, &next);
+            if (pfound) sdb_remove_internal(sdb, pfound, next);
+        }
+    } else if (bytes_freed) {
+        // squeeze out the replaced items in one pass, moving runs of
+        // kept items together
+        uint8_t *pout = pvals;
+        uint8_t *prun = pvals;
+        uint8_t *p = pvals;
+        while (p < pend) {
+            sdb_member_info_t mi = {};
+            uint8_t *next = sdb_parse_record(p, &mi);
+            if (sdb_fields_have(fields, n, ids, mi.id)) {
+                memmove(pout, prun, p - prun);
+                SDB_STAT(sdb_stats.moved += p - prun);
+                pout += p - prun;
+                prun = next;
+            }
+            p = next;
+        }
+        memmove(pout, prun, pend - prun);
+        SDB_STAT(sdb_stats.moved += pend - prun);
+        sdb->vals_size -= bytes_freed;
+    }
+
+    // fill from the back, so the last of any repeated id is the one kept
+    // and everything still comes out in the order given. The set holds
+    // every id now, so the last of each is the one still there to take.
+    uint8_t *ptarget = sdb_vals_end(sdb) + bytes_needed;
+    for (size_t i=n; i-- > 0; ) {
+        const sdb_field_t *f = &fields[i];
+        if (ids ? !sdb_idset_take(ids, f->id) : sdb_field_repeated(fields, n, i)) continue;
+        ptarget -= sdb_field_size(f);
+        uint8_t *pdata;
+        size_t dbytes;
+        if (f->type == SDB_BLOB) {
+            pdata = sdb_write_header(ptarget, f->id, SDB_BLOB, 1, f->count);
+            dbytes = f->count;
+        } else {
+            pdata = sdb_write_header(ptarget, f->id, f->type, f->count, sdbtype_sizes[f->type]);
+            dbytes = (size_t)f->count * sdbtype_sizes[f->type];
+        }
+        // empty fields may have no data pointer
+        if (dbytes) memcpy(pdata, f->data, dbytes);
+    }
+
+    sdb->vals_size += bytes_needed;
+    if (sdb->header & SDB_HDR_SORTED) {
+        sdb_sort_internal(sdb);
+    }
+    sdb_write_sizes(sdb);
+    return SDB_OK;
+}
+
+int8_t sdb_set_many(sdb_t *sdb, const sdb_field_t *fields, size_t n) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    if (n <= SDB_ID_SCAN_MAX) return sdb_set_many_internal(sdb, fields, n, NULL);
+    sdb_idset_t ids;
+    sdb_idset_clear(&ids);
+    return sdb_set_many_internal(sdb, fields, n, &ids);
+}
+
+int8_t sdb_set_val(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const void *data) {
+    return sdb_set_vala(sdb, id,type, 1, data);
+}
+
+int8_t sdb_set_vala(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, const void *data) {
+    uint8_t *ptarget = 0;
+    sdb_len_t dsize = sdbtype_sizes[type];
+    int8_t rv = sdb_append_internal(sdb, id, type, count, dsize, &ptarget);
+    // an empty array may come with no source at all
+    if ((rv == SDB_OK) && count) {
+        memcpy(ptarget, data, count * dsize);
+    }
+    return rv;
+}
+
+
+// header bytes of the record at p, whatever the type
+static sdb_tlen_t sdb_record_header_size(const uint8_t *p) {
+    sdbtypes_t stype = _SDB_INVALID_TYPE;
+    memcpy(&stype, p + SDB_ID_SZ, sizeof(stype));
+    sdb_tlen_t hsize = SDB_ID_SZ + sizeof(stype);
+    if ((stype & ~SDB_ARRAY_T_FLAG) == SDB_BLOB) hsize += SDB_BLOB_T_SZ;
+    if (stype & SDB_ARRAY_T_FLAG)                hsize += SDB_COUNT_T_SZ;
+    return hsize;
+}
+
+static void sdb_swap_entries(uint8_t *a, uint8_t *b) {
+    uint8_t t[SDB_DIR_ENTRY_SZ];
+    memcpy(t, a, SDB_DIR_ENTRY_SZ);
+    memcpy(a, b, SDB_DIR_ENTRY_SZ);
+    memcpy(b, t, SDB_DIR_ENTRY_SZ);
+}
+
+static sdb_id_t sdb_entry_id(const uint8_t *pentries, size_t i) {
+    sdb_id_t id;
+    memcpy(&id, pentries + i * SDB_DIR_ENTRY_SZ, SDB_ID_SZ);
+    return id;
+}
+
+static void sdb_sift_down(uint8_t *pentries, size_t i, size_t n) {
+    while (2 * i + 1 < n) {
+        size_t c = 2 * i + 1;
+        if ((c + 1 < n) && (sdb_entry_id(pentries, c + 1) > sdb_entry_id(pentries, c))) c++;
+        if (sdb_entry_id(pentries, i) >= sdb_entry_id(pentries, c)) return;
+        sdb_swap_entries(pentries + i * SDB_DIR_ENTRY_SZ, pentries + c * SDB_DIR_ENTRY_SZ);
+        i = c;
+    }
+}
+
+// heapsort, since the entries are in a packed table with no room to spare
+static void sdb_sort_entries(uint8_t *pentries, size_t n) {
+    for (size_t i=n/2; i-- > 0; ) {
+        sdb_sift_down(pentries, i, n);
+    }
+    for (size_t end=n; end-- > 1; ) {
+        sdb_swap_entries(pentries, pentries + end * SDB_DIR_ENTRY_SZ);
+        sdb_sift_down(pentries, 0, end);
+    }
+}
+
+int8_t sdb_add_directory(sdb_t *sdb) {
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+
+    uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    size_t count = 0;
+    for (uint8_t *p = pvals; p < pend; count++) {
+        sdb_member_info_t mi = {};
+        p = sdb_record_at(sdb, p, &mi);
+    }
+
+    sdb_tlen_t hsize = sdb_header_size(SDB_BLOB, 1);
+    sdb_tlen_t dsize = count * SDB_DIR_ENTRY_SZ;
+    uint32_t max_item_len = (sdb_tlen_t)(sdb_len_t)(0 - 1);
+    if (hsize + dsize > max_item_len) {
+        return sdb_err(-SDB_ITEM_TOO_BIG);
+    }
+    if (sdb->len - (pend - (uint8_t *)sdb->buf) < hsize + dsize) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+
+    // it goes first, so that a reader can find it straight away
+    sdb_open_gap(sdb, pvals, hsize + dsize);
+    uint8_t *pentries = sdb_write_header(pvals, SDB_ID_DIRECTORY, SDB_BLOB, 1, dsize);
+    sdb->vals_size += hsize + dsize;
+
+    // offsets are on the wire, counting blobs held by reference
+    sdb_tlen_t offset = hsize + dsize;
+    uint8_t *p = pentries + dsize;
+    pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
+    bool sorted = true;
+    for (size_t i=0; p < pend; i++) {
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_next_record(sdb, p, &mi, &ref);
+        memcpy(pentries + i * SDB_DIR_ENTRY_SZ, &mi.id, SDB_ID_SZ);
+        memcpy(pentries + i * SDB_DIR_ENTRY_SZ + SDB_ID_SZ, &offset, SDB_TLEN_SZ);
+        if (i && (mi.id < sdb_entry_id(pentries, i - 1))) sorted = false;
+        offset += sdb_record_header_size(p) + mi.minsize;
+        p = next;
+    }
+    if (!sorted) {
+        sdb_sort_entries(pentries, count);
+    }
+
+    sdb_write_sizes(sdb);
+    sdb_update_flags(sdb, SDB_HDR_DIRECTORY, 0);
+    return SDB_OK;
+}
+
+// filler to put in front of a record whose payload would start at pos.
+// The smallest record is four bytes, so a smaller gap has to go round
+// to the next boundary.
+static sdb_tlen_t sdb_pad_size(sdb_tlen_t pos, sdb_tlen_t align) {
+    sdb_tlen_t gap = (align - pos % align) % align;
+    while (gap && (gap < SDB_ID_SZ + sizeof(sdbtypes_t) + 1)) gap += align;
+    return gap;
+}
+
+static sdb_tlen_t sdb_payload_align(const sdb_member_info_t *mi, uint8_t boundary) {
+    // scalars are copied out by sdb_get anyway
+    if ((mi->type != SDB_BLOB) && (mi->elemcount == 1)) return 1;
+    if (boundary) return boundary;
+    return (mi->type == SDB_BLOB) ? 8 : mi->elemsize;
+}
+
+int8_t sdb_align(sdb_t *sdb, uint8_t boundary) {
+    if (boundary & (boundary - 1)) return sdb_err(-SDB_BAD_HANDLE);
+    int8_t wrv = sdb_writable(sdb);
+    if (wrv != SDB_OK) return wrv;
+    if (sdb->nrefs) return sdb_err(-SDB_BAD_HANDLE);
+
+    // see whether it all fits before changing anything
+    uint8_t *pvals = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    sdb_tlen_t pos = SDB_VALS_OFFSET;
+    sdb_tlen_t bytes_needed = 0;
+    for (uint8_t *p = pvals; p < pend; ) {
+        sdb_member_info_t mi = {};
+        uint8_t *next = sdb_parse_record(p, &mi);
+        sdb_tlen_t gap = sdb_pad_size(pos + (mi.data - p), sdb_payload_align(&mi, boundary));
+        bytes_needed += gap;
+        pos += gap + (next - p);
+        p = next;
+    }
+    if (sdb->len - (pend - (uint8_t *)sdb->buf) < bytes_needed) {
+        return sdb_err(-SDB_BUFFER_TOO_SMALL);
+    }
+
+    uint8_t *p = pvals;
+    while (p < sdb_vals_end(sdb)) {
+        sdb_member_info_t mi = {};
+        sdb_parse_record(p, &mi);
+        sdb_tlen_t gap = sdb_pad_size(mi.data - (uint8_t *)sdb->buf, sdb_payload_align(&mi, boundary));
+        if (gap) {
+            sdb_open_gap(sdb, p, gap);
+            sdb->vals_size += gap;
+            uint8_t *pfill;
+            if (gap < sdb_header_size(SDB_BLOB, 1)) {
+                pfill = sdb_write_header(p, SDB_ID_PAD, SDB_U8, 1, 0);
+            } else {
+                pfill = sdb_write_header(p, SDB_ID_PAD, SDB_BLOB, 1, gap - sdb_header_size(SDB_BLOB, 1));
+            }
+            memset(pfill, 0, p + gap - pfill);
+            p += gap;
+        }
+        p = sdb_parse_record(p, &mi);
+    }
+    sdb_filter_add(sdb, SDB_ID_PAD);
+
+    sdb_write_sizes(sdb);
+    sdb_update_flags(sdb, SDB_HDR_ALIGNED, 0);
+    return SDB_OK;
+}
+
+// appends whole records to a message under construction. Records that
+// sit next to each other in their source are copied together.
+typedef struct sdb_copier_t {
+    sdb_t         *dst;
+    const uint8_t *run;
+    sdb_tlen_t     run_len;
+    int8_t         error;
+} sdb_copier_t;
+
+static void sdb_copier_flush(sdb_copier_t *c) {
+    if (c->run_len && (c->error == SDB_OK)) {
+        sdb_tlen_t bytes_avail = c->dst->len - SDB_VALS_OFFSET - c->dst->vals_size;
+        if (c->run_len > bytes_avail) {
+            c->error = sdb_err(-SDB_BUFFER_TOO_SMALL);
+        } else {
+            memcpy(sdb_vals_end(c->dst), c->run, c->run_len);
+            c->dst->vals_size += c->run_len;
+        }
+    }
+    c->run = NULL;
+    c->run_len = 0;
+}
+
+static void sdb_copier_add(sdb_copier_t *c, const sdb_member_info_t *mi) {
+    sdb_tlen_t hsize = sdb_record_header_size(mi->handle);
+    if (mi->data == mi->handle + hsize) {
+        if (c->run && (c->run + c->run_len == mi->handle)) {
+            c->run_len += hsize + mi->minsize;
+            return;
+        }
+        sdb_copier_flush(c);
+        c->run = mi->handle;
+        c->run_len = hsize + mi->minsize;
+        return;
+    }
+    // held by reference, so the header and payload are apart
+    sdb_copier_flush(c);
+    c->run = mi->handle;
+    c->run_len = hsize;
+    sdb_copier_flush(c);
+    c->run = mi->data;
+    c->run_len = mi->minsize;
+    sdb_copier_flush(c);
+}
+
+// steps through the records of a message that are not reserved and,
+// optionally, not in a set of ids to skip
+typedef struct sdb_walker_t {
+    const sdb_t        *sdb;
+    uint8_t            *p;
+    uint16_t            ref;
+    const sdb_idlist_t *skip;
+    sdb_member_info_t   mi;
+    bool                valid;
+} sdb_walker_t;
+
+static void sdb_walker_next(sdb_walker_t *w) {
+    uint8_t *pend = sdb_vals_end(w->sdb);
+    while (w->p < pend) {
+        w->p = sdb_next_record(w->sdb, w->p, &w->mi, &w->ref);
+        if (w->mi.id >= SDB_ID_RESERVED) continue;
+        if (w->skip && sdb_idlist_has(w->skip, w->mi.id)) continue;
+        w->valid = true;
+        return;
+    }
+    w->valid = false;
+}
+
+static void sdb_walker_init(sdb_walker_t *w, const sdb_t *sdb, const sdb_idlist_t *skip) {
+    w->sdb = sdb;
+    w->p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    w->ref = 0;
+    w->skip = skip;
+    sdb_walker_next(w);
+}
+
+// the ids overlay replaces or, with SDB_MERGE_TOMBSTONES, removes. The
+// first max of them go in ids, and all of them in set if there is one.
+// Returns how many there are, counting any repeats.
+static size_t sdb_merge_drops(const sdb_t *overlay, uint8_t flags, sdb_id_t *ids, size_t max, sdb_idset_t *set, int8_t *error) {
+    size_t n = 0;
+    uint8_t *p = (uint8_t *)overlay->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(overlay);
+    uint16_t ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(overlay, p, &mi, &ref);
+        if (set) sdb_idset_add(set, mi.id);
+        if (n < max) ids[n] = mi.id;
+        n++;
+        if ((mi.id == SDB_ID_TOMBSTONES) && (flags & SDB_MERGE_TOMBSTONES)) {
+            if (mi.type != SDB_U16) {
+                *error = sdb_err(-SDB_DIFFERENT_TYPE);
+                return n;
+            }
+            for (sdb_len_t i=0; i<mi.elemcount; i++) {
+                sdb_id_t id;
+                memcpy(&id, mi.data + i * SDB_ID_SZ, SDB_ID_SZ);
+                if (set) sdb_idset_add(set, id);
+                if (n < max) ids[n] = id;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+static int8_t sdb_merge_internal(sdb_t *dst, const sdb_t *base, const sdb_t *overlay, const sdb_idlist_t *drop) {
+    // if both are sorted, so is the result: take whichever comes first.
+    // Otherwise it's all of base followed by all of overlay. Padding is
+    // never copied, so nothing in dst is aligned any more either.
+    bool sorted = (base->header & SDB_HDR_SORTED) && (overlay->header & SDB_HDR_SORTED);
+    sdb_update_flags(dst, sorted ? SDB_HDR_SORTED : 0, SDB_HDR_SORTED | SDB_HDR_DIRECTORY | SDB_HDR_ALIGNED);
+    dst->vals_size = 0;
+    sdb_copier_t c = { dst, NULL, 0, SDB_OK };
+    sdb_walker_t wb, wo;
+    sdb_walker_init(&wb, base, drop);
+    sdb_walker_init(&wo, overlay, NULL);
+    while (wb.valid || wo.valid) {
+        bool take_base = wb.valid && (!wo.valid || !sorted || (wb.mi.id < wo.mi.id));
+        sdb_walker_t *w = take_base ? &wb : &wo;
+        sdb_copier_add(&c, &w->mi);
+        sdb_walker_next(w);
+    }
+    sdb_copier_flush(&c);
+
+    if (c.error != SDB_OK) {
+        dst->vals_size = 0;
+    }
+    sdb_write_sizes(dst);
+    return c.error;
+}
+
+int8_t sdb_merge(sdb_t *dst, const sdb_t *base, const sdb_t *overlay, uint8_t flags) {
+    if (dst->readonly) return sdb_err(-SDB_READ_ONLY);
+    if (dst->nrefs) return sdb_err(-SDB_BAD_HANDLE);
+    dst->filtered = false;
+
+    // everything the overlay has, or says to remove, is not taken from
+    // the base. Usually that is few enough ids to just list.
+    int8_t err = SDB_OK;
+    sdb_id_t ids[SDB_ID_SCAN_MAX];
+    size_t n = sdb_merge_drops(overlay, flags, ids, SDB_ID_SCAN_MAX, NULL, &err);
+    if (err != SDB_OK) return err;
+    if (n <= SDB_ID_SCAN_MAX) {
+        sdb_idlist_t drop = { NULL, ids, n };
+        return sdb_merge_internal(dst, base, overlay, &drop);
+    }
+    sdb_idset_t set;
+    sdb_idset_clear(&set);
+    sdb_merge_drops(overlay, flags, ids, 0, &set, &err);
+    sdb_idlist_t drop = { &set, NULL, 0 };
+    return sdb_merge_internal(dst, base, overlay, &drop);
+}
+
+// look for id starting where the last search left off, wrapping around
+// if need be. Messages that share an order are then searched in a single
+// pass. Refs are only tracked from the start, so those go the long way.
+static bool sdb_find_from(const sdb_t *sdb, sdb_id_t id, uint8_t **cursor, sdb_member_info_t *mi) {
+    uint8_t *next;
+    if (sdb->nrefs) {
+        return sdb_find_internal(sdb, id, mi, &next) != NULL;
+    }
+    uint8_t *pstart = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint8_t *p = *cursor ? *cursor : pstart;
+    for (int pass=0; pass<2; pass++) {
+        uint8_t *plimit = pass ? *cursor : pend;
+        while (p < plimit) {
+            next = sdb_parse_record(p, mi);
+            if (mi->id == id) {
+                *cursor = next < pend ? next : pstart;
+                mi->valid = true;
+                return true;
+            }
+            p = next;
+        }
+        if (!*cursor) break;
+        p = pstart;
+    }
+    return false;
+}
+
+static bool sdb_same_value(const sdb_member_info_t *a, const sdb_member_info_t *b) {
+    return (a->type == b->type) &&
+           (a->elemsize == b->elemsize) &&
+           (a->elemcount == b->elemcount) &&
+           !memcmp(a->data, b->data, a->minsize);
+}
+
+int8_t sdb_diff(sdb_t *patch, const sdb_t *old, const sdb_t *now) {
+    if (patch->readonly) return sdb_err(-SDB_READ_ONLY);
+    if (patch->nrefs) return sdb_err(-SDB_BAD_HANDLE);
+    patch->filtered = false;
+
+    sdb_idset_t old_ids, now_ids;
+    sdb_idset_clear(&old_ids);
+    sdb_idset_clear(&now_ids);
+    uint8_t *p = (uint8_t *)old->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(old);
+    uint16_t ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(old, p, &mi, &ref);
+        sdb_idset_add(&old_ids, mi.id);
+    }
+
+    // anything new or different goes into the patch as it is, in the
+    // same order; the tombstones come last either way
+    sdb_update_flags(patch, now->header & SDB_HDR_SORTED, SDB_HDR_SORTED | SDB_HDR_DIRECTORY);
+    patch->vals_size = 0;
+    sdb_copier_t c = { patch, NULL, 0, SDB_OK };
+    uint8_t *cursor = NULL;
+    p = (uint8_t *)now->buf + SDB_VALS_OFFSET;
+    pend = sdb_vals_end(now);
+    ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(now, p, &mi, &ref);
+        if (mi.id >= SDB_ID_RESERVED) continue;
+        sdb_idset_add(&now_ids, mi.id);
+        if (sdb_idset_has(&old_ids, mi.id)) {
+            sdb_member_info_t omi = {};
+            if (sdb_find_from(old, mi.id, &cursor, &omi) && sdb_same_value(&mi, &omi)) {
+                continue;
+            }
+        }
+        sdb_copier_add(&c, &mi);
+    }
+    sdb_copier_flush(&c);
+
+    // and anything that has gone away is listed as a tombstone
+    sdb_len_t gone = 0;
+    for (int pass=0; (pass<2) && (c.error == SDB_OK); pass++) {
+        uint16_t *pids = NULL;
+        if (pass) {
+            if (!gone) break;
+            pids = sdb_reserve_array(patch, SDB_ID_TOMBSTONES, SDB_U16, gone, &c.error);
+            if (!pids) break;
+            gone = 0;
+        }
+        p = (uint8_t *)old->buf + SDB_VALS_OFFSET;
+        pend = sdb_vals_end(old);
+        ref = 0;
+        while (p < pend) {
+            sdb_member_info_t mi = {};
+            p = sdb_next_record(old, p, &mi, &ref);
+            if ((mi.id >= SDB_ID_RESERVED) || sdb_idset_has(&now_ids, mi.id)) continue;
+            if (pids) memcpy(pids + gone, &mi.id, SDB_ID_SZ);
+            gone++;
+        }
+    }
+
+    if (c.error != SDB_OK) {
+        patch->vals_size = 0;
+    }
+    sdb_write_sizes(patch);
+    return c.error;
+}
+
+int8_t sdb_patch(sdb_t *dst, const sdb_t *base, const sdb_t *patch) {
+    return sdb_merge(dst, base, patch, SDB_MERGE_TOMBSTONES);
+}
+
+// Hashing goes through the payload in 32-byte stripes of four lanes
+// that don't depend on each other, each a 32x32 bit multiply and an add,
+// so that the compiler can keep them in vector registers.
+static const uint64_t sdb_hash_keys[4] = {
+    0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full,
+    0x165667b19e3779f9ull, 0x27d4eb2f165667c5ull,
+};
+
+static uint64_t sdb_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t sdb_hash_bytes(const uint8_t *p, size_t n, uint64_t seed) {
+    uint64_t h = seed;
+    size_t i = 0;
+    // most payloads are a few bytes, and go straight to the tail
+    if (n >= 32) {
+        uint64_t acc[4];
+        for (int l=0; l<4; l++) acc[l] = seed ^ sdb_hash_keys[l];
+        for (; i + 32 <= n; i += 32) {
+            uint64_t d[4];
+            memcpy(d, p + i, sizeof(d));
+            for (int l=0; l<4; l++) {
+                uint64_t k = d[l] ^ sdb_hash_keys[l];
+                acc[l] += (k & 0xffffffff) * (k >> 32);
+                acc[l ^ 1] += d[l];
+            }
+        }
+        for (int l=0; l<4; l++) h = sdb_hash_mix(h ^ acc[l]);
+    }
+    for (; i + 8 <= n; i += 8) {
+        uint64_t d;
+        memcpy(&d, p + i, sizeof(d));
+        h = sdb_hash_mix(h ^ d) * sdb_hash_keys[0];
+    }
+    if (i < n) {
+        uint64_t d = 0;
+        memcpy(&d, p + i, n - i);
+        h = sdb_hash_mix(h ^ d) * sdb_hash_keys[1];
+    }
+    return sdb_hash_mix(h);
+}
+
+uint64_t sdb_hash_record(const sdb_member_info_t *mi) {
+    uint64_t seed = (uint64_t)mi->id |
+                    ((uint64_t)mi->type << 16) |
+                    ((uint64_t)mi->elemsize << 24) |
+                    ((uint64_t)mi->elemcount << 40);
+    return sdb_hash_bytes(mi->data, mi->minsize, sdb_hash_mix(seed ^ sdb_hash_keys[2]));
+}
+
+uint64_t sdb_hash(const sdb_t *sdb) {
+    uint64_t h = 0;
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(sdb, p, &mi, &ref);
+        if (sdb_is_filler(mi.id)) continue;
+        h += sdb_hash_record(&mi);
+    }
+    return h;
+}
+
+static size_t sdb_count_records(const sdb_t *sdb) {
+    size_t n = 0;
+    uint8_t *p = (uint8_t *)sdb->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(sdb);
+    uint16_t ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(sdb, p, &mi, &ref);
+        if (!sdb_is_filler(mi.id)) n++;
+    }
+    return n;
+}
+
+bool sdb_equal(const sdb_t *a, const sdb_t *b) {
+    if (sdb_count_records(a) != sdb_count_records(b)) return false;
+    // two messages put together the same way are in the same order, and
+    // then each lookup in b starts right where it is
+    uint8_t *cursor = NULL;
+    uint8_t *p = (uint8_t *)a->buf + SDB_VALS_OFFSET;
+    uint8_t *pend = sdb_vals_end(a);
+    uint16_t ref = 0;
+    while (p < pend) {
+        sdb_member_info_t mi = {};
+        p = sdb_next_record(a, p, &mi, &ref);
+        if (sdb_is_filler(mi.id)) continue;
+        sdb_member_info_t bmi = {};
+        if (!sdb_find_from(b, mi.id, &cursor, &bmi) || !sdb_same_value(&mi, &bmi)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+sdb_tlen_t sdb_size(const sdb_t *sdb) {
+    return SDB_VALS_OFFSET + sdb->vals_size;
+}
+
+
+int8_t sdb_set_unsigned(sdb_t *sdb, sdb_id_t id, uint64_t uv) {
+    sdb_val_t v;
+    if (uv <= UINT8_MAX) {
+       v.u8 = uv;
+       return sdb_set_val(sdb, id, SDB_U8, &v);
+    }
+    if (uv <= UINT16_MAX) {
+       v.u16 = uv;
+       return sdb_set_val(sdb, id, SDB_U16, &v);
+    }
+    if (uv <= UINT32_MAX) {
+       v.u32 = uv;
+       return sdb_set_val(sdb, id, SDB_U32, &v);
+    }
+    v.u64 = uv;
+    return sdb_set_val(sdb, id, SDB_U64, &v);
 }
 
 int8_t sdb_set_signed(sdb_t *sdb, sdb_id_t id, int64_t iv) {
@@ -422,6 +1934,29 @@ int8_t sdb_set_signed(sdb_t *sdb, sdb_id_t id, int64_t iv) {
     return sdb_set_val(sdb, id, SDB_S64, &v);
 }
 
+int8_t sdb_set_double(sdb_t *sdb, sdb_id_t id, double dv) {
+    sdb_val_t v;
+    // bit for bit, so that -0.0 and NaN payloads survive too
+    if (isnan(dv) || isinf(dv) || ((dv >= -FLT_MAX) && (dv <= FLT_MAX))) {
+        v.f = (float)dv;
+        double back = v.f;
+        if (!memcmp(&back, &dv, sizeof(dv))) {
+            return sdb_set_val(sdb, id, SDB_FLOAT, &v);
+        }
+    }
+    v.d = dv;
+    return sdb_set_val(sdb, id, SDB_DOUBLE, &v);
+}
+
+int8_t sdb_set_halfa(sdb_t *sdb, sdb_id_t id, const sdb_len_t count, const float *data) {
+    int8_t err = SDB_OK;
+    void *ptarget = sdb_reserve_array(sdb, id, SDB_HALF, count, &err);
+    if (err == SDB_OK) {
+        sdb_floats_to_halfs(ptarget, data, count);
+    }
+    return err;
+}
+
 
 uint64_t sdb_get_unsigned(const sdb_t *sdb, sdb_id_t id, int8_t *error) {
     uint64_t rv = 0;
@@ -440,11 +1975,11 @@ uint64_t sdb_get_unsigned(const sdb_t *sdb, sdb_id_t id, int8_t *error) {
                 case SDB_U32: rv = v.u32; break;
                 case SDB_U64: rv = v.u64; break;
                 default:
-                    err = -SDB_DIFFERENT_TYPE;
+                    err = sdb_err(-SDB_DIFFERENT_TYPE);
             }
         }
     } else {
-        err = -SDB_NOT_FOUND;
+        err = sdb_err(-SDB_NOT_FOUND);
     }
 
     if (error) {
@@ -470,11 +2005,11 @@ int64_t sdb_get_signed(const sdb_t *sdb, sdb_id_t id, int8_t *error) {
                 case SDB_S32: rv = v.s32; break;
                 case SDB_S64: rv = v.s64; break;
                 default:
-                    err = -SDB_DIFFERENT_TYPE;
+                    err = sdb_err(-SDB_DIFFERENT_TYPE);
             }
         }
     } else {
-        err = -SDB_NOT_FOUND;
+        err = sdb_err(-SDB_NOT_FOUND);
     }
 
     if (error) {
@@ -483,6 +2018,129 @@ int64_t sdb_get_signed(const sdb_t *sdb, sdb_id_t id, int8_t *error) {
     return rv;
 }
 
+double sdb_get_double(const sdb_t *sdb, sdb_id_t id, int8_t *error) {
+    double rv = 0;
+    sdb_val_t v =  {};
+
+    sdb_member_info_t about = sdb_find(sdb, id);
+
+    int8_t err = SDB_OK;
+
+    if (about.valid && (about.type != SDB_HALF) && (about.type != SDB_FLOAT) && (about.type != SDB_DOUBLE)) {
+        // nor would a blob, so check before copying anything
+        err = sdb_err(-SDB_DIFFERENT_TYPE);
+    } else if (about.valid && (about.elemcount != 1)) {
+        // an array would not fit in v
+        err = sdb_err(-SDB_DIFFERENT_COUNT);
+    } else if (about.valid) {
+        err = sdb_get(&about, &v);
+        if (err == SDB_OK) {
+            switch (about.type) {
+                case SDB_HALF:   rv = sdb_half_to_float(v.u16); break;
+                case SDB_FLOAT:  rv = v.f; break;
+                default:         rv = v.d; break;
+            }
+        }
+    } else {
+        err = sdb_err(-SDB_NOT_FOUND);
+    }
+
+    if (error) {
+        *error = err;
+    }
+    return rv;
+}
+
+int8_t sdb_get_halfa(const sdb_member_info_t *about, float *data) {
+    if (!about || !about->valid) return sdb_err(-SDB_BAD_HANDLE);
+    if (about->type != SDB_HALF) return sdb_err(-SDB_DIFFERENT_TYPE);
+    sdb_halfs_to_floats(data, about->data, about->elemcount);
+    return SDB_OK;
+}
+
+float sdb_half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1f;
+    uint32_t m = h & 0x3ff;
+    uint32_t x = sign;
+    if (e == 0x1f) {
+        x |= 0x7f800000 | (m << 13);
+    } else if (e) {
+        x |= ((e + 127 - 15) << 23) | (m << 13);
+    } else if (m) {
+        // subnormal, but a float has the range to make it normal
+        e = 127 - 14;
+        while (!(m & 0x400)) {
+            m <<= 1;
+            e--;
+        }
+        x |= (e << 23) | ((m & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+uint16_t sdb_float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t a = x & 0x7fffffff;
+    if (a >= 0x7f800000) {
+        // NaNs stay NaNs, and quiet, as F16C has them
+        return sign | 0x7c00 | (a > 0x7f800000 ? 0x200 | ((a >> 13) & 0x3ff) : 0);
+    }
+    // 65520 and up round to infinity
+    if (a >= 0x477ff000) return sign | 0x7c00;
+    if (a >= 0x38800000) {
+        // normal: rebias, then round off 13 bits, half to even. A carry
+        // into the exponent is still the right answer.
+        uint32_t r = a - ((127 - 15) << 23);
+        r += 0xfff + ((r >> 13) & 1);
+        return sign | (r >> 13);
+    }
+    // half of the least subnormal, or less, is a tie or below it
+    if (a <= 0x33000000) return sign;
+    uint32_t m = (a & 0x7fffff) | 0x800000;
+    uint32_t shift = 126 - (a >> 23);
+    uint32_t h = m >> shift;
+    uint32_t rem = m & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if ((rem > halfway) || ((rem == halfway) && (h & 1))) h++;
+    return sign | h;
+}
+
+void sdb_halfs_to_floats(float *dst, const void *src, size_t n) {
+    const uint8_t *p = (const uint8_t *)src;
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t h;
+        memcpy(&h, p + 2 * i, sizeof(h));
+        dst[i] = sdb_half_to_float(h);
+    }
+}
+
+void sdb_floats_to_halfs(void *dst, const float *src, size_t n) {
+    uint8_t *p = (uint8_t *)dst;
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(p + 2 * i), h);
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t h = sdb_float_to_half(src[i]);
+        memcpy(p + 2 * i, &h, sizeof(h));
+    }
+}
+
 bool sdb_is_signed(sdbtypes_t t) {
     switch (t) {
         case SDB_S8:
@@ -4,13 +4,48 @@
 #define SDB_INCL_FLOAT 0
 #endif
 
+// set to use the system's struct iovec for sdb_to_iov
+#ifndef SDB_INCL_IOVEC
+#define SDB_INCL_IOVEC 0
+#endif
+
+// set to count what lookups and changes cost; see sdb_stats_get
+#ifndef SDB_INCL_STATS
+#define SDB_INCL_STATS 0
+#endif
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#if SDB_INCL_IOVEC
+#include <sys/uio.h>
+#endif
 
 #define SDB_VER_MAJOR (0x2)
 #define SDB_VER_MINOR (0x0)
 
+// The low three bits of the header byte were the minor version, but
+// readers have only ever checked the major version and endianness, so
+// they now hold flags describing how the message was put together.
+// records are in order of id
+#define SDB_HDR_SORTED    (0x01)
+// the first record is a directory of where every record starts
+#define SDB_HDR_DIRECTORY (0x02)
+// payloads are padded out to an alignment; see sdb_align
+#define SDB_HDR_ALIGNED   (0x04)
+
+// ids from here up are set aside for sdb's own use
+#define SDB_ID_RESERVED   (0xfff0)
+// a u16 array of ids that a delta removes; see sdb_merge
+#define SDB_ID_TOMBSTONES (0xfff0)
+// a blob of {u16 id, u32 offset} entries in id order; see sdb_add_directory
+#define SDB_ID_DIRECTORY  (0xfff1)
+// filler put in by sdb_align. There may be any number of these.
+#define SDB_ID_PAD        (0xfff2)
+
+// flags for sdb_merge
+#define SDB_MERGE_TOMBSTONES (0x01)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -41,6 +76,7 @@ typedef enum __attribute__((__packed__)) sdbtypes_t {
     SDB_U8, SDB_U16, SDB_U32, SDB_U64,
     SDB_FLOAT, SDB_DOUBLE,
     SDB_BLOB,
+    SDB_HALF,          // IEEE half precision; in sdb_val_t it is the u16
     _SDB_INVALID_TYPE,
 } sdbtypes_t;
 
@@ -56,21 +92,58 @@ typedef enum sdb_errors_t {
     SDB_BAD_HANDLE,
     SDB_SCAN_ERROR,
     SDB_ITEM_TOO_BIG,
+    SDB_READ_ONLY,
+    SDB_MISALIGNED,
+    SDB_BUSY,
 } sdb_errors_t;
 
+#if SDB_INCL_IOVEC
+typedef struct iovec sdb_iov_t;
+#else
+// laid out like struct iovec
+typedef struct sdb_iov_t {
+    void   *iov_base;
+    size_t  iov_len;
+} sdb_iov_t;
+#endif
+
+// a blob whose payload stays in the caller's memory. "offset" is where
+// in the buffer the payload would have gone.
+typedef struct sdb_ref_t {
+    sdb_tlen_t  offset;
+    const void *data;
+    sdb_len_t   len;
+} sdb_ref_t;
+
 typedef struct sdb_t {
     void *buf;
     sdb_tlen_t len;
     sdb_hdr_t  header;
     sdb_tlen_t vals_size;
+    bool       readonly; // set for views into another buffer
+    sdb_ref_t  *refs;    // see sdb_attach_refs
+    uint16_t   nrefs;
+    uint16_t   max_refs;
+    sdb_tlen_t ext_size; // part of vals_size held by reference
+    uint32_t   filter[8]; // ids that may be present; see sdb_build_filter
+    bool       filtered;  // filter is up to date
 } sdb_t;
 
+// one item for sdb_set_many. For a blob, count is its size in bytes.
+typedef struct sdb_field_t {
+    sdb_id_t    id;
+    sdbtypes_t  type;
+    sdb_len_t   count;
+    const void *data;
+} sdb_field_t;
+
 // this structure is set up by sdb_find and contains
 // both the info sdb needs to find a data element as
 // well as info you need to determine the type and
 // size of a found data element
 typedef struct sdb_member_info_t {
     const uint8_t *handle;
+    const uint8_t *data;     // the payload itself, in place
     sdb_id_t      id;
     sdbtypes_t    type;
     sdb_len_t     elemsize;
@@ -84,7 +157,7 @@ int8_t   sdb_init         (sdb_t *sdb, void *b, const sdb_tlen_t l, bool clear);
 
 // obtain total size of blob. Primary use is if you are about to 
 // transmit or write out the buffer
-sdb_len_t sdb_size        (const sdb_t *sdb);
+sdb_tlen_t sdb_size       (const sdb_t *sdb);
 
 // setters for standard types:
 // .. an array:
@@ -94,6 +167,51 @@ int8_t   sdb_set_val      (sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const
 // .. or just one, integers only (automatically uses smallest type):
 int8_t   sdb_set_unsigned (sdb_t *sdb, sdb_id_t id, uint64_t v);
 int8_t   sdb_set_signed   (sdb_t *sdb, sdb_id_t id, int64_t v);
+// .. or floating point, as a float if that loses nothing, else a double
+int8_t   sdb_set_double   (sdb_t *sdb, sdb_id_t id, double v);
+// .. or floats, stored as halves, rounding to nearest even
+int8_t   sdb_set_halfa    (sdb_t *sdb, sdb_id_t id, const sdb_len_t count, const float *data);
+
+// .. or many at once. Later items win over earlier ones with the same
+// id. Nothing is changed unless they all fit. sdb_measure gives the size
+// of a new message holding exactly these items, to size a buffer with.
+int8_t   sdb_set_many     (sdb_t *sdb, const sdb_field_t *fields, size_t n);
+sdb_tlen_t sdb_measure    (const sdb_field_t *fields, size_t n);
+
+// sort the items by id and mark the message as sorted. From then on
+// every setter keeps it sorted, and lookups stop as soon as they have
+// passed the id they want. Two sorted messages with the same items are
+// identical byte for byte. Call it on a freshly cleared buffer to build
+// a sorted message from scratch.
+int8_t   sdb_canonicalize (sdb_t *sdb);
+
+// move the given ids to the front, in that order, so that a reader
+// scanning front to back finds them first. Ids that aren't present are
+// ignored. Any reader can still read the result, but it is no longer
+// sorted unless it already was in that order.
+int8_t   sdb_reorder      (sdb_t *sdb, const sdb_id_t *ids, size_t n);
+
+// put a directory at the front of a finished message so that lookups
+// are a binary search rather than a scan. Offsets count from the start
+// of the values. Any later change to the message drops the directory;
+// add it again just before sending.
+int8_t   sdb_add_directory(sdb_t *sdb);
+
+// pad a finished message so that every array payload starts at a
+// multiple of its element size and every blob at a multiple of 8, or,
+// with a boundary of 8, 16, 32 or 64, so that they all start at that.
+// Positions count from the start of the buffer, so a reader gets
+// aligned payloads if it keeps the message at that alignment. Like the
+// directory, the padding goes again on the next change, and the two
+// can't be had together. Not for messages with refs.
+int8_t   sdb_align        (sdb_t *sdb, uint8_t boundary);
+
+// note which ids are present in a small filter, so that looking for
+// one that is not there usually costs nothing rather than a full scan.
+// A freshly cleared message keeps its filter up to date as items are
+// added; call this once on a message that was received or opened, or
+// after writing into the buffer behind sdb's back.
+void     sdb_build_filter (sdb_t *sdb);
 
 // remove an element or report not found
 int8_t   sdb_remove       (sdb_t *sdb, sdb_id_t id);
@@ -101,26 +219,164 @@ int8_t   sdb_remove       (sdb_t *sdb, sdb_id_t id);
 // setter for blobs
 int8_t   sdb_add_blob     (sdb_t *sdb, sdb_id_t id, const void *ib, const sdb_len_t isize);
 
+// blobs can also be added by reference, so that large payloads are
+// never copied into the buffer. Give the sdb a table to keep track of
+// them with sdb_attach_refs, then add them with sdb_add_blob_ref. The
+// memory must stay put until the message has been sent. sdb_size is
+// still the size on the wire, but the buffer alone no longer holds the
+// message: use sdb_to_iov to get it as pieces to hand to writev.
+// sdb_to_iov returns the number of pieces used, or an error.
+int8_t   sdb_attach_refs  (sdb_t *sdb, sdb_ref_t *refs, uint16_t max_refs);
+int8_t   sdb_add_blob_ref (sdb_t *sdb, sdb_id_t id, const void *ib, const sdb_len_t isize);
+int      sdb_to_iov       (const sdb_t *sdb, sdb_iov_t *iov, int max_iov);
+
+// reserve space for a blob or an array and return a pointer to where
+// its payload goes, so it can be filled in place rather than copied in.
+// The pointer is good until the sdb is next modified. If less than was
+// reserved ends up being used, sdb_shrink gives back the rest; "used"
+// is in bytes for a blob and in elements for an array.
+void    *sdb_reserve_blob (sdb_t *sdb, sdb_id_t id, const sdb_len_t size, int8_t *error);
+void    *sdb_reserve_array(sdb_t *sdb, sdb_id_t id, const sdbtypes_t type, const sdb_len_t count, int8_t *error);
+int8_t   sdb_shrink       (sdb_t *sdb, sdb_id_t id, const sdb_len_t used);
+
+// build a nested sdb directly inside the parent's free space, instead
+// of building it elsewhere and copying it in with sdb_add_blob.
+// sdb_begin_nested sets up "child" to use the space at the end of the
+// parent; fill it with the usual setters (or nest further), then call
+// sdb_end_nested to add it to the parent as blob "id". Do not modify
+// the parent while a child is open. A child that is never ended leaves
+// the parent unchanged, apart from any earlier item with that id.
+int8_t   sdb_begin_nested (sdb_t *parent, sdb_id_t id, sdb_t *child);
+int8_t   sdb_end_nested   (sdb_t *parent, sdb_t *child);
+
+// combine two messages into dst, which must be set up with its own
+// buffer. dst gets everything in overlay, plus everything in base that
+// overlay does not replace. With SDB_MERGE_TOMBSTONES, items that the
+// overlay lists in SDB_ID_TOMBSTONES are left out too. Records in the
+// reserved id range are not copied.
+int8_t   sdb_merge        (sdb_t *dst, const sdb_t *base, const sdb_t *overlay, uint8_t flags);
+
+// sdb_diff fills "patch" (set up with its own buffer) with whatever is
+// new or changed in "now" compared to "old", plus a tombstone list of
+// what has gone. sdb_patch applies that to base, building the result in
+// dst. sdb_patch(dst, old, patch) gives the same items as "now".
+int8_t   sdb_diff         (sdb_t *patch, const sdb_t *old, const sdb_t *now);
+int8_t   sdb_patch        (sdb_t *dst, const sdb_t *base, const sdb_t *patch);
+
+// a hash of what a message holds, rather than of its bytes: the same for
+// the same items in any order, with or without a directory or padding.
+// A single value and an array of one are the same, as they are to the
+// getters. It is the sum of sdb_hash_record over the items, so a cached
+// hash can be kept up to date by taking away the old item's hash and
+// adding the new one's. Not for use against someone choosing collisions.
+uint64_t sdb_hash         (const sdb_t *sdb);
+uint64_t sdb_hash_record  (const sdb_member_info_t *mi);
+// the same items in both, in whatever order
+bool     sdb_equal        (const sdb_t *a, const sdb_t *b);
+
 // "find" an item by name and set up a member_info_t with a pointer
 // to the object as well as metadata you need to size a receiving
 // buffer
 sdb_member_info_t sdb_find(const sdb_t *sdb, sdb_id_t id);
 
+// step through the items in the order they are in the message: pass
+// NULL for the first and the previous result after that. Directories
+// and padding are skipped. The result is not valid after the last.
+sdb_member_info_t sdb_iter(const sdb_t *sdb, const sdb_member_info_t *prev);
+
+// for a message from somewhere not trusted, before looking inside:
+// SDB_SCAN_ERROR unless every record, and everywhere a directory
+// points, lies within vals_size. Lookups and sdb_iter do not check.
+int8_t   sdb_check        (const sdb_t *sdb);
+
 // A simple, generic getter. "data" must be large enough to hold
 // the data. Inspect the member_info_t.minsize value to determine
 // the minimum receiving size.
 int8_t   sdb_get          (const sdb_member_info_t *about, void *data);
 
+// zero-copy alternative to sdb_get: a pointer to the payload inside
+// the buffer, valid until the buffer is next modified
+const void *sdb_get_ptr   (const sdb_member_info_t *about);
+
+// a pointer straight into the buffer for an item of the given type,
+// that can be used as a const T* because it is a multiple of align
+// bytes (or of the element size, if align is 0) from address zero.
+// Fails with SDB_MISALIGNED rather than hand out anything else. count
+// is set to the number of elements, or bytes for a blob.
+const void *sdb_get_aligned(const sdb_t *sdb, sdb_id_t id, sdbtypes_t type, size_t align, sdb_len_t *count, int8_t *error);
+
+// initialize a read-only sdb directly over a blob member that itself
+// holds an sdb, without copying it out of the parent buffer
+int8_t   sdb_init_nested  (sdb_t *inner, const sdb_member_info_t *about);
+
+// look up several ids at once, filling in one sdb_member_info_t per id
+// and returning how many were found. On a sorted message with the ids in
+// ascending order, this takes a single pass.
+size_t   sdb_find_many    (const sdb_t *sdb, const sdb_id_t *ids, size_t n, sdb_member_info_t *mis);
+
+// like sdb_find, but walks a path of ids through nested sdbs. All but
+// the last id must name blobs that hold sdbs. The returned info points
+// into the outermost buffer.
+sdb_member_info_t sdb_find_path(const sdb_t *sdb, const sdb_id_t *path, size_t depth);
+
 uint64_t sdb_get_unsigned (const sdb_t *sdb, sdb_id_t id, int8_t *error);
 int64_t  sdb_get_signed   (const sdb_t *sdb, sdb_id_t id, int8_t *error);
+// any of half, float or double, without loss
+double   sdb_get_double   (const sdb_t *sdb, sdb_id_t id, int8_t *error);
+// a half array as floats; "data" must hold about->elemcount of them
+int8_t   sdb_get_halfa    (const sdb_member_info_t *about, float *data);
+
+// conversions to and from half precision. Halves may be at any
+// alignment. Built with F16C (-mf16c, or a -march that has it), the
+// arrays go eight at a time.
+float    sdb_half_to_float  (uint16_t h);
+uint16_t sdb_float_to_half  (float f);
+void     sdb_halfs_to_floats(float *dst, const void *src, size_t n);
+void     sdb_floats_to_halfs(void *dst, const float *src, size_t n);
 
 // debug dumper
 void     sdb_debug        (const sdb_t *sdb);
 void     sdb_show_mi      (const sdb_member_info_t *mi);
+// names for sdb_debug to show beside the ids they hash to. The table is
+// not copied; pass NULL to stop.
+void     sdb_debug_names  (const char *const *names, size_t n);
+
+// the id for a field name, the same one SDB_NAME gives at compile time
+// in C++ (see sdb_names.hpp), for callers that name their fields
+sdb_id_t sdb_name_id      (const char *name);
 
 bool     sdb_is_signed    (sdbtypes_t t);
 bool     sdb_is_unsigned  (sdbtypes_t t);
 
+#if SDB_INCL_STATS
+#define SDB_STATS_SCAN_BUCKETS (12)
+#define SDB_STATS_IDS          (64)
+#define SDB_STATS_ERRORS       (16)
+
+// counters for the calling thread since it started or last reset
+typedef struct sdb_stats_t {
+    // records stepped over per lookup, setters' lookups included.
+    // Bucket 0 is none (the filter said no), bucket n is up to 2^n - 1,
+    // and the last is everything longer.
+    uint32_t scans[SDB_STATS_SCAN_BUCKETS];
+    // sdb_find and the getters, by id, for the first ids seen
+    struct {
+        sdb_id_t id;
+        uint32_t hits;
+        uint32_t misses;
+    } ids[SDB_STATS_IDS];
+    uint32_t other_hits;   // ids that didn't fit in the table
+    uint32_t other_misses;
+    uint64_t moved;        // bytes memmove'd to make or close gaps
+    uint32_t errors[SDB_STATS_ERRORS]; // by sdb_errors_t
+} sdb_stats_t;
+
+void     sdb_stats_get    (sdb_stats_t *stats);
+void     sdb_stats_reset  (void);
+// the ids with the most hits so far, most first, to pass to sdb_reorder
+size_t   sdb_stats_hot_ids(sdb_id_t *ids, size_t max);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,7 +1,10 @@
 
+#include <algorithm>
 #include <ctype.h>
 #include <map>
+#include <math.h>
 #include <random>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -9,6 +12,7 @@
 #include <vector>
 
 #include "sdbuf.h"
+#include "sdb_names.hpp"
 
 #define BUF_SIZE (2048)
 
@@ -186,7 +190,7 @@ int test_two() {
         uint16_t id = rand() & 0xffff;
         
         sdb_val_t rint;
-        if (stype < SDB_FLOAT) {
+        if ((stype < SDB_FLOAT) || (stype == SDB_HALF)) {
             rint.u64 = 0;
             rint.u64 <<= 16; rint.u64 |= rand() & 0xffff;
             rint.u64 <<= 16; rint.u64 |= rand() & 0xffff;
@@ -415,6 +419,1164 @@ int test_six() {
     return ec.get();
 }
 
+int test_seven() {
+    // nested sdbufs, read in place
+
+    sdb_t outer;
+    uint8_t outbuf[BUF_SIZE];
+    ec.check(sdb_init(&outer, outbuf, BUF_SIZE, true),"could not init top buf");
+
+    uint8_t midbuf[512];
+    sdb_t mid;
+    ec.check(sdb_init(&mid, midbuf, 512, true),"could not init mid buf");
+
+    uint8_t inbuf[128];
+    sdb_t inner;
+    ec.check(sdb_init(&inner, inbuf, 128, true),"could not init inner buf");
+    int32_t i32 = -123456;
+    ec.check(sdb_set_val(&inner, 0x30, SDB_S32, &i32),"could not set inner val");
+    const char *msg = "deep down";
+    ec.check(sdb_add_blob(&inner, 0x31, msg, strlen(msg)),"could not add inner blob");
+
+    ec.check(sdb_set_unsigned(&mid, 0x20, 77),"could not set mid val");
+    ec.check(sdb_add_blob(&mid, 0x21, inner.buf, sdb_size(&inner)),"could not add inner to mid");
+    ec.check(sdb_set_unsigned(&outer, 0x10, 5),"could not set outer val");
+    ec.check(sdb_add_blob(&outer, 0x11, mid.buf, sdb_size(&mid)),"could not add mid to outer");
+
+    auto mi = sdb_find(&outer, 0x11);
+    ec.check(!mi.valid, "mid not found");
+    sdb_t view;
+    ec.check(sdb_init_nested(&view, &mi),"could not init nested view");
+    ec.check(view.buf != sdb_get_ptr(&mi), "nested view is not in place");
+    int8_t err = 0;
+    ec.check(sdb_get_unsigned(&view, 0x20, &err) != 77, "wrong mid value");
+    ec.check(err, "could not get mid value");
+    ec.check(sdb_set_unsigned(&view, 0x22, 1) != -SDB_READ_ONLY, "nested view should be read only");
+
+    mi = sdb_find(&outer, 0x10);
+    ec.check(sdb_init_nested(&view, &mi) != -SDB_DIFFERENT_TYPE, "scalar should not be nested");
+
+    const sdb_id_t p0[] = { 0x11, 0x21, 0x30 };
+    mi = sdb_find_path(&outer, p0, 3);
+    ec.check(!mi.valid, "path to 0x30 not found");
+    sdb_val_t v = {};
+    ec.check(sdb_get(&mi, &v), "could not get 0x30");
+    ec.check(v.s32 != i32, "wrong value at 0x30");
+
+    const sdb_id_t p1[] = { 0x11, 0x21, 0x31 };
+    mi = sdb_find_path(&outer, p1, 3);
+    ec.check(!mi.valid, "path to 0x31 not found");
+    ec.check(mi.elemsize != strlen(msg), "wrong length at 0x31");
+    ec.check(memcmp(sdb_get_ptr(&mi), msg, mi.elemsize), "wrong blob at 0x31");
+    auto pouter = static_cast<const uint8_t *>(outer.buf);
+    ec.check(!((mi.data > pouter) && (mi.data < pouter + sdb_size(&outer))), "0x31 not in outer buffer");
+
+    const sdb_id_t p2[] = { 0x11, 0x20, 0x30 };
+    mi = sdb_find_path(&outer, p2, 3);
+    ec.check(mi.valid, "path through scalar should fail");
+
+    const sdb_id_t p3[] = { 0x11, 0x99 };
+    mi = sdb_find_path(&outer, p3, 2);
+    ec.check(mi.valid, "path to missing id should fail");
+
+    return ec.get();
+}
+
+int test_eight() {
+    // nested sdbufs, built in place
+
+    sdb_t outer;
+    uint8_t outbuf[BUF_SIZE];
+    ec.check(sdb_init(&outer, outbuf, BUF_SIZE, true),"could not init top buf");
+    ec.check(sdb_set_unsigned(&outer, 0x10, 5),"could not set outer val");
+
+    // the same message as test_seven, without any scratch buffers
+    sdb_t mid, inner;
+    ec.check(sdb_begin_nested(&outer, 0x11, &mid),"could not begin mid");
+    ec.check(sdb_set_unsigned(&mid, 0x20, 77),"could not set mid val");
+    ec.check(sdb_begin_nested(&mid, 0x21, &inner),"could not begin inner");
+    int32_t i32 = -123456;
+    ec.check(sdb_set_val(&inner, 0x30, SDB_S32, &i32),"could not set inner val");
+    const char *msg = "deep down";
+    ec.check(sdb_add_blob(&inner, 0x31, msg, strlen(msg)),"could not add inner blob");
+    ec.check(sdb_end_nested(&mid, &inner),"could not end inner");
+    ec.check(sdb_end_nested(&outer, &mid),"could not end mid");
+    ec.check(sdb_end_nested(&outer, &mid) != -SDB_BAD_HANDLE,"ended mid twice");
+
+    // compare against the copying way of doing it
+    sdb_t ref, refmid, refinner;
+    uint8_t refbuf[BUF_SIZE], refmidbuf[512], refinbuf[128];
+    sdb_init(&ref, refbuf, BUF_SIZE, true);
+    sdb_init(&refmid, refmidbuf, 512, true);
+    sdb_init(&refinner, refinbuf, 128, true);
+    sdb_set_val(&refinner, 0x30, SDB_S32, &i32);
+    sdb_add_blob(&refinner, 0x31, msg, strlen(msg));
+    sdb_set_unsigned(&refmid, 0x20, 77);
+    sdb_add_blob(&refmid, 0x21, refinner.buf, sdb_size(&refinner));
+    sdb_set_unsigned(&ref, 0x10, 5);
+    sdb_add_blob(&ref, 0x11, refmid.buf, sdb_size(&refmid));
+    ec.check(sdb_size(&outer) != sdb_size(&ref), "nested size mismatch");
+    ec.check(memcmp(outer.buf, ref.buf, sdb_size(&ref)), "nested bytes mismatch");
+
+    // an abandoned child leaves nothing behind
+    sdb_len_t before = sdb_size(&outer);
+    ec.check(sdb_begin_nested(&outer, 0x12, &mid),"could not begin abandoned");
+    ec.check(sdb_set_unsigned(&mid, 0x20, 1),"could not set abandoned val");
+    ec.check(sdb_size(&outer) != before, "abandoned child changed parent");
+    ec.check(sdb_find(&outer, 0x12).valid, "abandoned child was found");
+
+    // and an item can be replaced by a nested one
+    ec.check(sdb_begin_nested(&outer, 0x10, &mid),"could not begin replacement");
+    ec.check(sdb_set_unsigned(&mid, 0x40, 6),"could not set replacement val");
+    ec.check(sdb_end_nested(&outer, &mid),"could not end replacement");
+    const sdb_id_t path[] = { 0x10, 0x40 };
+    auto mi = sdb_find_path(&outer, path, 2);
+    ec.check(!mi.valid, "replacement not found");
+    const sdb_id_t deep[] = { 0x11, 0x21, 0x31 };
+    mi = sdb_find_path(&outer, deep, 3);
+    ec.check(!mi.valid || memcmp(sdb_get_ptr(&mi), msg, mi.elemsize), "deep blob lost");
+
+    sdb_t tiny;
+    uint8_t tinybuf[12];
+    sdb_init(&tiny, tinybuf, sizeof(tinybuf), true);
+    ec.check(sdb_begin_nested(&tiny, 0x1, &mid) != -SDB_BUFFER_TOO_SMALL, "nested should not fit");
+
+    return ec.get();
+}
+
+int test_nine() {
+    // filling items in place
+
+    sdb_t s;
+    uint8_t obuf[BUF_SIZE];
+    ec.check(sdb_init(&s, obuf, BUF_SIZE, true),"could not init top buf");
+
+    int8_t err = 0;
+    auto pb = static_cast<uint8_t *>(sdb_reserve_blob(&s, 0x100, 64, &err));
+    ec.check(err, "could not reserve blob");
+    const char *msg = "written in place";
+    memcpy(pb, msg, strlen(msg));
+
+    auto pa = static_cast<uint16_t *>(sdb_reserve_array(&s, 0x101, SDB_U16, 10, &err));
+    ec.check(err, "could not reserve array");
+    for (uint16_t i=0; i<10; i++) { 
+        uint16_t v = i * 100;
+        memcpy(pa + i, &v, sizeof(v));
+    }
+    ec.check(sdb_set_unsigned(&s, 0x102, 0x1234), "could not set after reserves");
+
+    // give back what the blob did not use, even though it is not last
+    sdb_len_t before = sdb_size(&s);
+    ec.check(sdb_shrink(&s, 0x100, strlen(msg)), "could not shrink blob");
+    ec.check(sdb_size(&s) != before - (64 - strlen(msg)), "blob shrink size wrong");
+    ec.check(sdb_shrink(&s, 0x101, 4), "could not shrink array");
+    ec.check(sdb_shrink(&s, 0x101, 5) != -SDB_DIFFERENT_COUNT, "array should not grow");
+    ec.check(sdb_shrink(&s, 0x102, 0) != -SDB_DIFFERENT_COUNT, "scalar should not shrink");
+    ec.check(sdb_shrink(&s, 0x103, 0) != -SDB_NOT_FOUND, "shrink of missing item");
+
+    // should be just what the copying setters would have made
+    sdb_t r;
+    uint8_t rbuf[BUF_SIZE];
+    sdb_init(&r, rbuf, BUF_SIZE, true);
+    sdb_add_blob(&r, 0x100, msg, strlen(msg));
+    const uint16_t ra[] = { 0, 100, 200, 300 };
+    sdb_set_vala(&r, 0x101, SDB_U16, 4, ra);
+    sdb_set_unsigned(&r, 0x102, 0x1234);
+    ec.check(sdb_size(&s) != sdb_size(&r), "reserved size mismatch");
+    ec.check(memcmp(s.buf, r.buf, sdb_size(&r)), "reserved bytes mismatch");
+
+    ec.check(sdb_reserve_blob(&s, 0x104, BUF_SIZE, &err) != NULL, "reserve should not fit");
+    ec.check(err != -SDB_BUFFER_TOO_SMALL, "reserve should be too small");
+
+    // refs after a shrunk item move down with it
+    sdb_ref_t refs[1];
+    const char *big = "held by reference";
+    sdb_init(&s, obuf, BUF_SIZE, true);
+    sdb_attach_refs(&s, refs, 1);
+    sdb_reserve_blob(&s, 0x100, 32, &err);
+    ec.check(sdb_add_blob_ref(&s, 0x101, big, strlen(big)), "could not add ref");
+    ec.check(sdb_shrink(&s, 0x100, 4), "could not shrink before ref");
+    sdb_member_info_t mi = sdb_find(&s, 0x101);
+    ec.check(!mi.valid || (mi.data != (const uint8_t *)big), "ref lost after shrink");
+    sdb_iov_t iov[4];
+    int n = sdb_to_iov(&s, iov, 4);
+    size_t total = 0;
+    for (int i=0; i<n; i++) total += iov[i].iov_len;
+    ec.check((n != 2) || (total != sdb_size(&s)), "pieces wrong after shrink");
+
+    return ec.get();
+}
+
+int test_ten() {
+    // blobs held by reference, sent as pieces
+
+    std::string big0(20000, 'a'), big1(30000, 'b');
+    for (size_t i=0; i<big0.size(); i++) big0[i] = rand() & 0xff;
+    for (size_t i=0; i<big1.size(); i++) big1[i] = rand() & 0xff;
+    const char *small = "a small blob";
+
+    sdb_t s;
+    uint8_t obuf[256];
+    sdb_ref_t refs[4];
+    ec.check(sdb_init(&s, obuf, sizeof(obuf), true),"could not init top buf");
+    ec.check(sdb_attach_refs(&s, refs, 4), "could not attach refs");
+    ec.check(sdb_set_unsigned(&s, 0x100, 0x12345678), "could not set before refs");
+    ec.check(sdb_add_blob_ref(&s, 0x101, big0.data(), big0.size()), "could not add ref 0x101");
+    ec.check(sdb_add_blob(&s, 0x102, small, strlen(small)), "could not add 0x102");
+    ec.check(sdb_add_blob_ref(&s, 0x103, big1.data(), big1.size()), "could not add ref 0x103");
+    ec.check(sdb_add_blob_ref(&s, 0x104, small, strlen(small)), "could not add ref 0x104");
+    // replacing a ref moves everything after it, refs included
+    ec.check(sdb_add_blob_ref(&s, 0x101, big0.data(), big0.size() / 2), "could not replace ref 0x101");
+    ec.check(sdb_set_unsigned(&s, 0x100, 7), "could not replace 0x100");
+    ec.check(s.nrefs != 3, "wrong ref count");
+
+    auto mi = sdb_find(&s, 0x103);
+    ec.check(!mi.valid || (mi.elemsize != big1.size()), "ref 0x103 not found");
+    ec.check(sdb_get_ptr(&mi) != big1.data(), "ref 0x103 should point at the original");
+    std::string got(mi.minsize, 0);
+    ec.check(sdb_get(&mi, &got[0]), "could not get ref 0x103");
+    ec.check(got != big1, "ref 0x103 does not match");
+    mi = sdb_find(&s, 0x102);
+    ec.check(!mi.valid || memcmp(sdb_get_ptr(&mi), small, mi.elemsize), "0x102 lost among refs");
+
+    sdb_iov_t iov[8];
+    int n = sdb_to_iov(&s, iov, 8);
+    ec.check(n != 7, "wrong number of pieces");
+    ec.check(sdb_to_iov(&s, iov, 3) != -SDB_BUFFER_TOO_SMALL, "pieces should not fit");
+    std::string wire;
+    for (int i=0; i<n; i++) {
+        wire.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+    ec.check(wire.size() != sdb_size(&s), "wire size mismatch");
+
+    // the same thing, copied in the ordinary way
+    std::vector<uint8_t> rbuf(64 * 1024);
+    sdb_t r;
+    sdb_init(&r, rbuf.data(), rbuf.size(), true);
+    sdb_add_blob(&r, 0x102, small, strlen(small));
+    sdb_add_blob(&r, 0x103, big1.data(), big1.size());
+    sdb_add_blob(&r, 0x104, small, strlen(small));
+    sdb_add_blob(&r, 0x101, big0.data(), big0.size() / 2);
+    sdb_set_unsigned(&r, 0x100, 7);
+    ec.check(sdb_size(&r) != wire.size(), "reference size mismatch");
+    ec.check(memcmp(r.buf, wire.data(), wire.size()), "wire bytes mismatch");
+
+    ec.check(sdb_remove(&s, 0x103), "could not remove ref");
+    ec.check(s.nrefs != 2, "ref not dropped");
+    ec.check(sdb_remove(&r, 0x103), "could not remove reference copy");
+    n = sdb_to_iov(&s, iov, 8);
+    wire.clear();
+    for (int i=0; i<n; i++) {
+        wire.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+    ec.check((wire.size() != sdb_size(&r)) || memcmp(r.buf, wire.data(), wire.size()), "wire bytes mismatch after remove");
+
+    ec.check(sdb_add_blob_ref(&s, 0x105, small, 1), "could not add third ref");
+    ec.check(sdb_add_blob_ref(&s, 0x106, small, 1), "could not add fourth ref");
+    ec.check(sdb_add_blob_ref(&s, 0x107, small, 1) != -SDB_BUFFER_TOO_SMALL, "ref table should be full");
+
+    return ec.get();
+}
+
+int test_eleven() {
+    // many at once
+
+    const uint8_t  u8 = 0x11;
+    const int16_t  s16a[] = { -1, -2, -3 };
+    const uint32_t u32 = 0xdeadbeef;
+    const char    *msg = "batched blob";
+    const uint64_t u64 = 0x0102030405060708ULL;
+    const sdb_field_t fields[] = {
+        { 0x10, SDB_U8,   1, &u8 },
+        { 0x11, SDB_S16,  3, s16a },
+        { 0x12, SDB_U32,  1, &u32 },
+        { 0x13, SDB_BLOB, (sdb_len_t)strlen(msg), msg },
+        { 0x11, SDB_U64,  1, &u64 },   // replaces the first 0x11
+    };
+    const size_t nfields = sizeof(fields) / sizeof(fields[0]);
+
+    // the same, one at a time, without the repeat
+    sdb_t r;
+    uint8_t rbuf[BUF_SIZE];
+    sdb_init(&r, rbuf, BUF_SIZE, true);
+    sdb_set_val(&r, 0x10, SDB_U8, &u8);
+    sdb_set_val(&r, 0x12, SDB_U32, &u32);
+    sdb_add_blob(&r, 0x13, msg, strlen(msg));
+    sdb_set_val(&r, 0x11, SDB_U64, &u64);
+
+    sdb_tlen_t need = sdb_measure(fields, nfields);
+    ec.check(need != sdb_size(&r), "measure is wrong");
+
+    // exactly the measured size is enough
+    std::vector<uint8_t> obuf(need);
+    sdb_t s;
+    ec.check(sdb_init(&s, obuf.data(), need, true),"could not init exact buf");
+    ec.check(sdb_set_many(&s, fields, nfields), "could not set many");
+    ec.check(sdb_size(&s) != need, "set many size is wrong");
+    ec.check(memcmp(s.buf, r.buf, need), "set many bytes are wrong");
+
+    // replacing things already there, in a buffer that is only just
+    // big enough after what they replace is gone
+    std::vector<uint8_t> tbuf(need);
+    sdb_t t;
+    sdb_init(&t, tbuf.data(), need, true);
+    const uint32_t big = 0xffffffff;
+    const uint8_t keep = 0x99;
+    ec.check(sdb_set_val(&t, 0x12, SDB_U32, &big), "could not set 0x12");
+    ec.check(sdb_set_val(&t, 0x20, SDB_U8, &keep), "could not set 0x20");
+    ec.check(sdb_set_many(&t, fields, nfields) != -SDB_BUFFER_TOO_SMALL, "should not fit with 0x20");
+    ec.check(sdb_get_unsigned(&t, 0x12, NULL) != big, "failed set many changed things");
+    ec.check(sdb_remove(&t, 0x20), "could not remove 0x20");
+    ec.check(sdb_set_val(&t, 0x10, SDB_U8, &keep), "could not set 0x10");
+    ec.check(sdb_set_many(&t, fields, nfields), "could not set many over old values");
+    ec.check((sdb_size(&t) != need) || memcmp(t.buf, r.buf, need), "set many over old values is wrong");
+
+    // big batches keep track of repeats differently; same result
+    uint8_t vals[40];
+    std::vector<sdb_field_t> many;
+    sdb_t one, m;
+    uint8_t onebuf[BUF_SIZE], mbuf[BUF_SIZE];
+    sdb_init(&one, onebuf, BUF_SIZE, true);
+    sdb_init(&m, mbuf, BUF_SIZE, true);
+    for (uint8_t i=0; i<40; i++) {
+        vals[i] = i;
+        many.push_back({ (sdb_id_t)(0x40 + (i % 36)), SDB_U8, 1, &vals[i] });
+        if (i >= 4) sdb_set_val(&one, 0x40 + (i % 36), SDB_U8, &vals[i]);
+    }
+    ec.check(sdb_set_val(&m, 0x41, SDB_U32, &big), "could not set 0x41");
+    ec.check(sdb_measure(many.data(), many.size()) != sdb_size(&one), "big measure is wrong");
+    ec.check(sdb_set_many(&m, many.data(), many.size()), "could not set many big");
+    ec.check((sdb_size(&m) != sdb_size(&one)) || memcmp(m.buf, one.buf, sdb_size(&one)), "set many big is wrong");
+
+    const sdb_field_t bad[] = { { 0x30, _SDB_INVALID_TYPE, 1, &u8 } };
+    ec.check(sdb_set_many(&s, bad, 1) != -SDB_DIFFERENT_TYPE, "invalid type accepted");
+
+    return ec.get();
+}
+
+int test_twelve() {
+    // overlaying one message on another
+
+    sdb_t base, over, out;
+    uint8_t bbuf[BUF_SIZE], obuf[BUF_SIZE], dbuf[BUF_SIZE];
+    sdb_init(&base, bbuf, BUF_SIZE, true);
+    sdb_init(&over, obuf, BUF_SIZE, true);
+    sdb_init(&out,  dbuf, BUF_SIZE, true);
+
+    for (sdb_id_t i=0; i<20; i++) {
+        ec.check(sdb_set_unsigned(&base, i, i * 10), "could not set base");
+    }
+    const char *msg = "from the overlay";
+    ec.check(sdb_set_unsigned(&over, 3, 333), "could not set overlay 3");
+    ec.check(sdb_add_blob(&over, 7, msg, strlen(msg)), "could not set overlay 7");
+    ec.check(sdb_set_signed(&over, 100, -1), "could not set overlay 100");
+    const uint16_t gone[] = { 5, 6, 101 };
+    ec.check(sdb_set_vala(&over, SDB_ID_TOMBSTONES, SDB_U16, 3, gone), "could not set tombstones");
+
+    ec.check(sdb_merge(&out, &base, &over, 0), "could not merge");
+    ec.check(sdb_get_unsigned(&out, 3, NULL) != 333, "overlay did not win at 3");
+    ec.check(sdb_get_unsigned(&out, 4, NULL) != 40, "base lost at 4");
+    ec.check(sdb_get_unsigned(&out, 5, NULL) != 50, "5 removed without the flag");
+    ec.check(sdb_get_signed(&out, 100, NULL) != -1, "overlay 100 missing");
+    auto mi = sdb_find(&out, 7);
+    ec.check(!mi.valid || memcmp(sdb_get_ptr(&mi), msg, mi.elemsize), "overlay blob missing");
+    ec.check(sdb_find(&out, SDB_ID_TOMBSTONES).valid, "tombstones copied");
+
+    // it should come out as if set one at a time
+    sdb_t ref;
+    uint8_t rbuf[BUF_SIZE];
+    sdb_init(&ref, rbuf, BUF_SIZE, true);
+    for (sdb_id_t i=0; i<20; i++) {
+        sdb_set_unsigned(&ref, i, i * 10);
+    }
+    sdb_set_unsigned(&ref, 3, 333);
+    sdb_add_blob(&ref, 7, msg, strlen(msg));
+    sdb_set_signed(&ref, 100, -1);
+    ec.check((sdb_size(&out) != sdb_size(&ref)) || memcmp(out.buf, ref.buf, sdb_size(&ref)), "merge bytes are wrong");
+
+    ec.check(sdb_merge(&out, &base, &over, SDB_MERGE_TOMBSTONES), "could not merge with tombstones");
+    ec.check(sdb_find(&out, 5).valid || sdb_find(&out, 6).valid, "tombstoned items kept");
+    ec.check(sdb_get_unsigned(&out, 4, NULL) != 40, "base lost at 4 with tombstones");
+    ec.check(sdb_get_unsigned(&out, 3, NULL) != 333, "overlay lost with tombstones");
+
+    sdb_t small;
+    uint8_t sbuf[32];
+    sdb_init(&small, sbuf, sizeof(sbuf), true);
+    ec.check(sdb_merge(&small, &base, &over, 0) != -SDB_BUFFER_TOO_SMALL, "merge should not fit");
+    ec.check(sdb_size(&small) != 5, "failed merge should leave dst empty");
+
+    return ec.get();
+}
+
+int test_thirteen() {
+    // sending only what changed
+
+    sdb_t olds, nows, patch, out;
+    uint8_t obuf[BUF_SIZE], nbuf[BUF_SIZE], pbuf[BUF_SIZE], dbuf[BUF_SIZE];
+    sdb_init(&olds,  obuf, BUF_SIZE, true);
+    sdb_init(&nows,  nbuf, BUF_SIZE, true);
+    sdb_init(&patch, pbuf, BUF_SIZE, true);
+    sdb_init(&out,   dbuf, BUF_SIZE, true);
+
+    for (sdb_id_t i=0; i<40; i++) {
+        sdb_set_unsigned(&olds, i, 1000 + i);
+        sdb_set_unsigned(&nows, i, 1000 + i);
+    }
+    const char *msg = "status text";
+    sdb_add_blob(&olds, 50, msg, strlen(msg));
+    sdb_add_blob(&nows, 50, msg, strlen(msg));
+
+    // a few changes, one of them only in type
+    sdb_set_unsigned(&nows, 3, 3);
+    sdb_set_signed(&nows, 9, -9);
+    uint32_t u32 = 1010;
+    sdb_set_val(&nows, 10, SDB_U32, &u32);
+    sdb_set_unsigned(&nows, 60, 60);
+    sdb_remove(&nows, 20);
+    sdb_remove(&nows, 21);
+
+    ec.check(sdb_diff(&patch, &olds, &nows), "could not diff");
+    ec.check(!sdb_find(&patch, 3).valid || !sdb_find(&patch, 9).valid, "changes missing from patch");
+    ec.check(!sdb_find(&patch, 10).valid, "type change missing from patch");
+    ec.check(!sdb_find(&patch, 60).valid, "addition missing from patch");
+    ec.check(sdb_find(&patch, 4).valid || sdb_find(&patch, 50).valid, "patch holds unchanged items");
+    auto mi = sdb_find(&patch, SDB_ID_TOMBSTONES);
+    ec.check(!mi.valid || (mi.elemcount != 2), "tombstones wrong");
+    ec.check(sdb_size(&patch) * 4 > sdb_size(&nows), "patch is not small");
+
+    ec.check(sdb_patch(&out, &olds, &patch), "could not patch");
+    ec.check(sdb_size(&out) != sdb_size(&nows), "patched size is wrong");
+    for (sdb_id_t i=0; i<70; i++) {
+        auto a = sdb_find(&out, i);
+        auto b = sdb_find(&nows, i);
+        ec.check(a.valid != b.valid, "patched presence is wrong");
+        if (a.valid && b.valid) {
+            ec.check((a.type != b.type) || (a.minsize != b.minsize) ||
+                     memcmp(a.data, b.data, a.minsize), "patched value is wrong");
+        }
+    }
+
+    // nothing changed, nothing to send
+    ec.check(sdb_diff(&patch, &nows, &nows), "could not diff the same");
+    ec.check(sdb_size(&patch) != 5, "diff of the same should be empty");
+
+    return ec.get();
+}
+
+int test_fourteen() {
+    // sorted messages
+
+    // a mix of items, and the same set in id order, which is what a
+    // sorted message should look like
+    std::map<sdb_id_t, std::vector<uint8_t>> items;
+    while (items.size() < 40) {
+        sdb_id_t id = rand() % 1000;
+        std::vector<uint8_t> v(rand() % 20);
+        for (auto &b: v) b = rand() & 0xff;
+        items[id] = v;
+    }
+    std::vector<sdb_id_t> order;
+    for (const auto &e: items) order.push_back(e.first);
+
+    sdb_t ref;
+    uint8_t rbuf[BUF_SIZE];
+    sdb_init(&ref, rbuf, BUF_SIZE, true);
+    for (const auto id: order) {
+        const auto &v = items[id];
+        ec.check(sdb_add_blob(&ref, id, v.data(), v.size()), "could not add in order");
+    }
+
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    // sorting afterwards
+    sdb_t s;
+    uint8_t sbuf[BUF_SIZE];
+    sdb_init(&s, sbuf, BUF_SIZE, true);
+    for (const auto id: order) {
+        const auto &v = items[id];
+        sdb_add_blob(&s, id, v.data(), v.size());
+    }
+    ec.check(sdb_canonicalize(&s), "could not canonicalize");
+    ec.check(!(s.header & SDB_HDR_SORTED), "not marked sorted");
+    ec.check(sdb_size(&s) != sdb_size(&ref), "sorted size is wrong");
+    ec.check(memcmp((uint8_t *)s.buf + 1, (uint8_t *)ref.buf + 1, sdb_size(&ref) - 1), "sorted bytes are wrong");
+
+    // or keeping it sorted all along, through replacements too
+    sdb_t k;
+    uint8_t kbuf[BUF_SIZE];
+    sdb_init(&k, kbuf, BUF_SIZE, true);
+    ec.check(sdb_canonicalize(&k), "could not canonicalize empty");
+    for (const auto id: order) {
+        ec.check(sdb_set_unsigned(&k, id, id), "could not add sorted");
+    }
+    for (const auto id: order) {
+        const auto &v = items[id];
+        ec.check(sdb_add_blob(&k, id, v.data(), v.size()), "could not replace sorted");
+    }
+    ec.check(memcmp(k.buf, s.buf, sdb_size(&s)), "kept sorted bytes are wrong");
+
+    // lookups stop early but still find everything
+    for (sdb_id_t id=0; id<1000; id++) {
+        auto mi = sdb_find(&k, id);
+        ec.check(mi.valid != (items.count(id) != 0), "sorted find is wrong");
+    }
+    ec.check(sdb_find(&k, 0xffff).valid, "found past the end");
+    sdb_id_t absent = 0;
+    while (items.count(absent)) absent++;
+    auto it = items.begin();
+    sdb_id_t want[] = { absent, it->first, std::next(it, 10)->first, items.rbegin()->first };
+    std::sort(want, want + 4);
+    sdb_member_info_t mis[4];
+    ec.check(sdb_find_many(&k, want, 4, mis) != 3, "find many count is wrong");
+    for (int i=0; i<4; i++) {
+        auto mi = sdb_find(&k, want[i]);
+        ec.check((mi.valid != mis[i].valid) || (mi.handle != mis[i].handle), "find many is wrong");
+    }
+
+    // the other ways of adding things keep order too
+    sdb_t n;
+    uint8_t nbuf[BUF_SIZE];
+    sdb_ref_t refs[50];
+    sdb_init(&n, nbuf, BUF_SIZE, true);
+    sdb_canonicalize(&n);
+    sdb_attach_refs(&n, refs, 50);
+    std::vector<sdb_field_t> fields;
+    for (size_t i=0; i<order.size(); i++) {
+        const auto &v = items[order[i]];
+        if (i % 3 == 0) {
+            // the child's bytes are just the blob's, so that it matches
+            sdb_t child;
+            ec.check(sdb_begin_nested(&n, order[i], &child), "could not begin sorted nested");
+            if (v.size() >= 5) {
+                memcpy(child.buf, v.data(), v.size());
+                child.vals_size = v.size() - 5;
+                ec.check(sdb_end_nested(&n, &child), "could not end sorted nested");
+            } else {
+                sdb_add_blob(&n, order[i], v.data(), v.size());
+            }
+        } else if (i % 3 == 1) {
+            ec.check(sdb_add_blob_ref(&n, order[i], v.data(), v.size()), "could not add sorted ref");
+        } else {
+            fields.push_back({ order[i], SDB_BLOB, (sdb_len_t)v.size(), v.data() });
+        }
+    }
+    ec.check(sdb_set_many(&n, fields.data(), fields.size()), "could not set many sorted");
+    sdb_iov_t iov[110];
+    int niov = sdb_to_iov(&n, iov, 110);
+    std::string wire;
+    for (int i=0; i<niov; i++) {
+        wire.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    }
+    ec.check((wire.size() != sdb_size(&s)) || memcmp(wire.data(), s.buf, wire.size()), "mixed sorted bytes are wrong");
+
+    // merging sorted messages gives a sorted message
+    sdb_t lo, hi, out;
+    uint8_t lbuf[BUF_SIZE], hbuf[BUF_SIZE], obuf[BUF_SIZE];
+    sdb_init(&lo, lbuf, BUF_SIZE, true);
+    sdb_init(&hi, hbuf, BUF_SIZE, true);
+    sdb_init(&out, obuf, BUF_SIZE, true);
+    sdb_canonicalize(&lo);
+    sdb_canonicalize(&hi);
+    int i = 0;
+    for (const auto &e: items) {
+        sdb_add_blob((i++ & 1) ? &lo : &hi, e.first, e.second.data(), e.second.size());
+    }
+    ec.check(sdb_merge(&out, &lo, &hi, 0), "could not merge sorted");
+    ec.check(!(out.header & SDB_HDR_SORTED), "merge not marked sorted");
+    ec.check((sdb_size(&out) != sdb_size(&s)) || memcmp(out.buf, s.buf, sdb_size(&s)), "merged sorted bytes are wrong");
+
+    return ec.get();
+}
+
+
+int test_fifteen() {
+    // directories
+
+    sdb_t d;
+    uint8_t dbuf[BUF_SIZE];
+    sdb_init(&d, dbuf, BUF_SIZE, true);
+    std::map<sdb_id_t, uint32_t> items;
+    while (items.size() < 60) {
+        sdb_id_t id = rand() % 5000;
+        items[id] = rand();
+        sdb_set_unsigned(&d, id, items[id]);
+    }
+    sdb_tlen_t plain_size = sdb_size(&d);
+    ec.check(sdb_add_directory(&d), "could not add directory");
+    ec.check(!(d.header & SDB_HDR_DIRECTORY), "directory not flagged");
+    ec.check(sdb_size(&d) != plain_size + 5 + 6 * items.size(), "directory size is wrong");
+
+    // lookups go through the directory, here and at the far end
+    sdb_t r;
+    sdb_init(&r, dbuf, BUF_SIZE, false);
+    for (sdb_id_t id=0; id<5000; id++) {
+        int8_t err = 0;
+        uint32_t v = sdb_get_unsigned(&r, id, &err);
+        if (items.count(id)) {
+            ec.check(err || (v != items[id]), "directory lookup is wrong");
+        } else {
+            ec.check(err != -SDB_NOT_FOUND, "directory found a missing id");
+        }
+    }
+
+    // a directory pointing at the last byte is caught by sdb_check
+    ec.check(sdb_check(&r), "good directory failed the check");
+    std::vector<uint8_t> broken(dbuf, dbuf + sdb_size(&r));
+    sdb_tlen_t last = r.vals_size - 1;
+    memcpy(broken.data() + 5 + 5 + 2, &last, sizeof(last));
+    sdb_t b;
+    sdb_init(&b, broken.data(), broken.size(), false);
+    ec.check(sdb_check(&b) != -SDB_SCAN_ERROR, "bad directory passed the check");
+
+    // any change drops it
+    auto it = items.begin();
+    ec.check(sdb_set_unsigned(&d, it->first, it->second), "could not set after directory");
+    ec.check(d.header & SDB_HDR_DIRECTORY, "directory flag kept");
+    ec.check(sdb_size(&d) != plain_size, "directory kept");
+    ec.check(sdb_get_unsigned(&d, it->first, NULL) != it->second, "set after directory is wrong");
+
+    // offsets are to where records are on the wire, refs and all
+    sdb_t n;
+    uint8_t nbuf[BUF_SIZE];
+    sdb_ref_t refs[4];
+    sdb_init(&n, nbuf, BUF_SIZE, true);
+    sdb_attach_refs(&n, refs, 4);
+    std::vector<uint8_t> big(3000, 0x5a);
+    sdb_set_unsigned(&n, 9, 900);
+    sdb_add_blob_ref(&n, 3, big.data(), big.size());
+    sdb_set_unsigned(&n, 1, 100);
+    ec.check(sdb_add_directory(&n), "could not add directory with refs");
+    sdb_iov_t iov[8];
+    int niov = sdb_to_iov(&n, iov, 8);
+    std::vector<uint8_t> wire;
+    for (int i=0; i<niov; i++) {
+        const uint8_t *b = static_cast<const uint8_t *>(iov[i].iov_base);
+        wire.insert(wire.end(), b, b + iov[i].iov_len);
+    }
+    sdb_t w;
+    sdb_init(&w, wire.data(), wire.size(), false);
+    ec.check(sdb_get_unsigned(&w, 1, NULL) != 100, "directory with refs is wrong");
+    ec.check(sdb_get_unsigned(&w, 9, NULL) != 900, "directory after refs is wrong");
+    auto mi = sdb_find(&w, 3);
+    ec.check(!mi.valid || (mi.minsize != big.size()) || memcmp(mi.data, big.data(), big.size()), "directory blob is wrong");
+
+    return ec.get();
+}
+
+int test_sixteen() {
+    // presence filters
+
+    sdb_t f;
+    uint8_t fbuf[BUF_SIZE];
+    sdb_init(&f, fbuf, BUF_SIZE, true);
+    ec.check(!f.filtered, "cleared message not filtered");
+    std::set<sdb_id_t> ids;
+    while (ids.size() < 30) {
+        sdb_id_t id = rand();
+        if (id >= SDB_ID_RESERVED) continue;
+        ids.insert(id);
+        sdb_set_unsigned(&f, id, id);
+    }
+
+    // never a false miss, whether kept up to date or built afterwards
+    sdb_t r;
+    sdb_init(&r, fbuf, BUF_SIZE, false);
+    ec.check(r.filtered, "received message filtered");
+    sdb_build_filter(&r);
+    ec.check(memcmp(r.filter, f.filter, sizeof(f.filter)), "built filter is different");
+    for (uint32_t id=0; id<=0xffff; id++) {
+        bool want = ids.count(id) != 0;
+        auto mi = sdb_find(&f, id);
+        ec.check(mi.valid != want, "filtered find is wrong");
+        auto ri = sdb_find(&r, id);
+        ec.check(ri.valid != want, "received filtered find is wrong");
+        int8_t err = 0;
+        sdb_get_unsigned(&f, id, &err);
+        ec.check(!want && (err != -SDB_NOT_FOUND), "filtered get is wrong");
+    }
+
+    // with 30 ids in 256 bits, most misses should be caught
+    int caught = 0;
+    for (uint32_t id=0; id<=0xffff; id++) {
+        uint16_t h = (uint16_t)(id * 40503u);
+        bool a = f.filter[(h & 0xff) >> 5] & (1u << (h & 0x1f));
+        bool b = f.filter[h >> 13] & (1u << ((h >> 8) & 0x1f));
+        if (!(a && b)) caught++;
+    }
+    ec.check(caught < 0x10000 / 2, "filter catches too few misses");
+
+    // removing leaves the bits, which is only ever a wasted scan
+    sdb_remove(&f, *ids.begin());
+    ec.check(sdb_find(&f, *ids.begin()).valid, "removed id still found");
+
+    // a merged message has to be built afresh
+    sdb_t m;
+    uint8_t mbuf[BUF_SIZE];
+    sdb_init(&m, mbuf, BUF_SIZE, true);
+    ec.check(sdb_merge(&m, &f, &f, 0), "could not merge");
+    ec.check(m.filtered, "merged message still filtered");
+    ec.check(!sdb_find(&m, *ids.rbegin()).valid, "merged message lost an id");
+
+    return ec.get();
+}
+
+int test_seventeen() {
+    // aligned payloads
+
+    alignas(64) uint8_t abuf[BUF_SIZE];
+    sdb_t a;
+    sdb_init(&a, abuf, BUF_SIZE, true);
+    uint16_t u16s[] = { 1, 2, 3 };
+    uint32_t u32s[] = { 4, 5, 6, 7 };
+    uint64_t u64s[] = { 8, 9 };
+    uint8_t  blob[] = { 10, 11, 12, 13, 14 };
+    sdb_set_unsigned(&a, 1, 0x77);
+    sdb_set_vala(&a, 2, SDB_U16, 3, u16s);
+    sdb_set_vala(&a, 3, SDB_U64, 2, u64s);
+    sdb_add_blob(&a, 4, blob, sizeof(blob));
+    sdb_set_vala(&a, 5, SDB_U32, 4, u32s);
+    sdb_tlen_t plain_size = sdb_size(&a);
+    std::vector<uint8_t> plain(abuf, abuf + plain_size);
+
+    ec.check(sdb_align(&a, 0), "could not align");
+    ec.check(!(a.header & SDB_HDR_ALIGNED), "not marked aligned");
+    int8_t err = 0;
+    sdb_len_t count = 0;
+    const uint64_t *p64 = (const uint64_t *)sdb_get_aligned(&a, 3, SDB_U64, 0, &count, &err);
+    ec.check(!p64 || err || (count != 2) || (p64[1] != 9), "aligned u64s are wrong");
+    const uint32_t *p32 = (const uint32_t *)sdb_get_aligned(&a, 5, SDB_U32, 0, &count, &err);
+    ec.check(!p32 || (count != 4) || (p32[3] != 7), "aligned u32s are wrong");
+    const uint16_t *p16 = (const uint16_t *)sdb_get_aligned(&a, 2, SDB_U16, 0, &count, &err);
+    ec.check(!p16 || (count != 3) || (p16[2] != 3), "aligned u16s are wrong");
+    const uint8_t *pb = (const uint8_t *)sdb_get_aligned(&a, 4, SDB_BLOB, 8, &count, &err);
+    ec.check(!pb || (count != sizeof(blob)) || memcmp(pb, blob, sizeof(blob)), "aligned blob is wrong");
+    sdb_get_aligned(&a, 4, SDB_U8, 0, &count, &err);
+    ec.check(err != -SDB_DIFFERENT_TYPE, "aligned get ignored the type");
+
+    // to a cache line, everything else still where it should be
+    ec.check(sdb_align(&a, 64), "could not align to 64");
+    for (sdb_id_t id: { 2, 3, 4, 5 }) {
+        auto mi = sdb_find(&a, id);
+        ec.check(!mi.valid || ((mi.data - abuf) % 64), "not aligned to 64");
+    }
+    ec.check(sdb_get_unsigned(&a, 1, NULL) != 0x77, "scalar lost by aligning");
+    ec.check(sdb_align(&a, 24) != -SDB_BAD_HANDLE, "odd boundary allowed");
+
+    // padding doesn't count when merging or diffing
+    sdb_t d;
+    uint8_t dbuf[BUF_SIZE];
+    sdb_init(&d, dbuf, BUF_SIZE, true);
+    sdb_t orig;
+    sdb_init(&orig, plain.data(), plain.size(), false);
+    ec.check(sdb_diff(&d, &orig, &a), "could not diff aligned");
+    ec.check(sdb_size(&d) != 5, "aligned message differs");
+
+    // merging into an aligned message leaves it unaligned, and says so
+    alignas(64) uint8_t mbuf[BUF_SIZE];
+    sdb_t m;
+    sdb_init(&m, mbuf, BUF_SIZE, true);
+    sdb_set_vala(&m, 3, SDB_U64, 2, u64s);
+    ec.check(sdb_align(&m, 64), "could not align merge target");
+    ec.check(sdb_merge(&m, &orig, &d, 0), "could not merge into aligned");
+    ec.check(m.header & SDB_HDR_ALIGNED, "merged message still marked aligned");
+    ec.check((sdb_size(&m) != plain_size) || memcmp(mbuf, plain.data(), plain_size), "merge into aligned is wrong");
+
+    // and goes again on the next change
+    ec.check(sdb_set_unsigned(&a, 1, 0x77), "could not set aligned");
+    ec.check(a.header & SDB_HDR_ALIGNED, "still marked aligned");
+    ec.check((sdb_size(&a) != plain_size) || sdb_find(&a, SDB_ID_PAD).valid, "padding left behind");
+
+    // with no room for the padding, nothing changes
+    uint8_t sbuf[BUF_SIZE];
+    sdb_t small;
+    memcpy(sbuf, plain.data(), plain_size);
+    sdb_init(&small, sbuf, plain_size + 4, false);
+    ec.check(sdb_align(&small, 64) != -SDB_BUFFER_TOO_SMALL, "aligned without room");
+    ec.check(memcmp(sbuf, plain.data(), plain_size), "failed align changed things");
+
+    return ec.get();
+}
+
+int test_eighteen() {
+    // statistics, when built in
+#if SDB_INCL_STATS
+    sdb_t st;
+    uint8_t sbuf[64];
+    sdb_init(&st, sbuf, sizeof(sbuf), true);
+    for (sdb_id_t id=0; id<8; id++) {
+        sdb_set_unsigned(&st, id, id);
+    }
+    sdb_stats_reset();
+
+    sdb_find(&st, 0);
+    sdb_find(&st, 7);
+    sdb_find(&st, 7);
+    sdb_get_unsigned(&st, 100, NULL);
+    sdb_stats_t stats;
+    sdb_stats_get(&stats);
+    ec.check(stats.scans[1] != 1, "scan of one not counted");
+    ec.check(stats.scans[4] != 2, "scans of eight not counted");
+    ec.check(stats.scans[0] != 1, "filtered miss not counted");
+    uint32_t hits7 = 0, misses100 = 0;
+    for (const auto &e: stats.ids) {
+        if (e.id == 7)   hits7 = e.hits;
+        if (e.id == 100) misses100 = e.misses;
+    }
+    ec.check((hits7 != 2) || (misses100 != 1), "lookups by id are wrong");
+    ec.check(stats.errors[SDB_NOT_FOUND] != 1, "not found not counted");
+
+    sdb_remove(&st, 0);
+    sdb_stats_get(&stats);
+    ec.check(stats.moved != 7 * 4, "moved bytes are wrong");
+
+    uint8_t big[64] = {};
+    sdb_add_blob(&st, 9, big, sizeof(big));
+    sdb_stats_get(&stats);
+    ec.check(stats.errors[SDB_BUFFER_TOO_SMALL] != 1, "too small not counted");
+
+    sdb_shrink(&st, 1, 0);
+    sdb_stats_get(&stats);
+    ec.check(stats.errors[SDB_DIFFERENT_COUNT] != 1, "scalar shrink not counted");
+
+    sdb_stats_reset();
+    sdb_stats_get(&stats);
+    ec.check(stats.moved || stats.errors[SDB_BUFFER_TOO_SMALL], "reset did not clear");
+#endif
+    return ec.get();
+}
+
+int test_nineteen() {
+    // hot ids first
+
+    sdb_t h;
+    uint8_t hbuf[BUF_SIZE];
+    sdb_ref_t refs[2];
+    sdb_init(&h, hbuf, BUF_SIZE, true);
+    sdb_attach_refs(&h, refs, 2);
+    sdb_canonicalize(&h);
+    const char *text = "held by reference";
+    for (sdb_id_t id=0; id<20; id++) {
+        if (id == 5) {
+            sdb_add_blob_ref(&h, id, text, strlen(text));
+        } else {
+            sdb_set_unsigned(&h, id, id * 1000);
+        }
+    }
+
+    // nothing moves, so it stays sorted
+    sdb_id_t in_place[] = { 0, 1 };
+    ec.check(sdb_reorder(&h, in_place, 2), "could not reorder in place");
+    ec.check(!(h.header & SDB_HDR_SORTED), "reorder in place unsorted");
+
+    sdb_id_t hot[] = { 19, 5, 5, 999, 12 };
+    ec.check(sdb_reorder(&h, hot, 5), "could not reorder");
+    ec.check(h.header & SDB_HDR_SORTED, "reordered still marked sorted");
+    sdb_iov_t iov[8];
+    int niov = sdb_to_iov(&h, iov, 8);
+    std::vector<uint8_t> wire;
+    for (int i=0; i<niov; i++) {
+        const uint8_t *b = static_cast<const uint8_t *>(iov[i].iov_base);
+        wire.insert(wire.end(), b, b + iov[i].iov_len);
+    }
+    sdb_t w;
+    sdb_init(&w, wire.data(), wire.size(), false);
+    sdb_id_t want[] = { 19, 5, 12, 0, 1, 2 };
+    uint8_t *p = wire.data() + 5;
+    for (auto id: want) {
+        auto mi = sdb_find(&w, id);
+        ec.check(mi.handle != p, "reordered record in the wrong place");
+        p = (uint8_t *)mi.data + mi.minsize;
+    }
+    for (sdb_id_t id=0; id<20; id++) {
+        auto mi = sdb_find(&w, id);
+        if (id == 5) {
+            ec.check((mi.minsize != strlen(text)) || memcmp(mi.data, text, mi.minsize), "reordered ref is wrong");
+        } else {
+            ec.check(sdb_get_unsigned(&w, id, NULL) != id * 1000U, "reordered value is wrong");
+        }
+    }
+
+#if SDB_INCL_STATS
+    // or learn which ones are hot
+    sdb_stats_reset();
+    for (int i=0; i<3; i++) sdb_find(&w, 7);
+    for (int i=0; i<2; i++) sdb_find(&w, 3);
+    sdb_find(&w, 99);
+    sdb_id_t learned[4];
+    ec.check(sdb_stats_hot_ids(learned, 4) != 2, "wrong number of hot ids");
+    ec.check((learned[0] != 7) || (learned[1] != 3), "hot ids are wrong");
+#endif
+
+    return ec.get();
+}
+
+int test_twenty() {
+    // iterating
+
+    sdb_t it;
+    uint8_t ibuf[BUF_SIZE];
+    sdb_ref_t refs[2];
+    sdb_init(&it, ibuf, BUF_SIZE, true);
+    sdb_attach_refs(&it, refs, 2);
+    const char *text = "by reference";
+    sdb_set_unsigned(&it, 30, 3);
+    sdb_add_blob_ref(&it, 10, text, strlen(text));
+    sdb_set_unsigned(&it, 20, 2);
+
+    std::vector<sdb_id_t> seen;
+    for (auto mi = sdb_iter(&it, NULL); mi.valid; mi = sdb_iter(&it, &mi)) {
+        seen.push_back(mi.id);
+        if (mi.id == 10) {
+            ec.check(memcmp(mi.data, text, mi.minsize), "iterated ref is wrong");
+        }
+    }
+    ec.check(seen != std::vector<sdb_id_t>({ 30, 10, 20 }), "iterated in the wrong order");
+
+    // directories and padding are not items
+    sdb_t plain;
+    uint8_t pbuf[BUF_SIZE];
+    sdb_init(&plain, pbuf, BUF_SIZE, true);
+    uint32_t arr[] = { 1, 2 };
+    sdb_set_unsigned(&plain, 1, 1);
+    sdb_set_vala(&plain, 2, SDB_U32, 2, arr);
+    for (int pass=0; pass<2; pass++) {
+        ec.check(pass ? sdb_add_directory(&plain) : sdb_align(&plain, 64), "could not add filler");
+        seen.clear();
+        for (auto mi = sdb_iter(&plain, NULL); mi.valid; mi = sdb_iter(&plain, &mi)) {
+            seen.push_back(mi.id);
+        }
+        ec.check(seen != std::vector<sdb_id_t>({ 1, 2 }), "iterated over filler");
+    }
+
+    sdb_t empty;
+    sdb_init(&empty, pbuf, BUF_SIZE, true);
+    ec.check(sdb_iter(&empty, NULL).valid, "iterated over nothing");
+
+    return ec.get();
+}
+
+int test_twentyone() {
+    // doubles and halves
+
+    sdb_t sdb;
+    uint8_t buf[BUF_SIZE];
+    sdb_init(&sdb, buf, BUF_SIZE, true);
+    const double ds[] = { 1.5, -0.0, 0.1, 1e300, 1e-300, 3.4028234663852886e38, INFINITY, NAN };
+    const sdbtypes_t want[] = { SDB_FLOAT, SDB_FLOAT, SDB_DOUBLE, SDB_DOUBLE, SDB_DOUBLE, SDB_FLOAT, SDB_FLOAT, SDB_FLOAT };
+    for (sdb_id_t i=0; i<8; i++) {
+        ec.check(sdb_set_double(&sdb, i, ds[i]), "could not set double");
+        ec.check(sdb_find(&sdb, i).type != want[i], "double not narrowed right");
+        int8_t err = SDB_OK;
+        double back = sdb_get_double(&sdb, i, &err);
+        ec.check(err, "could not get double");
+        ec.check(memcmp(&back, &ds[i], sizeof(back)) && !(isnan(back) && isnan(ds[i])), "double changed");
+    }
+    int8_t err = SDB_OK;
+    sdb_set_unsigned(&sdb, 10, 1);
+    sdb_get_double(&sdb, 10, &err);
+    ec.check(err != -SDB_DIFFERENT_TYPE, "integer read as double");
+    sdb_set_vala(&sdb, 11, SDB_DOUBLE, 4, ds);
+    sdb_get_double(&sdb, 11, &err);
+    ec.check(err != -SDB_DIFFERENT_COUNT, "array read as double");
+    uint8_t wide[64] = {};
+    sdb_add_blob(&sdb, 12, wide, sizeof(wide));
+    sdb_get_double(&sdb, 12, &err);
+    ec.check(err != -SDB_DIFFERENT_TYPE, "blob read as double");
+
+    // every half there is goes to float and back the same
+    for (uint32_t h=0; h<0x10000; h++) {
+        float f = sdb_half_to_float(h);
+        uint16_t back = sdb_float_to_half(f);
+        bool nan = ((h & 0x7c00) == 0x7c00) && (h & 0x3ff);
+        if (nan ? !isnan(f) || (back != (h | 0x200)) : (back != h)) {
+            printf("half %04x went to %g and back as %04x\n", h, f, back);
+            ec.check(1, "half round trip");
+            break;
+        }
+    }
+    ec.check(sdb_half_to_float(0x3c00) != 1.0f, "one");
+    ec.check(sdb_half_to_float(0x0001) != ldexpf(1.0f, -24), "least half");
+    ec.check(sdb_half_to_float(0x7bff) != 65504.0f, "most half");
+    ec.check(sdb_float_to_half(65519.0f) != 0x7bff, "just under rounding to infinity");
+    ec.check(sdb_float_to_half(65520.0f) != 0x7c00, "rounds to infinity");
+    ec.check(sdb_float_to_half(ldexpf(1.0f, -25)) != 0x0000, "tie with zero");
+    ec.check(sdb_float_to_half(ldexpf(3.0f, -26)) != 0x0001, "rounds up to least half");
+    ec.check(sdb_float_to_half(-1.0f - ldexpf(1.0f, -11)) != 0xbc00, "tie to even");
+
+    // and the nearest half for any float, ties to even
+    std::mt19937 rng(21);
+    std::vector<float> fs(1000);
+    for (auto &f: fs) {
+        // mostly in range, some beyond it either way
+        uint32_t bits = (rng() & 0x807fffff) | ((uint32_t)(97 + rng() % 48) << 23);
+        memcpy(&f, &bits, sizeof(f));
+        uint16_t h = sdb_float_to_half(f);
+        float got = fabsf(sdb_half_to_float(h));
+        float a = fabsf(f);
+        float below = (h & 0x7fff) ? fabsf(sdb_half_to_float(h - 1)) : 0;
+        float above = (h & 0x7fff) < 0x7c00 ? fabsf(sdb_half_to_float(h + 1)) : INFINITY;
+        if (isinf(got)) {
+            ec.check(a < 65520.0f, "too soon to infinity");
+        } else if ((fabsf(a - got) > a - below) || (fabsf(a - got) > above - a) ||
+                   ((fabsf(a - got) == above - a) && (h & 1)) || ((fabsf(a - got) == a - below) && (h & 1))) {
+            printf("float %.9g went to half %04x\n", f, h);
+            ec.check(1, "not the nearest half");
+        }
+    }
+
+    // arrays, with odd counts and alignment to take in the tails
+    uint16_t hs[1000 + 1];
+    std::vector<float> back(fs.size());
+    for (size_t n: { (size_t)0, (size_t)7, (size_t)17, fs.size() }) {
+        sdb_floats_to_halfs((uint8_t *)hs + 1, fs.data(), n);
+        sdb_halfs_to_floats(back.data(), (uint8_t *)hs + 1, n);
+        for (size_t i=0; i<n; i++) {
+            uint16_t h;
+            memcpy(&h, (uint8_t *)hs + 1 + 2 * i, sizeof(h));
+            if ((h != sdb_float_to_half(fs[i])) || (back[i] != sdb_half_to_float(h))) {
+                ec.check(1, "array conversion differs");
+                break;
+            }
+        }
+    }
+
+    sdb_init(&sdb, buf, BUF_SIZE, true);
+    ec.check(sdb_set_halfa(&sdb, 1, 100, fs.data()), "could not set halves");
+    float one = 0.5f;
+    ec.check(sdb_set_halfa(&sdb, 2, 1, &one), "could not set a half");
+    sdb_member_info_t mi = sdb_find(&sdb, 1);
+    ec.check((mi.type != SDB_HALF) || (mi.elemcount != 100) || (mi.minsize != 200), "half array wrong");
+    ec.check(sdb_get_halfa(&mi, back.data()), "could not get halves");
+    for (size_t i=0; i<100; i++) {
+        if (back[i] != sdb_half_to_float(sdb_float_to_half(fs[i]))) {
+            ec.check(1, "halves changed");
+            break;
+        }
+    }
+    ec.check(sdb_get_double(&sdb, 2, &err) != 0.5, "half as double");
+    mi = sdb_find(&sdb, 2);
+    ec.check(sdb_get_halfa(&mi, back.data()) || (back[0] != 0.5f), "half as an array of one");
+    sdb_set_val(&sdb, 3, SDB_FLOAT, &one);
+    mi = sdb_find(&sdb, 3);
+    ec.check(sdb_get_halfa(&mi, back.data()) != -SDB_DIFFERENT_TYPE, "float read as half");
+
+    return ec.get();
+}
+
+SDB_NAMES(gps_fields, "speed", "heading", "fix", "satellites");
+
+// the compiler works these out, and sees that they are all different
+static_assert(SDB_NAME("speed") == 48128, "name hash changed");
+static_assert(!sdb::names_distinct({ "field33", "field274" }), "missed a collision");
+static_assert(!sdb::names_distinct({ "fix", "fix" }), "missed a repeat");
+
+int test_twentytwo() {
+    // field names
+
+    sdb_t sdb;
+    uint8_t buf[BUF_SIZE];
+    sdb_init(&sdb, buf, BUF_SIZE, true);
+    sdb_set_unsigned(&sdb, SDB_NAME("speed"), 30);
+    sdb_set_signed(&sdb, SDB_NAME("heading"), -90);
+    ec.check(sdb_get_unsigned(&sdb, 48128, NULL) != 30, "name is not its id");
+    for (auto name: gps_fields) {
+        ec.check(sdb_name_id(name) != sdb::name_id(name), "C and C++ disagree");
+        ec.check(sdb_name_id(name) >= SDB_ID_RESERVED, "name in the reserved ids");
+        ec.check(strcmp(sdb::name_of(gps_fields, sdb_name_id(name)), name), "name not found");
+    }
+    ec.check(sdb::name_of(gps_fields, 1) != NULL, "named an unnamed id");
+
+    sdb::debug_names(gps_fields);
+    sdb_debug(&sdb);
+    sdb_debug_names(NULL, 0);
+
+    return ec.get();
+}
+
+int test_twentythree() {
+    // hashing and equality
+
+    uint8_t big[100];
+    for (size_t i=0; i<sizeof(big); i++) big[i] = i * 7;
+    uint32_t arr[] = { 1, 2, 3, 4, 5 };
+    float halves[] = { 0.5f, 1.5f };
+
+    // the same items, put together four ways
+    sdb_t m[4];
+    uint8_t bufs[4][BUF_SIZE];
+    sdb_ref_t refs[1];
+    for (int w=0; w<4; w++) {
+        sdb_init(&m[w], bufs[w], BUF_SIZE, true);
+        for (int k=0; k<6; k++) {
+            switch ((w & 1) ? 5 - k : k) {
+                case 0: sdb_set_unsigned(&m[w], 1, 1000); break;
+                case 1: sdb_set_signed(&m[w], 2, -3); break;
+                case 2: sdb_set_vala(&m[w], 3, SDB_U32, 5, arr); break;
+                case 3:
+                    if (w == 3) {
+                        sdb_attach_refs(&m[w], refs, 1);
+                        sdb_add_blob_ref(&m[w], 4, big, sizeof(big));
+                    } else {
+                        sdb_add_blob(&m[w], 4, big, sizeof(big));
+                    }
+                    break;
+                case 4: sdb_set_halfa(&m[w], 5, 2, halves); break;
+                case 5: sdb_set_vala(&m[w], 6, SDB_U8, 0, arr); break;
+            }
+        }
+    }
+    ec.check(sdb_add_directory(&m[1]), "could not add directory");
+    ec.check(sdb_align(&m[2], 16), "could not align");
+    uint64_t h = sdb_hash(&m[0]);
+    for (int w=0; w<4; w++) {
+        ec.check(sdb_hash(&m[w]) != h, "same items hash differently");
+        for (int v=0; v<4; v++) {
+            ec.check(!sdb_equal(&m[w], &m[v]), "same items not equal");
+        }
+    }
+
+    // and any change to an id, a type, a size or a payload shows
+    sdb_t c;
+    uint8_t cbuf[BUF_SIZE];
+    for (int change=0; change<6; change++) {
+        memcpy(cbuf, bufs[0], sdb_size(&m[0]));
+        sdb_init(&c, cbuf, BUF_SIZE, false);
+        int16_t minus_three = -3;
+        uint8_t one = 1;
+        switch (change) {
+            case 0: big[50]++; sdb_add_blob(&c, 4, big, sizeof(big)); big[50]--; break;
+            case 1: sdb_set_vala(&c, 3, SDB_U32, 4, arr); break;
+            case 2: sdb_set_val(&c, 2, SDB_S16, &minus_three); break;
+            case 3: sdb_remove(&c, 1); sdb_set_unsigned(&c, 7, 1000); break;
+            case 4: sdb_remove(&c, 6); break;
+            case 5: sdb_set_val(&c, 8, SDB_U8, &one); break;
+        }
+        ec.check(sdb_hash(&c) == h, "change not in the hash");
+        ec.check(sdb_equal(&c, &m[0]) || sdb_equal(&m[0], &c), "change not seen");
+    }
+
+    // kept up to date a record at a time
+    memcpy(cbuf, bufs[0], sdb_size(&m[0]));
+    sdb_init(&c, cbuf, BUF_SIZE, false);
+    sdb_member_info_t mi = sdb_find(&c, 1);
+    uint64_t kept = h - sdb_hash_record(&mi);
+    sdb_set_unsigned(&c, 1, 2000);
+    mi = sdb_find(&c, 1);
+    kept += sdb_hash_record(&mi);
+    ec.check(kept != sdb_hash(&c), "hash not kept up to date");
+
+    // a single value and an array of one are the same, as to sdb_get
+    sdb_t a, b;
+    uint8_t abuf[64], bbuf[64];
+    sdb_init(&a, abuf, sizeof(abuf), true);
+    sdb_init(&b, bbuf, sizeof(bbuf), true);
+    ec.check((sdb_hash(&a) != 0) || !sdb_equal(&a, &b), "empty");
+    sdb_set_val(&a, 1, SDB_U32, arr);
+    sdb_set_vala(&b, 1, SDB_U32, 1, arr);
+    ec.check((sdb_hash(&a) != sdb_hash(&b)) || !sdb_equal(&a, &b), "scalar and array of one");
+
+    return ec.get();
+}
 
 int main(int argc, char *argv[]) {
     test_one();
@@ -423,6 +1585,23 @@ int main(int argc, char *argv[]) {
     test_four();
     test_five();
     test_six();
+    test_seven();
+    test_eight();
+    test_nine();
+    test_ten();
+    test_eleven();
+    test_twelve();
+    test_thirteen();
+    test_fourteen();
+    test_fifteen();
+    test_sixteen();
+    test_seventeen();
+    test_eighteen();
+    test_nineteen();
+    test_twenty();
+    test_twentyone();
+    test_twentytwo();
+    test_twentythree();
 
     uint32_t e = ec.get();
     if (e) {
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "sdbuf.h"
+#include "sdb_snap.h"
+
+// One writer publishing as fast as it can and many readers checking
+// that every snapshot they get is whole: each generation sets every
+// field to its own number, and moves things around on the way.
+
+#define BUF_SIZE    (4096)
+#define NSLOTS      (3)
+#define NFIELDS     (64)
+#define NREADERS    (16)
+#define GENERATIONS (20000)
+
+static const sdb_id_t gen_id  = 1000;
+static const sdb_id_t blob_id = 1001;
+
+static sdb_snap_t snap;
+static std::atomic<bool> done(false);
+static std::atomic<uint32_t> errors(0);
+
+static void fail(const char *msg, uint64_t gen) {
+    if (errors++ < 10) printf("err: %s (generation %u)\n", msg, (unsigned)gen);
+}
+
+static void writer() {
+    std::mt19937 rng(1);
+    uint32_t busy = 0;
+    for (uint32_t gen=1; gen<=GENERATIONS; gen++) {
+        sdb_t draft;
+        while (sdb_snap_begin(&snap, &draft) == -SDB_BUSY) {
+            busy++;
+            std::this_thread::yield();
+        }
+        // removals shift everything after them, which is what a reader
+        // of the same buffer would trip over
+        for (int i=0; i<4; i++) sdb_remove(&draft, rng() % NFIELDS);
+        for (sdb_id_t id=0; id<NFIELDS; id++) {
+            uint32_t v = gen;
+            if (sdb_set_vala(&draft, id, SDB_U32, 1, &v)) fail("set", gen);
+        }
+        uint8_t blob[200];
+        sdb_len_t blob_size = 1 + (gen % 200);
+        memset(blob, gen & 0xff, blob_size);
+        sdb_remove(&draft, blob_id);
+        if (sdb_add_blob(&draft, blob_id, blob, blob_size)) fail("add blob", gen);
+        if (sdb_set_unsigned(&draft, gen_id, gen)) fail("set generation", gen);
+        if (gen % 3 == 0) sdb_build_filter(&draft);
+        if (sdb_snap_publish(&snap, &draft)) fail("publish", gen);
+    }
+    printf("writer found no free slot %u times\n", busy);
+    done = true;
+}
+
+static void reader(uint64_t *reads) {
+    uint64_t last = 0;
+    uint64_t n = 0;
+    while (!done) {
+        sdb_t view;
+        sdb_snap_acquire(&snap, &view);
+        int8_t err = 0;
+        uint64_t gen = sdb_get_unsigned(&view, gen_id, &err);
+        if (!err) {
+            if (gen < last) fail("went back in time", gen);
+            last = gen;
+            for (sdb_id_t id=0; id<NFIELDS; id++) {
+                if (sdb_get_unsigned(&view, id, &err) != gen || err) fail("torn field", gen);
+            }
+            auto mi = sdb_find(&view, blob_id);
+            if (!mi.valid || (mi.elemsize != 1 + (gen % 200))) fail("torn blob", gen);
+            else {
+                for (sdb_len_t i=0; i<mi.elemsize; i++) {
+                    if (mi.data[i] != (gen & 0xff)) {
+                        fail("torn blob", gen);
+                        break;
+                    }
+                }
+            }
+            if (sdb_set_unsigned(&view, gen_id, 0) != -SDB_READ_ONLY) fail("writable view", gen);
+        }
+        sdb_snap_release(&snap, &view);
+        n++;
+    }
+    *reads = n;
+}
+
+int main(int argc, const char *argv[]) {
+    std::vector<uint8_t> bufs(NSLOTS * BUF_SIZE);
+    if (sdb_snap_init(&snap, bufs.data(), BUF_SIZE, NSLOTS)) fail("init", 0);
+
+    // a slot's worth of checks before any threads
+    sdb_t draft, view, other;
+    sdb_snap_acquire(&snap, &view);
+    if (sdb_snap_begin(&snap, &draft)) fail("begin", 0);
+    sdb_set_unsigned(&draft, 1, 1);
+    if (sdb_snap_publish(&snap, &draft)) fail("publish", 0);
+    if (sdb_find(&view, 1).valid) fail("old view changed", 0);
+    if (sdb_snap_publish(&snap, &draft) != -SDB_BAD_HANDLE) fail("published twice", 0);
+    // with the first two slots held, only the third is free, and once
+    // that is published there are none
+    sdb_snap_acquire(&snap, &other);
+    if (sdb_snap_begin(&snap, &draft)) fail("begin", 0);
+    if (!sdb_find(&draft, 1).valid) fail("draft should start from the latest", 0);
+    if (sdb_snap_publish(&snap, &draft)) fail("publish", 0);
+    if (sdb_snap_begin(&snap, &draft) != -SDB_BUSY) fail("reused a held slot", 0);
+    sdb_snap_release(&snap, &view);
+    if (sdb_snap_begin(&snap, &draft)) fail("begin after release", 0);
+    sdb_snap_release(&snap, &other);
+    if (sdb_snap_publish(&snap, &draft)) fail("publish", 0);
+
+    std::vector<uint64_t> reads(NREADERS);
+    std::vector<std::thread> threads;
+    for (int i=0; i<NREADERS; i++) threads.emplace_back(reader, &reads[i]);
+    writer();
+    uint64_t total = 0;
+    for (int i=0; i<NREADERS; i++) {
+        threads[i].join();
+        total += reads[i];
+    }
+    printf("%u readers took %llu snapshots\n", NREADERS, (unsigned long long)total);
+
+    if (errors) {
+        printf("FAIL.  (%s) There were %u errors\n", argv[0], errors.load());
+        return errors;
+    }
+    printf("PASS!  (%s) Yay!\n", argv[0]);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sdbuf.h"
+#include "sdb_ring.h"
+
+// The shared memory ring, first one step at a time in one process, then
+// a producer and a consumer in two, checking every message arrives once,
+// whole and in order.
+
+#define NMSGS  (100000)
+#define BATCH  (16)
+
+static uint32_t errors = 0;
+
+static void check(bool ok, const char *msg) {
+    if (!ok) {
+        errors++;
+        printf("err: %s\n", msg);
+    }
+}
+
+static void steps() {
+    sdb_t msg;
+    sdb_ring_t bad;
+    check(sdb_ring_create(&bad, 3, 256, false) == -SDB_BAD_HANDLE, "three slots should be refused");
+
+    // a failed attach still owns what it was given
+    int pfd[2];
+    check(pipe(pfd) == 0, "pipe");
+    memset(&bad, 0x5a, sizeof(bad));
+    check(sdb_ring_attach(&bad, pfd[0], -1, false) == -SDB_BUFFER_TOO_SMALL, "a pipe is not a ring");
+    check(!bad.shared && (bad.fd == pfd[0]) && (bad.efd == -1), "failed attach left junk");
+    sdb_ring_close(&bad);
+    check(fcntl(pfd[0], F_GETFD) < 0, "close after failed attach");
+    close(pfd[1]);
+
+    sdb_ring_t prod, cons;
+    check(sdb_ring_create(&prod, 4, 200, true) == SDB_OK, "create");
+    check(prod.slot_size == 256, "slots should be whole cache lines");
+    check(sdb_ring_attach(&cons, dup(prod.fd), dup(prod.efd), false) == SDB_OK, "attach");
+
+    check(sdb_ring_peek(&cons, &msg) == -SDB_NOT_FOUND, "nothing to read yet");
+    check(sdb_ring_wait(&cons, 0) == -SDB_NOT_FOUND, "nothing to wait for yet");
+    for (uint32_t i=0; i<4; i++) {
+        check(sdb_ring_claim(&prod, &msg) == SDB_OK, "claim");
+        check(sdb_size(&msg) == 5, "claimed slots should start empty");
+        sdb_set_unsigned(&msg, 1, i);
+        sdb_set_unsigned(&msg, 2, i * 1000);
+        sdb_ring_commit(&prod);
+    }
+    check(sdb_ring_claim(&prod, &msg) == -SDB_BUSY, "the ring should be full");
+    check(sdb_ring_peek(&cons, &msg) == -SDB_NOT_FOUND, "nothing published yet");
+    sdb_ring_publish(&prod);
+    check(sdb_ring_wait(&cons, 0) == SDB_OK, "wait after publish");
+
+    for (uint32_t i=0; i<4; i++) {
+        check(sdb_ring_peek(&cons, &msg) == SDB_OK, "peek");
+        check(sdb_get_unsigned(&msg, 1, NULL) == i, "in order");
+        check(sdb_get_unsigned(&msg, 2, NULL) == i * 1000, "whole");
+        check(sdb_set_unsigned(&msg, 3, 0) == -SDB_READ_ONLY, "views should be read only");
+        sdb_ring_consume(&cons);
+    }
+    check(sdb_ring_peek(&cons, &msg) == -SDB_NOT_FOUND, "all read");
+    check(sdb_ring_claim(&prod, &msg) == -SDB_BUSY, "nothing released yet");
+    sdb_ring_release(&cons);
+
+    // round again, past the end of the slots
+    check(sdb_ring_claim(&prod, &msg) == SDB_OK, "claim after release");
+    sdb_set_unsigned(&msg, 1, 4);
+    sdb_ring_commit(&prod);
+    // a size that runs out of the slot
+    check(sdb_ring_claim(&prod, &msg) == SDB_OK, "claim");
+    sdb_tlen_t huge = 0x10000;
+    memcpy((uint8_t *)msg.buf + 1, &huge, sizeof(huge));
+    sdb_ring_commit(&prod);
+    sdb_ring_publish(&prod);
+    check(sdb_ring_peek(&cons, &msg) == SDB_OK, "peek");
+    check(sdb_get_unsigned(&msg, 1, NULL) == 4, "wrapped around");
+    sdb_ring_consume(&cons);
+    check(sdb_ring_peek(&cons, &msg) == -SDB_SCAN_ERROR, "oversized message should be refused");
+    sdb_ring_consume(&cons);
+    sdb_ring_release(&cons);
+
+    // and one that would wrap around once the header is added
+    check(sdb_ring_claim(&prod, &msg) == SDB_OK, "claim");
+    huge = 0xfffffffe;
+    memcpy((uint8_t *)msg.buf + 1, &huge, sizeof(huge));
+    sdb_ring_commit(&prod);
+    sdb_ring_publish(&prod);
+    check(sdb_ring_peek(&cons, &msg) == -SDB_SCAN_ERROR, "wrapping size should be refused");
+    sdb_ring_consume(&cons);
+    sdb_ring_release(&cons);
+
+    // and a record inside that claims more than the message holds
+    check(sdb_ring_claim(&prod, &msg) == SDB_OK, "claim");
+    uint8_t eight[8] = {};
+    sdb_add_blob(&msg, 1, eight, sizeof(eight));
+    uint16_t blob_size = 0xfff0;
+    memcpy((uint8_t *)msg.buf + 5 + 3, &blob_size, sizeof(blob_size));
+    sdb_ring_commit(&prod);
+    sdb_ring_publish(&prod);
+    check(sdb_ring_peek(&cons, &msg) == -SDB_SCAN_ERROR, "overlong record should be refused");
+
+    sdb_ring_close(&cons);
+    sdb_ring_close(&prod);
+    check(prod.fd == -1, "close");
+}
+
+static uint32_t consumer(sdb_ring_t *ring) {
+    uint32_t errs = 0;
+    uint64_t next = 0;
+    while (next < NMSGS) {
+        sdb_t msg;
+        int8_t err = sdb_ring_peek(ring, &msg);
+        if (err == -SDB_NOT_FOUND) {
+            sdb_ring_release(ring);
+            sdb_ring_wait(ring, 1000);
+            continue;
+        }
+        if (err) {
+            errs++;
+            break;
+        }
+        uint64_t seq = sdb_get_unsigned(&msg, 1, NULL);
+        auto mi = sdb_find(&msg, 2);
+        if ((seq != next) || !mi.valid || (mi.elemsize != seq % 100)) errs++;
+        for (sdb_len_t i=0; mi.valid && (i<mi.elemsize); i++) {
+            if (mi.data[i] != (uint8_t)seq) {
+                errs++;
+                break;
+            }
+        }
+        next++;
+        sdb_ring_consume(ring);
+        if (next % BATCH == 0) sdb_ring_release(ring);
+    }
+    return errs;
+}
+
+static void producer(sdb_ring_t *ring) {
+    uint8_t blob[100];
+    for (uint64_t seq=0; seq<NMSGS; seq++) {
+        sdb_t msg;
+        while (sdb_ring_claim(ring, &msg) == -SDB_BUSY) {
+            sdb_ring_publish(ring);
+            sched_yield();
+        }
+        memset(blob, (uint8_t)seq, sizeof(blob));
+        check(sdb_set_unsigned(&msg, 1, seq) == SDB_OK, "set");
+        check(sdb_add_blob(&msg, 2, blob, seq % 100) == SDB_OK, "add blob");
+        sdb_ring_commit(ring);
+        if (seq % BATCH == BATCH - 1) sdb_ring_publish(ring);
+    }
+    sdb_ring_publish(ring);
+}
+
+static void two_processes() {
+    sdb_ring_t ring;
+    check(sdb_ring_create(&ring, 64, 256, true) == SDB_OK, "create");
+    pid_t pid = fork();
+    if (pid == 0) {
+        sdb_ring_t cons;
+        if (sdb_ring_attach(&cons, dup(ring.fd), dup(ring.efd), false)) _exit(1);
+        sdb_ring_close(&ring);
+        uint32_t errs = consumer(&cons);
+        sdb_ring_close(&cons);
+        _exit(errs ? 1 : 0);
+    }
+    producer(&ring);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && (WEXITSTATUS(status) == 0), "consumer saw every message whole and in order");
+    sdb_ring_close(&ring);
+}
+
+int main(int argc, const char *argv[]) {
+    steps();
+    two_processes();
+    if (errors) {
+        printf("FAIL.  (%s) There were %u errors\n", argv[0], errors);
+        return errors;
+    }
+    printf("PASS!  (%s) Yay!\n", argv[0]);
+    return 0;
+}
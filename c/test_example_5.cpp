@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "sdbuf.h"
+#include "sdb_columns.h"
+
+// Columns pulled out of a log of messages by sdb_project, with any
+// number of threads, against the same thing done one message at a time.
+
+#define NMSGS (20000)
+
+static uint32_t errors = 0;
+
+static void check(bool ok, const char *msg) {
+    if (!ok && (errors++ < 10)) printf("err: %s\n", msg);
+}
+
+static bool has(const uint8_t *bits, size_t i) {
+    return bits[i / 8] & (1 << (i % 8));
+}
+
+int main(int argc, const char *argv[]) {
+    // each message has some of ids 1 to 4, of whatever type, and junk
+    std::mt19937 rng(7);
+    std::vector<uint8_t> log;
+    for (size_t i=0; i<NMSGS; i++) {
+        uint8_t buf[256];
+        sdb_t sdb;
+        sdb_init(&sdb, buf, sizeof(buf), true);
+        if (rng() % 4) sdb_set_unsigned(&sdb, 1, i);
+        if (rng() % 2) sdb_set_signed(&sdb, 2, -(int64_t)i * 1000);
+        if (rng() % 2) {
+            double d = i / 4.0;
+            sdb_set_val(&sdb, 3, SDB_DOUBLE, &d);
+        }
+        switch (rng() % 4) {
+            case 0: sdb_set_unsigned(&sdb, 4, 300); break;          // too big for a u8
+            case 1: sdb_set_signed(&sdb, 4, -1); break;             // negative
+            case 2: {
+                uint8_t a[2] = { 1, 2 };
+                sdb_set_vala(&sdb, 4, SDB_U8, 2, a);                 // an array
+                break;
+            }
+            default: sdb_set_unsigned(&sdb, 4, i & 0xff); break;    // fits
+        }
+        for (sdb_id_t j=0; j<(rng() % 8); j++) sdb_set_unsigned(&sdb, 100 + j, rng());
+        log.insert(log.end(), buf, buf + sdb_size(&sdb));
+    }
+
+    std::vector<const uint8_t *> msgs(NMSGS);
+    std::vector<sdb_tlen_t> lens(NMSGS);
+    check(sdb_index_log(log.data(), log.size(), msgs.data(), lens.data(), NMSGS) == NMSGS, "index log");
+    // a message cut short at the end is left out
+    check(sdb_index_log(log.data(), log.size() - 1, msgs.data(), lens.data(), NMSGS) == NMSGS - 1, "short log");
+    check(sdb_index_log(log.data(), log.size(), msgs.data(), lens.data(), 10) == NMSGS, "count past max");
+
+    for (unsigned nthreads: { 1u, 3u, 8u, 0u }) {
+        std::vector<uint32_t> c1(NMSGS, 0xdead);
+        std::vector<int64_t> c2(NMSGS);
+        std::vector<float> c3(NMSGS);
+        std::vector<uint8_t> c4(NMSGS);
+        std::vector<int32_t> c3i(NMSGS);
+        std::vector<std::vector<uint8_t>> bits(5, std::vector<uint8_t>((NMSGS + 7) / 8, 0xff));
+        sdb_column_t cols[] = {
+            { 1, SDB_U32, c1.data(),  bits[0].data() },
+            { 2, SDB_S64, c2.data(),  bits[1].data() },
+            { 3, SDB_FLOAT, c3.data(), bits[2].data() },
+            { 4, SDB_U8, c4.data(),   bits[3].data() },
+            { 3, SDB_S32, c3i.data(), bits[4].data() },  // floats don't go into integers
+        };
+        check(sdb_project(msgs.data(), lens.data(), NMSGS, cols, 5, nthreads) == SDB_OK, "project");
+
+        for (size_t i=0; i<NMSGS; i++) {
+            sdb_t sdb;
+            sdb_init(&sdb, (void *)msgs[i], lens[i], false);
+            int8_t err = 0;
+            uint64_t v1 = sdb_get_unsigned(&sdb, 1, &err);
+            check(has(bits[0].data(), i) == !err, "column 1 presence");
+            check(c1[i] == (err ? 0 : v1), "column 1 value");
+            bool p2 = sdb_find(&sdb, 2).valid;
+            check(has(bits[1].data(), i) == p2, "column 2 presence");
+            check(c2[i] == (p2 ? -(int64_t)i * 1000 : 0), "column 2 value");
+            bool p3 = sdb_find(&sdb, 3).valid;
+            check(has(bits[2].data(), i) == p3, "column 3 presence");
+            check(c3[i] == (p3 ? (float)(i / 4.0) : 0), "column 3 value");
+            check(!has(bits[4].data(), i) && !c3i[i], "floats into integers");
+            auto mi = sdb_find(&sdb, 4);
+            bool fits = mi.valid && (mi.type == SDB_U8) && (mi.elemcount == 1);
+            check(has(bits[3].data(), i) == fits, "column 4 presence");
+            check(c4[i] == (fits ? (i & 0xff) : 0), "column 4 value");
+        }
+    }
+
+    uint32_t v;
+    uint8_t b;
+    sdb_column_t blob_col = { 1, SDB_BLOB, &v, &b };
+    check(sdb_project(msgs.data(), lens.data(), NMSGS, &blob_col, 1, 1) == -SDB_BAD_HANDLE, "blob columns");
+    check(sdb_project(msgs.data(), lens.data(), 0, &blob_col, 0, 4) == SDB_OK, "nothing to do");
+    std::vector<sdb_column_t> many(SDB_COL_MAX_COLS + 1, { 1, SDB_U32, &v, &b });
+    check(sdb_project(msgs.data(), lens.data(), 1, many.data(), many.size(), 1) == -SDB_ITEM_TOO_BIG, "too many columns");
+
+    // doubles too big for a float are left out, but not infinities
+    uint8_t fbufs[3][64];
+    const double fds[3] = { 1e300, -INFINITY, 2.5 };
+    const uint8_t *fmsgs[3];
+    sdb_tlen_t flens[3];
+    for (int i=0; i<3; i++) {
+        sdb_t sdb;
+        sdb_init(&sdb, fbufs[i], sizeof(fbufs[i]), true);
+        sdb_set_val(&sdb, 1, SDB_DOUBLE, &fds[i]);
+        fmsgs[i] = fbufs[i];
+        flens[i] = sdb_size(&sdb);
+    }
+    float fv[3];
+    uint8_t fb = 0;
+    sdb_column_t fcol = { 1, SDB_FLOAT, fv, &fb };
+    check(sdb_project(fmsgs, flens, 3, &fcol, 1, 1) == SDB_OK, "project floats");
+    check((fb == 6) && !fv[0] && (fv[1] == -INFINITY) && (fv[2] == 2.5f), "doubles out of float range");
+
+    if (errors) {
+        printf("FAIL.  (%s) There were %u errors\n", argv[0], errors);
+        return errors;
+    }
+    printf("PASS!  (%s) Yay!\n", argv[0]);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <random>
+#include <string>
+
+#include "sdbuf.h"
+#include "sdb_json.h"
+
+// sdb_to_json, and above all its floats, which should read back as the
+// same value with no more digits than printf needs to do the same.
+
+static uint32_t errors = 0;
+
+static void check(bool ok, const char *msg) {
+    if (!ok && (errors++ < 10)) printf("err: %s\n", msg);
+}
+
+static std::string json_of(const sdb_t *sdb, uint8_t flags = 0) {
+    char out[4096];
+    size_t n = 0;
+    int8_t err = sdb_to_json(sdb, out, sizeof(out), &n, flags);
+    if (err) return "error " + std::to_string(err);
+    check(n == strlen(out), "written is the length");
+    return out;
+}
+
+static std::string json_of_double(double d) {
+    uint8_t buf[64];
+    sdb_t sdb;
+    sdb_init(&sdb, buf, sizeof(buf), true);
+    sdb_set_val(&sdb, 1, SDB_DOUBLE, &d);
+    std::string s = json_of(&sdb);
+    return s.substr(5, s.size() - 6);  // just the value out of {"1":...}
+}
+
+static std::string json_of_float(float f) {
+    uint8_t buf[64];
+    sdb_t sdb;
+    sdb_init(&sdb, buf, sizeof(buf), true);
+    sdb_set_val(&sdb, 1, SDB_FLOAT, &f);
+    std::string s = json_of(&sdb);
+    return s.substr(5, s.size() - 6);
+}
+
+// not counting zeros at either end, which printf's %g drops too
+static size_t sig_digits(const std::string &s) {
+    std::string digits;
+    for (char c: s) {
+        if ((c == 'e') || (c == 'E')) break;
+        if ((c >= '0') && (c <= '9')) digits += c;
+    }
+    size_t first = digits.find_first_not_of('0');
+    if (first == std::string::npos) return 1;
+    return digits.find_last_not_of('0') - first + 1;
+}
+
+static size_t fewest_digits(double d, int most) {
+    char tmp[320];
+    for (int p=1; p<most; p++) {
+        snprintf(tmp, sizeof(tmp), "%.*g", p, d);
+        if (strtod(tmp, NULL) == d) return p;
+    }
+    return most;
+}
+
+static std::string json_of_half(uint16_t h) {
+    uint8_t buf[64];
+    sdb_t sdb;
+    sdb_init(&sdb, buf, sizeof(buf), true);
+    sdb_set_val(&sdb, 1, SDB_HALF, &h);
+    std::string s = json_of(&sdb);
+    return s.substr(5, s.size() - 6);
+}
+
+static size_t fewest_digits(float f, int most) {
+    char tmp[320];
+    for (int p=1; p<most; p++) {
+        snprintf(tmp, sizeof(tmp), "%.*g", p, f);
+        if (strtof(tmp, NULL) == f) return p;
+    }
+    return most;
+}
+
+static void check_double(double d) {
+    std::string s = json_of_double(d);
+    double back = strtod(s.c_str(), NULL);
+    if (back != d) {
+        printf("double %.17g came out as %s\n", d, s.c_str());
+        check(false, "double round trip");
+        return;
+    }
+    // whole numbers are written out in full
+    if ((fabs(d) < 9007199254740992.0) && (d == floor(d))) return;
+    if (sig_digits(s) > fewest_digits(d, 17)) {
+        printf("double %.17g came out as %s\n", d, s.c_str());
+        check(false, "double digits");
+    }
+}
+
+static void check_float(float f) {
+    std::string s = json_of_float(f);
+    float back = strtof(s.c_str(), NULL);
+    if (back != f) {
+        printf("float %.9g came out as %s\n", f, s.c_str());
+        check(false, "float round trip");
+        return;
+    }
+    if (f == floorf(f)) return;
+    if (sig_digits(s) > fewest_digits(f, 9)) {
+        printf("float %.9g came out as %s\n", f, s.c_str());
+        check(false, "float digits");
+    }
+}
+
+// halves are few enough to try every one
+static void check_halves() {
+    char tmp[32];
+    for (uint32_t h=0; h<0x10000; h++) {
+        std::string s = json_of_half(h);
+        if ((h & 0x7c00) == 0x7c00) {
+            check(s == "null", "half nan or infinity");
+            continue;
+        }
+        float f = sdb_half_to_float(h);
+        if (sdb_float_to_half(strtof(s.c_str(), NULL)) != h) {
+            printf("half %04x came out as %s\n", h, s.c_str());
+            check(false, "half round trip");
+            continue;
+        }
+        if (f == floorf(f)) continue;
+        size_t fewest = 5;
+        for (int p=1; p<5; p++) {
+            snprintf(tmp, sizeof(tmp), "%.*g", p, f);
+            if (sdb_float_to_half(strtof(tmp, NULL)) == h) {
+                fewest = p;
+                break;
+            }
+        }
+        if (sig_digits(s) > fewest) {
+            printf("half %04x came out as %s\n", h, s.c_str());
+            check(false, "half digits");
+        }
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    uint8_t buf[1024];
+    sdb_t sdb;
+    sdb_init(&sdb, buf, sizeof(buf), true);
+    check(json_of(&sdb) == "{}", "empty");
+
+    sdb_set_unsigned(&sdb, 1, 5);
+    sdb_set_signed(&sdb, 2, -300);
+    sdb_set_unsigned(&sdb, 3, UINT64_MAX);
+    sdb_set_signed(&sdb, 4, INT64_MIN);
+    uint16_t a[3] = { 1, 20, 300 };
+    sdb_set_vala(&sdb, 5, SDB_U16, 3, a);
+    sdb_set_vala(&sdb, 6, SDB_U16, 0, a);
+    sdb_add_blob(&sdb, 7, (const uint8_t *)"hello", 5);
+    sdb_add_blob(&sdb, 8, (const uint8_t *)"", 0);
+    check(json_of(&sdb) ==
+          "{\"1\":5,\"2\":-300,\"3\":18446744073709551615,\"4\":-9223372036854775808,"
+          "\"5\":[1,20,300],\"6\":[],\"7\":\"aGVsbG8=\",\"8\":\"\"}", "scalars, arrays and blobs");
+    check(json_of(&sdb, SDB_JSON_HEX).find("\"7\":\"68656c6c6f\"") != std::string::npos, "hex blob");
+
+    // a message inside a blob, when asked for
+    uint8_t ibuf[64];
+    sdb_t inner;
+    sdb_init(&inner, ibuf, sizeof(ibuf), true);
+    sdb_set_unsigned(&inner, 9, 42);
+    sdb_t outer;
+    uint8_t obuf[128];
+    sdb_init(&outer, obuf, sizeof(obuf), true);
+    sdb_add_blob(&outer, 1, ibuf, sdb_size(&inner));
+    check(json_of(&outer, SDB_JSON_NESTED) == "{\"1\":{\"9\":42}}", "nested");
+    check(json_of(&outer).substr(0, 6) == "{\"1\":\"", "not nested unless asked");
+
+    // too small says how much would have been needed
+    char small[8];
+    size_t n = 0;
+    check(sdb_to_json(&sdb, small, sizeof(small), &n, 0) == -SDB_BUFFER_TOO_SMALL, "too small");
+    check((n == json_of(&sdb).size()) && (strlen(small) == sizeof(small) - 1), "too small length");
+
+    // records that run off the end are refused, not read
+    uint8_t bad[64];
+    memcpy(bad, buf, sizeof(bad));
+    sdb_t sbad;
+    sdb_init(&sbad, bad, sizeof(bad), false);
+    check(json_of(&sbad) == "error " + std::to_string(-SDB_SCAN_ERROR), "truncated");
+
+    // the same spellings Python uses
+    check(json_of_double(0.0) == "0.0", "zero");
+    check(json_of_double(-0.0) == "-0.0", "negative zero");
+    check(json_of_double(1.5) == "1.5", "one and a half");
+    check(json_of_double(-2.0) == "-2.0", "minus two");
+    check(json_of_double(0.1) == "0.1", "a tenth");
+    check(json_of_double(0.3) == "0.3", "three tenths");
+    check(json_of_double(0.1 + 0.2) == "0.30000000000000004", "not three tenths");
+    check(json_of_double(1e100) == "1e+100", "googol");
+    check(json_of_double(1.5e-7) == "1.5e-07", "small");
+    check(json_of_double(0.0001) == "0.0001", "not yet small");
+    check(json_of_double(5e-324) == "5e-324", "least");
+    check(json_of_double(1.7976931348623157e308) == "1.7976931348623157e+308", "most");
+    check(json_of_double(1e16) == "1e+16", "big whole");
+    check(json_of_double(123456789012345.6) == "123456789012345.6", "big fraction");
+    check(json_of_double(NAN) == "null", "nan");
+    check(json_of_double(-INFINITY) == "null", "infinity");
+    check(json_of_float(0.1f) == "0.1", "float tenth");
+    check(json_of_float(3.4028235e38f) == "3.4028235e+38", "float most");
+    check(json_of_float(1e-45f) == "1e-45", "float least");
+    check(json_of_float(123456792.0f) == "123456792.0", "float whole");
+    check(json_of_half(0x2e66) == "0.1", "half tenth");
+    check(json_of_half(0x7bff) == "65504.0", "half most");
+    check(json_of_half(0x0001) == "6e-08", "half least");
+    check_halves();
+
+    std::mt19937_64 rng(11);
+    for (int i=0; i<20000; i++) {
+        uint64_t bits = rng();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        if (isfinite(d)) check_double(d);
+        uint32_t fbits = (uint32_t)bits;
+        float f;
+        memcpy(&f, &fbits, sizeof(f));
+        if (isfinite(f)) check_float(f);
+        // and values nearer the ones people use
+        check_double((double)(int64_t)(rng() % 2000001 - 1000000) / 1000.0);
+        check_float((float)(rng() % 100000) / 100.0f);
+    }
+
+    if (errors) {
+        printf("FAIL.  (%s) There were %u errors\n", argv[0], errors);
+        return errors;
+    }
+    printf("PASS!  (%s) Yay!\n", argv[0]);
+    return 0;
+}
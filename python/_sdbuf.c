@@ -0,0 +1,378 @@
+// Optional native speedups for sdbuf.py, built on c/sdbuf.c. sdbuf.py
+// works the same without it; see setup.py to build it.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "sdbuf.h"
+#include "sdb_json.h"
+
+// the same names sdbuf.py uses, in sdbtypes_t order
+static const char *type_names[] = {
+    "s8", "s16", "s32", "s64", "u8", "u16", "u32", "u64",
+    "float", "double", "blob", "half",
+};
+#define NTYPES ((int)(sizeof(type_names) / sizeof(type_names[0])))
+
+static const uint8_t type_sizes[] = { 1, 2, 4, 8, 1, 2, 4, 8, 4, 8, 0, 2 };
+
+static PyObject *type_name_objs[NTYPES];
+static PyObject *str_type, *str_value, *str_val_bytes;
+
+static PyObject *decode_one(sdbtypes_t type, const uint8_t *p) {
+    switch (type) {
+        case SDB_S8:  { int8_t v;   memcpy(&v, p, 1); return PyLong_FromLong(v); }
+        case SDB_S16: { int16_t v;  memcpy(&v, p, 2); return PyLong_FromLong(v); }
+        case SDB_S32: { int32_t v;  memcpy(&v, p, 4); return PyLong_FromLong(v); }
+        case SDB_S64: { int64_t v;  memcpy(&v, p, 8); return PyLong_FromLongLong(v); }
+        case SDB_U8:  { uint8_t v;  memcpy(&v, p, 1); return PyLong_FromUnsignedLong(v); }
+        case SDB_U16: { uint16_t v; memcpy(&v, p, 2); return PyLong_FromUnsignedLong(v); }
+        case SDB_U32: { uint32_t v; memcpy(&v, p, 4); return PyLong_FromUnsignedLong(v); }
+        case SDB_U64: { uint64_t v; memcpy(&v, p, 8); return PyLong_FromUnsignedLongLong(v); }
+        case SDB_FLOAT:  { float v;  memcpy(&v, p, 4); return PyFloat_FromDouble(v); }
+        case SDB_DOUBLE: { double v; memcpy(&v, p, 8); return PyFloat_FromDouble(v); }
+        case SDB_HALF:   { uint16_t v; memcpy(&v, p, 2); return PyFloat_FromDouble(sdb_half_to_float(v)); }
+        default: Py_RETURN_NONE;
+    }
+}
+
+// whether every record from p to pend, header and data, lies inside
+// it. sdb_iter reads headers without looking, so this goes first.
+static int records_fit(const uint8_t *p, const uint8_t *pend) {
+    while (p < pend) {
+        // id and type, then a blob size and an array count if it has them
+        if (pend - p < 3) return 0;
+        uint8_t type = p[2] & 0x7f;
+        int is_array = p[2] & 0x80;
+        if (type >= NTYPES) return 0;
+        Py_ssize_t hsize = 3 + ((type == SDB_BLOB) ? 2 : 0) + (is_array ? 2 : 0);
+        if (pend - p < hsize) return 0;
+        uint16_t size = type_sizes[type];
+        uint16_t count = 1;
+        if (type == SDB_BLOB) memcpy(&size, p + 3, 2);
+        if (is_array) memcpy(&count, p + hsize - 2, 2);
+        if (pend - p - hsize < (Py_ssize_t)count * size) return 0;
+        p += hsize + (Py_ssize_t)count * size;
+    }
+    return 1;
+}
+
+// the same dict that sdb.__scan builds
+static PyObject *scan(PyObject *self, PyObject *arg) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0) return NULL;
+
+    sdb_t sdb;
+    PyObject *rv = NULL;
+    if ((sdb_init(&sdb, view.buf, view.len, false) != SDB_OK) ||
+        (5 + (Py_ssize_t)sdb.vals_size > view.len)) {
+        PyErr_SetString(PyExc_ValueError, "incompatible bytestring");
+        goto done;
+    }
+
+    const uint8_t *pvals = (const uint8_t *)view.buf + 5;
+    if (!records_fit(pvals, pvals + sdb.vals_size)) {
+        PyErr_SetString(PyExc_ValueError, "bad record");
+        goto done;
+    }
+
+    rv = PyDict_New();
+    if (!rv) goto done;
+    for (sdb_member_info_t mi = sdb_iter(&sdb, NULL); mi.valid; mi = sdb_iter(&sdb, &mi)) {
+        sdb_len_t count = mi.elemcount;
+        sdb_len_t size = mi.elemsize;
+        PyObject *values = PyList_New(count);
+        PyObject *raw = PyList_New(count);
+        PyObject *key = PyLong_FromUnsignedLong(mi.id);
+        PyObject *entry = PyDict_New();
+        if (!values || !raw || !key || !entry) goto fail_entry;
+        for (sdb_len_t i=0; i<count; i++) {
+            const uint8_t *p = mi.data + (size_t)i * size;
+            PyObject *v = decode_one(mi.type, p);
+            PyObject *b = PyBytes_FromStringAndSize((const char *)p, size);
+            if (!v || !b) {
+                Py_XDECREF(v);
+                Py_XDECREF(b);
+                goto fail_entry;
+            }
+            PyList_SET_ITEM(values, i, v);
+            PyList_SET_ITEM(raw, i, b);
+        }
+        if ((PyDict_SetItem(entry, str_type, type_name_objs[mi.type]) < 0) ||
+            (PyDict_SetItem(entry, str_value, values) < 0) ||
+            (PyDict_SetItem(entry, str_val_bytes, raw) < 0) ||
+            (PyDict_SetItem(rv, key, entry) < 0)) {
+            goto fail_entry;
+        }
+        Py_DECREF(values);
+        Py_DECREF(raw);
+        Py_DECREF(key);
+        Py_DECREF(entry);
+        continue;
+    fail_entry:
+        Py_XDECREF(values);
+        Py_XDECREF(raw);
+        Py_XDECREF(key);
+        Py_XDECREF(entry);
+        goto fail;
+    }
+    goto done;
+
+fail:
+    Py_CLEAR(rv);
+done:
+    PyBuffer_Release(&view);
+    return rv;
+}
+
+static int type_index(PyObject *name) {
+    for (int i=0; i<NTYPES; i++) {
+        if (PyUnicode_CompareWithASCIIString(name, type_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// write one value the way int.to_bytes and struct.pack would, with the
+// same complaint when it doesn't fit
+static int encode_one(sdbtypes_t type, PyObject *v, uint8_t *p) {
+    if ((type == SDB_FLOAT) || (type == SDB_DOUBLE) || (type == SDB_HALF)) {
+        double d = PyFloat_AsDouble(v);
+        if ((d == -1.0) && PyErr_Occurred()) return -1;
+        if (type == SDB_DOUBLE) {
+            memcpy(p, &d, 8);
+        } else if (type == SDB_HALF) {
+            if (isfinite(d) && (fabs(d) >= 65520.0)) {
+                PyErr_SetString(PyExc_OverflowError, "float too large to pack with e format");
+                return -1;
+            }
+            // through a float rounded to odd, so that it is only rounded
+            // once, as struct does it
+            float f = (float)d;
+            if (!isnan(d) && ((double)f != d)) {
+                uint32_t b;
+                memcpy(&b, &f, 4);
+                if (fabs((double)f) > fabs(d)) b--;
+                b |= 1;
+                memcpy(&f, &b, 4);
+            }
+            uint16_t h = sdb_float_to_half(f);
+            memcpy(p, &h, 2);
+        } else {
+            // struct rounds first and only then checks; short of rounding
+            // up to infinity, that is FLT_MAX
+            if (isfinite(d) && (fabs(d) >= 0x1.ffffffp127)) {
+                PyErr_SetString(PyExc_OverflowError, "float too large to pack with f format");
+                return -1;
+            }
+            float f = (float)d;
+            if (isfinite(d) && (fabs(d) > FLT_MAX)) f = (d > 0) ? FLT_MAX : -FLT_MAX;
+            memcpy(p, &f, 4);
+        }
+        return 0;
+    }
+    if (!PyLong_Check(v)) {
+        PyErr_SetString(PyExc_TypeError, "integer expected");
+        return -1;
+    }
+    if (sdb_is_signed(type)) {
+        long long s = PyLong_AsLongLong(v);
+        if ((s == -1) && PyErr_Occurred()) return -1;
+        int bits = 8 * type_sizes[type];
+        if ((bits < 64) && ((s < -(1LL << (bits - 1))) || (s >= (1LL << (bits - 1))))) {
+            PyErr_SetString(PyExc_OverflowError, "int too big to convert");
+            return -1;
+        }
+        memcpy(p, &s, type_sizes[type]);
+    } else {
+        unsigned long long u = PyLong_AsUnsignedLongLong(v);
+        if ((u == (unsigned long long)-1) && PyErr_Occurred()) return -1;
+        int bits = 8 * type_sizes[type];
+        if ((bits < 64) && (u >> bits)) {
+            PyErr_SetString(PyExc_OverflowError, "int too big to convert");
+            return -1;
+        }
+        memcpy(p, &u, type_sizes[type]);
+    }
+    return 0;
+}
+
+// encode(items, directory) where items is a sequence of (key, entry)
+// with entries as in sdb.vals. Raises NotImplementedError for what only
+// sdbuf.py can encode, such as arrays of blobs.
+static PyObject *encode(PyObject *self, PyObject *args) {
+    PyObject *items;
+    int directory = 0;
+    if (!PyArg_ParseTuple(args, "O|p", &items, &directory)) return NULL;
+    PyObject *seq = PySequence_Fast(items, "items must be a sequence");
+    if (!seq) return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+
+    PyObject *rv = NULL;
+    sdb_field_t *fields = PyMem_Calloc(n ? n : 1, sizeof(sdb_field_t));
+    uint8_t **datas = PyMem_Calloc(n ? n : 1, sizeof(uint8_t *));
+    if (!fields || !datas) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (Py_ssize_t i=0; i<n; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *key, *entry;
+        if (!PyArg_ParseTuple(item, "OO", &key, &entry)) goto done;
+        unsigned long id = PyLong_AsUnsignedLong(key);
+        if (PyErr_Occurred()) goto done;
+        if (id > 0xffff) {
+            PyErr_SetString(PyExc_OverflowError, "id out of range");
+            goto done;
+        }
+        PyObject *tname = PyDict_GetItemWithError(entry, str_type);
+        if (!tname) {
+            if (!PyErr_Occurred()) PyErr_SetString(PyExc_KeyError, "type");
+            goto done;
+        }
+        int type = type_index(tname);
+        if (type < 0) {
+            PyErr_SetString(PyExc_NotImplementedError, "type");
+            goto done;
+        }
+        fields[i].id = (sdb_id_t)id;
+        fields[i].type = (sdbtypes_t)type;
+
+        if (type == SDB_BLOB) {
+            PyObject *raw = PyDict_GetItemWithError(entry, str_val_bytes);
+            if (!raw || !PyList_Check(raw) || (PyList_GET_SIZE(raw) != 1)) {
+                if (!PyErr_Occurred()) PyErr_SetString(PyExc_NotImplementedError, "blob arrays");
+                goto done;
+            }
+            Py_buffer view;
+            if (PyObject_GetBuffer(PyList_GET_ITEM(raw, 0), &view, PyBUF_SIMPLE) < 0) goto done;
+            if (view.len > 0xffff) {
+                PyBuffer_Release(&view);
+                PyErr_SetString(PyExc_OverflowError, "blob too big");
+                goto done;
+            }
+            datas[i] = PyMem_Malloc(view.len ? view.len : 1);
+            if (datas[i]) memcpy(datas[i], view.buf, view.len);
+            fields[i].count = (sdb_len_t)view.len;
+            PyBuffer_Release(&view);
+            if (!datas[i]) {
+                PyErr_NoMemory();
+                goto done;
+            }
+        } else {
+            PyObject *values = PyDict_GetItemWithError(entry, str_value);
+            if (!values) {
+                if (!PyErr_Occurred()) PyErr_SetString(PyExc_KeyError, "value");
+                goto done;
+            }
+            PyObject *vseq = PySequence_Fast(values, "value must be a list");
+            if (!vseq) goto done;
+            Py_ssize_t count = PySequence_Fast_GET_SIZE(vseq);
+            if (count > 0xffff) {
+                Py_DECREF(vseq);
+                PyErr_SetString(PyExc_OverflowError, "array too long");
+                goto done;
+            }
+            datas[i] = PyMem_Malloc(count ? count * type_sizes[type] : 1);
+            if (!datas[i]) {
+                Py_DECREF(vseq);
+                PyErr_NoMemory();
+                goto done;
+            }
+            for (Py_ssize_t j=0; j<count; j++) {
+                if (encode_one(type, PySequence_Fast_GET_ITEM(vseq, j), datas[i] + j * type_sizes[type]) < 0) {
+                    Py_DECREF(vseq);
+                    goto done;
+                }
+            }
+            Py_DECREF(vseq);
+            fields[i].count = (sdb_len_t)count;
+        }
+        fields[i].data = datas[i];
+    }
+
+    sdb_tlen_t size = sdb_measure(fields, n);
+    if (directory) size += 5 + 6 * n;
+    rv = PyByteArray_FromStringAndSize(NULL, size);
+    if (!rv) goto done;
+    sdb_t sdb;
+    sdb_init(&sdb, PyByteArray_AS_STRING(rv), size, true);
+    int8_t err = sdb_set_many(&sdb, fields, n);
+    if ((err == SDB_OK) && directory) err = sdb_add_directory(&sdb);
+    if (err != SDB_OK) {
+        PyErr_Format(PyExc_ValueError, "could not encode (%d)", err);
+        Py_CLEAR(rv);
+    }
+
+done:
+    for (Py_ssize_t i=0; datas && (i<n); i++) PyMem_Free(datas[i]);
+    PyMem_Free(datas);
+    PyMem_Free(fields);
+    Py_DECREF(seq);
+    return rv;
+}
+
+// to_json(buf, flags) with flags as for sdb_to_json
+static PyObject *to_json(PyObject *self, PyObject *args) {
+    Py_buffer view;
+    unsigned char flags = 0;
+    if (!PyArg_ParseTuple(args, "y*|b", &view, &flags)) return NULL;
+
+    sdb_t sdb;
+    PyObject *rv = NULL;
+    if ((sdb_init(&sdb, view.buf, view.len, false) != SDB_OK) ||
+        (5 + (Py_ssize_t)sdb.vals_size > view.len)) {
+        PyErr_SetString(PyExc_ValueError, "incompatible bytestring");
+        goto done;
+    }
+
+    // most messages fit on the stack; the rest get what they need
+    char small[4096];
+    char *out = small;
+    size_t n = 0;
+    int8_t err = sdb_to_json(&sdb, out, sizeof(small), &n, flags);
+    if (err == -SDB_BUFFER_TOO_SMALL) {
+        out = PyMem_Malloc(n + 1);
+        if (!out) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        err = sdb_to_json(&sdb, out, n + 1, &n, flags);
+    }
+    if (err == SDB_OK) {
+        rv = PyUnicode_DecodeASCII(out, n, NULL);
+    } else {
+        PyErr_SetString(PyExc_ValueError, "bad record");
+    }
+    if (out != small) PyMem_Free(out);
+
+done:
+    PyBuffer_Release(&view);
+    return rv;
+}
+
+static PyMethodDef methods[] = {
+    { "scan",   scan,   METH_O,       "decode a message into a dict like sdb.vals" },
+    { "encode", encode, METH_VARARGS, "encode (key, entry) pairs into a message" },
+    { "to_json", to_json, METH_VARARGS, "a message as JSON, as sdb_to_json writes it" },
+    { NULL, NULL, 0, NULL },
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "_sdbuf", "native speedups for sdbuf.py", -1, methods,
+};
+
+PyMODINIT_FUNC PyInit__sdbuf(void) {
+    for (int i=0; i<NTYPES; i++) {
+        type_name_objs[i] = PyUnicode_InternFromString(type_names[i]);
+        if (!type_name_objs[i]) return NULL;
+    }
+    str_type = PyUnicode_InternFromString("type");
+    str_value = PyUnicode_InternFromString("value");
+    str_val_bytes = PyUnicode_InternFromString("val_bytes");
+    if (!str_type || !str_value || !str_val_bytes) return NULL;
+    return PyModule_Create(&module);
+}
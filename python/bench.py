@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+# Timings for sdbuf.py, in the same shapes as c/bench.cpp, with and
+# without the native module if it is built. With --json, results come
+# out as one JSON object per line.
+
+import argparse
+import json
+import timeit
+
+import sdbuf
+
+def make_dict(fields, array, blob):
+    d = {}
+    for i in range(fields):
+        if blob and i % 4 == 3:
+            d[i] = bytes([0xa5]) * blob
+        elif array > 1:
+            d[i] = [ (i * 7919 + j) & 0xffffffff for j in range(array) ]
+        else:
+            d[i] = (i * 7919) & 0xffffffff
+    return d
+
+def ns_per_op(fn, ops = 1):
+    # run it for long enough to trust, like the C benchmarks
+    t = timeit.Timer(fn)
+    reps, secs = t.autorange()
+    return secs * 1e9 / (reps * ops)
+
+def report(args, impl, bench, fields, array, blob, size, ns):
+    if args.json:
+        print(json.dumps({
+            'impl': impl, 'bench': bench, 'fields': fields, 'array': array, 'blob': blob,
+            'size': size, 'ns_per_op': round(ns, 1),
+        }))
+    else:
+        print('{:6s} {:16s} {:6d} {:6d} {:6d} {:8d} {:12.1f}'.format(impl, bench, fields, array, blob, size, ns))
+
+def main():
+    parser = argparse.ArgumentParser(description='time sdbuf.py')
+    parser.add_argument('--json', action='store_true', help='one JSON object per result')
+    args = parser.parse_args()
+
+    if not args.json:
+        print('{:6s} {:16s} {:>6s} {:>6s} {:>6s} {:>8s} {:>12s}'.format('impl', 'bench', 'fields', 'array', 'blob', 'size', 'ns/op'))
+    impls = { 'pure': None }
+    if sdbuf._sdbuf is not None:
+        impls['native'] = sdbuf._sdbuf
+    for impl, module in impls.items():
+        sdbuf._sdbuf = module
+        for fields in (8, 64, 512):
+            for array in (1, 16):
+                for blob in (0, 256):
+                    d = make_dict(fields, array, blob)
+                    b = bytes(sdbuf.dict_to_sdb(d))
+                    shape = (fields, array, blob, len(b))
+                    report(args, impl, 'encode', *shape, ns_per_op(lambda: sdbuf.dict_to_sdb(d)))
+                    report(args, impl, 'decode', *shape, ns_per_op(lambda: sdbuf.sdb_to_dict(b)))
+                    report(args, impl, 'lazy_open_get1', *shape, ns_per_op(lambda: sdbuf.sdb(b, lazy=True).find(fields // 2)))
+                    report(args, impl, 'json_dumps', *shape,
+                        ns_per_op(lambda: json.dumps(sdbuf.sdb_to_dict(b), cls=sdbuf.BytesEncoder)))
+                    report(args, impl, 'to_json', *shape, ns_per_op(lambda: sdbuf.sdb_to_json(b)))
+                    s = sdbuf.sdb(b)
+                    report(args, impl, 'find', *shape, ns_per_op(lambda: [ s.find(i) for i in range(fields) ], fields))
+                    report(args, impl, 'find_in_bytes', *shape,
+                        ns_per_op(lambda: [ sdbuf.sdb.findIn(b, i) for i in range(0, fields, 8) ], len(range(0, fields, 8))))
+
+if __name__ == '__main__':
+    main()
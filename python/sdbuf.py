@@ -1,8 +1,18 @@
 #!/usr/bin/env python3
 
+import array
+import mmap
 import struct
+from collections.abc import MutableMapping
 from sys import byteorder
 
+# the native module, if it has been built (see setup.py), does the
+# same work as __scan and toBytes, only faster
+try:
+    import _sdbuf
+except ImportError:
+    _sdbuf = None
+
 class SDBException(Exception):
     pass
 
@@ -18,7 +28,13 @@ class sdb:
         'HD_SIZE'  :  1,
         'VS_SIZE'  :  4,
         'HD_OFFSET':  0, 
-        'MAX_ID':     0xffff
+        'MAX_ID':     0xffff,
+        'ID_RESERVED':   0xfff0,
+        'ID_TOMBSTONES': 0xfff0,
+        'ID_DIRECTORY':  0xfff1,
+        'ID_PAD':        0xfff2,
+        'HDR_DIRECTORY': 0x02,
+        'DIR_ENTRY_SIZE': 6,
     }
     constants['VS_OFFSET'] = (
         constants['HD_OFFSET'] +
@@ -44,12 +60,13 @@ class sdb:
        's64':     { 'idx': 3,  'size': 8, 'signed': True,   'range': (-9_223_372_036_854_775_808, 9_223_372_036_854_775_807)}, 
        'u8':      { 'idx': 4,  'size': 1, 'signed': False,  'range': (0, 255) }, 
        'u16':     { 'idx': 5,  'size': 2, 'signed': False,  'range': (0, 65535) }, 
-       'u32':     { 'idx': 6,  'size': 4, 'signed': False,  'range': (0, 4_2954_967_295) }, 
+       'u32':     { 'idx': 6,  'size': 4, 'signed': False,  'range': (0, 4_294_967_295) }, 
        'u64':     { 'idx': 7,  'size': 8, 'signed': False,  'range': (0, 18_446_744_073_709_551_615) }, 
        'float':   { 'idx': 8,  'size': 4 }, 
        'double':  { 'idx': 9,  'size': 8 }, 
        'blob':    { 'idx': 10, 'size': 0 },
-       '_inv':    { 'idx': 11, 'size': 0 },
+       'half':    { 'idx': 11, 'size': 2 },
+       '_inv':    { 'idx': 12, 'size': 0 },
     }
 
     type_names = [ x for x in types ]
@@ -65,7 +82,11 @@ class sdb:
 
 
 
-    def __init__(self, input: bytes|bytearray|str|dict|None):
+    # with lazy=True, opening a message only notes where each record is,
+    # over a memoryview of the input (or of the file, mapped), and each
+    # value is decoded the first time it is asked for. Arrays come back
+    # as views of the buffer rather than lists.
+    def __init__(self, input: bytes|bytearray|memoryview|str|dict|None, lazy = False):
         self.buf = bytearray()
         self.vals = {}
 
@@ -76,13 +97,16 @@ class sdb:
         elif isinstance(input, str):
             try:
                 with open(input, "rb") as ifh:
-                    self.buf = ifh.read()
+                    if lazy:
+                        self.buf = memoryview(mmap.mmap(ifh.fileno(), 0, access=mmap.ACCESS_READ))
+                    else:
+                        self.buf = ifh.read()
             except Exception as e:
                 raise SDBException(e)
-            self.__scan()
-        elif isinstance(input, (bytes, bytearray)):
-            self.buf = input;
-            self.__scan()
+            self.__scan(lazy)
+        elif isinstance(input, (bytes, bytearray, memoryview)):
+            self.buf = memoryview(input) if lazy else input
+            self.__scan(lazy)
        
 
     # takes a scalar thing or a list of things of the same type
@@ -115,7 +139,8 @@ class sdb:
         if not isinstance(vbytes,list):
             vbytes = [vbytes]
         self.vals[name] = {
-            'type': self.types['blob']['idx'],
+            'type': 'blob',
+            'value': [ None for x in vbytes ],
             'val_bytes': vbytes,
         }
 
@@ -128,7 +153,7 @@ class sdb:
             is_blob   = i[1]['type'] == 'blob'
             src = 'val_bytes' if is_blob else 'value'
             ov  = i[1][src]
-            is_scalar = isinstance(ov,(list,tuple)) and len(ov) <= 1
+            is_scalar = isinstance(ov,(list,tuple,memoryview,array.array)) and len(ov) == 1
             if is_scalar:
                 ov  = ov[0]
             rv[i[0]] = ov
@@ -139,7 +164,10 @@ class sdb:
             v = i[1]
             k = i[0]
             t = self.__guessType(v)
-            self.setVal(k, t, v)
+            if t == 'blob':
+                self.setBlob(k, v)
+            else:
+                self.setVal(k, t, v)
 
     def __guessType(self, vs):
         if not isinstance(vs, (list,tuple)):
@@ -148,12 +176,12 @@ class sdb:
         is_signed = False
         max_size  = 1
         for v in vs:
-            if v < 0:
-                is_signed = True
             if isinstance(v, float):
                 return 'double'
             if isinstance(v, (bytes, bytearray)):
                 return 'blob'
+            if v < 0:
+                is_signed = True
 
         if not all((isinstance(e,int) for e in vs)):
             raise SDBException(f'Cannot infer type of {vs}')
@@ -187,67 +215,84 @@ class sdb:
                 )
 
     def saveToFile(self,fn):
-        obytes = self.toBytes()
         try:
             with open(fn, 'wb') as ofh:
-                ofh.write(obytes)
+                self.writeTo(ofh)
         except Exception as e:
             raise SDBException(e)
 
-    def toBytes(self):
-        self.buf = bytearray()
-        self.buf += bytes(self.constants['V_OFFSET'])
-        for key in self.vals:
-            val = self.vals[key]
-            self.buf += struct.pack('H',key)
-            dcount = len(val['value'])
-            outtype = self.types[val['type']]['idx']
-            if dcount != 1:
-                outtype |= self.type_array_flag
-
-            self.buf += outtype.to_bytes(
-                self.constants['TYPE_SIZE'],
-                signed=False,
-                byteorder='little'
-            )
-
-
-            if val['type'] == 'blob':
-                self.buf += len(val['val_bytes'][0]).to_bytes(
-                    self.constants['SIZE_SIZE'],
-                    signed=False,
-                    byteorder='little'
-                )
-            if dcount != 1:
-                self.buf += dcount.to_bytes(
-                    self.constants['COUNT_SIZE'],
-                    signed=False,
-                    byteorder='little'
-                )
-
-            for didx in range(dcount):
-                if val['type'] == 'blob':
-                    self.buf += val['val_bytes'][didx]
-                elif val['type'] == 'float':
-                    self.buf += struct.pack('f',val['value'][didx])
-                elif val['type'] == 'double':
-                    self.buf += struct.pack('d',val['value'][didx])
-                else:
-                    self.buf += val['value'][didx].to_bytes(
-                        self.types[val['type']]['size'],
-                        signed=self.types[val['type']]['signed'],
-                        byteorder='little')
-
-        self.__byteAssign('HD_OFFSET','HD_SIZE',self.constants['ID_VAL'])
-        self.__byteAssign('VS_OFFSET','VS_SIZE',len(self.buf) - self.constants['V_OFFSET'])
+    # with directory=True the message starts with a table of where each
+    # record is, so that a reader can binary search for an id. Ids listed
+    # in priority go first, in that order, so that readers that scan
+    # find them sooner.
+    def toBytes(self, directory = False, priority = None):
+        order = self.__order(priority)
+        if _sdbuf is not None:
+            try:
+                self.buf = _sdbuf.encode([ (k, self.vals[k]) for k in order ], directory)
+                return self.buf
+            except NotImplementedError:
+                # something only the code below can write, like an array of blobs
+                pass
+
+        plan, vals_size = self.__plan(order)
+        head = self.__head(plan, vals_size, directory)
+        self.buf = bytearray(len(head) + vals_size)
+        self.buf[:len(head)] = head
+        idx = len(head)
+        for rec in plan:
+            idx = self.__packRecord(self.buf, idx, *rec)
         return self.buf
 
+    # the same bytes as toBytes, written to fh a record at a time rather
+    # than built in memory first
+    def writeTo(self, fh, directory = False, priority = None):
+        plan, vals_size = self.__plan(self.__order(priority))
+        fh.write(self.__head(plan, vals_size, directory))
+        scratch = bytearray(max((rec[2] for rec in plan), default = 0))
+        view = memoryview(scratch)
+        for rec in plan:
+            fh.write(view[:self.__packRecord(scratch, 0, *rec)])
+
     def find(self,key):
          rv = self.vals.get(key,None)
          if rv is not None:
              return rv['value']
          return None
 
+    # look up one id straight from the bytes without decoding the rest,
+    # through the directory if there is one
+    @classmethod
+    def findIn(cls, b: bytes|bytearray, key):
+        s = cls(None)
+        s.buf = b
+        s.__getSizes()
+        s.__checkHeader()
+        vstart = s.constants['V_OFFSET']
+        vend = vstart + s.vals_size
+        if s.header & s.constants['HDR_DIRECTORY']:
+            dkey, dval, _ = s.__record(vstart)
+            if dkey == s.constants['ID_DIRECTORY']:
+                entries = dval['val_bytes'][0]
+                lo, hi = 0, len(entries) // s.constants['DIR_ENTRY_SIZE']
+                while lo < hi:
+                    mid = (lo + hi) // 2
+                    ekey, offset = struct.unpack_from('<HI', entries, mid * s.constants['DIR_ENTRY_SIZE'])
+                    if ekey < key:
+                        lo = mid + 1
+                    elif ekey > key:
+                        hi = mid
+                    else:
+                        _, val, _ = s.__record(vstart + offset)
+                        return val['value']
+                return None
+        idx = vstart
+        while idx < vend:
+            rkey, val, idx = s.__record(idx)
+            if rkey == key:
+                return val['value']
+        return None
+
     # ----------------------------------------------------------
     ### end API
     # ----------------------------------------------------------
@@ -267,57 +312,108 @@ class sdb:
                     ],
         )
 
-    def __scan(self):
-        self.__getSizes();
+    def __checkHeader(self):
         if (self.header & (0x7 << 3)) != (self.constants['ID_VAL'] & (0x7 << 3)):
             raise SDBException('incompatible bytestring')
+
+    # decode the record at idx, returning its key, its value and where
+    # the next record starts
+    def __record(self, idx):
+        key, = struct.unpack('H', self.buf[idx:idx+self.constants['KEY_SIZE']])
+        idx += self.constants['KEY_SIZE']
+        type_idx = self.__bytesToInt(self.buf[idx:idx+self.constants['TYPE_SIZE']])
+        is_arry = type_idx & self.type_array_flag
+        type_idx &= ~self.type_array_flag
+
+        type_name = self.type_names[type_idx]
+        idx += self.constants['TYPE_SIZE']
+        if type_name == 'blob':
+            dsize = self.__bytesToInt(self.buf[idx:idx+self.constants['SIZE_SIZE']])
+            idx += self.constants['SIZE_SIZE']
+        else:
+            dsize = self.types[type_name]['size']
+
+        dcount = 1
+        if is_arry:
+            dcount = self.__bytesToInt(self.buf[idx:idx+self.constants['COUNT_SIZE']])
+            idx += self.constants['COUNT_SIZE']
+
+        data_vals = []
+        data_bytes = []
+        datum_val = None
+        for didx in range(dcount):
+            datum_bytes = self.buf[idx:idx+dsize] 
+            if type_name == 'blob':
+                datum_val = None
+            elif type_name == 'float':
+                temp0 = struct.unpack('f',datum_bytes)
+                datum_val = temp0[0] 
+            elif type_name == 'double':
+                temp1 = struct.unpack('d',datum_bytes)
+                datum_val = temp1[0] 
+            elif type_name == 'half':
+                datum_val, = struct.unpack('<e',datum_bytes)
+            else:
+                datum_val = self.__bytesToInt(datum_bytes,self.types[type_name]['signed'])
+            data_vals.append(datum_val)
+            data_bytes.append(datum_bytes)
+            idx += dsize
+
+        return key, {
+            'type': type_name or None,
+            'value': data_vals,
+            'val_bytes': data_bytes,
+        }, idx
+
+    def __scan(self, lazy = False):
+        self.__getSizes();
+        self.__checkHeader()
+        if lazy:
+            self.vals = _LazyVals(self.buf, self.__index())
+            return
+        if _sdbuf is not None:
+            try:
+                self.vals = _sdbuf.scan(self.buf)
+            except ValueError as e:
+                raise SDBException(e)
+            return
         idx = self.constants['V_OFFSET'];
         rv = {};
         while idx < self.vals_size + self.constants['V_OFFSET']:
-            key, = struct.unpack('H', self.buf[idx:idx+self.constants['KEY_SIZE']])
-            idx += self.constants['KEY_SIZE']
-            type_idx = self.__bytesToInt(self.buf[idx:idx+self.constants['TYPE_SIZE']])
+            key, val, idx = self.__record(idx)
+            # the directory and padding are only about the layout
+            if key in (self.constants['ID_DIRECTORY'], self.constants['ID_PAD']):
+                continue
+            rv[key] = val
+        self.vals = rv;
+
+    # where each record's payload is, without decoding any of it
+    def __index(self):
+        idx = self.constants['V_OFFSET']
+        end = idx + self.vals_size
+        if end > len(self.buf):
+            raise SDBException('truncated bytestring')
+        skip = (self.constants['ID_DIRECTORY'], self.constants['ID_PAD'])
+        blob_idx = self.types['blob']['idx']
+        rv = {}
+        while idx < end:
+            key, type_idx = struct.unpack_from('<HB', self.buf, idx)
+            idx += 3
             is_arry = type_idx & self.type_array_flag
             type_idx &= ~self.type_array_flag
-
-            type_name = self.type_names[type_idx]
-            idx += self.constants['TYPE_SIZE']
-            if type_name == 'blob':
-                dsize = self.__bytesToInt(self.buf[idx:idx+self.constants['SIZE_SIZE']])
-                idx += self.constants['SIZE_SIZE']
+            if type_idx == blob_idx:
+                dsize, = struct.unpack_from('<H', self.buf, idx)
+                idx += 2
             else:
-                dsize = self.types[type_name]['size']
-
+                dsize = self.types[self.type_names[type_idx]]['size']
             dcount = 1
             if is_arry:
-                dcount = self.__bytesToInt(self.buf[idx:idx+self.constants['COUNT_SIZE']])
-                idx += self.constants['COUNT_SIZE']
-
-            data_vals = []
-            data_bytes = []
-            datum_val = None
-            for didx in range(dcount):
-                datum_bytes = self.buf[idx:idx+dsize] 
-                if type_name == 'blob':
-                    datum_val = None
-                elif type_name == 'float':
-                    temp0 = struct.unpack('f',datum_bytes)
-                    datum_val = temp0[0] 
-                elif type_name == 'double':
-                    temp1 = struct.unpack('d',datum_bytes)
-                    datum_val = temp1[0] 
-                else:
-                    datum_val = self.__bytesToInt(datum_bytes,self.types[type_name]['signed'])
-                data_vals.append(datum_val)
-                data_bytes.append(datum_bytes)
-                idx += dsize
-
-            rv[key] = {
-                'type': type_name or None,
-                'value': data_vals,
-                'val_bytes': data_bytes,
-            }
-        self.vals = rv;
+                dcount, = struct.unpack_from('<H', self.buf, idx)
+                idx += 2
+            if key not in skip:
+                rv[key] = (self.type_names[type_idx], dcount, dsize, idx)
+            idx += dcount * dsize
+        return rv
 
     def __chunks(self,l,n):
         for i in range(0, len(l), n):
@@ -330,11 +426,149 @@ class sdb:
         print("========")
 
         
-    def __byteAssign(self,offset,size,value):
-        self.buf[self.constants[offset] :
-                 self.constants[offset] + self.constants[size]
-                ] = value.to_bytes(self.constants[size],signed=False,byteorder='little')
+    def __order(self, priority):
+        order = list(self.vals)
+        if priority:
+            hot = dict.fromkeys(k for k in priority if k in self.vals)
+            order = list(hot) + [ k for k in order if k not in hot ]
+        return order
+
+    # how every record will be written, and how big they all are, before
+    # any of them is. Each entry is (key, val, size, type byte, struct,
+    # blob size), where the struct packs all of a fixed size record, or
+    # just the head of a blob.
+    def __plan(self, order):
+        plan = []
+        total = 0
+        types = self.types
+        for key in order:
+            val = self.vals[key]
+            dcount = len(val['value'])
+            outtype = types[val['type']]['idx']
+            if dcount != 1:
+                outtype |= self.type_array_flag
+            if val['type'] == 'blob':
+                st = _blob_head if dcount == 1 else _blob_array_head
+                bsize = len(val['val_bytes'][0]) if dcount else 0
+                rsize = st.size + dcount * bsize
+            else:
+                st = _record_struct(val['type'], dcount)
+                bsize = None
+                rsize = st.size
+            plan.append((key, val, rsize, outtype, st, bsize))
+            total += rsize
+        return plan, total
+
+    # the header, and the directory if there is to be one
+    def __head(self, plan, vals_size, directory):
+        header = self.constants['ID_VAL']
+        d = b''
+        if directory:
+            dsize = self.constants['DIR_ENTRY_SIZE'] * len(plan)
+            dhead = _blob_head.size
+            d = bytearray(dhead + dsize)
+            _blob_head.pack_into(d, 0, self.constants['ID_DIRECTORY'], self.types['blob']['idx'], dsize)
+            offsets = []
+            offset = dhead + dsize
+            for rec in plan:
+                offsets.append((rec[0], offset))
+                offset += rec[2]
+            for i, (key, offset) in enumerate(sorted(offsets)):
+                _dir_entry.pack_into(d, dhead + i * self.constants['DIR_ENTRY_SIZE'], key, offset)
+            header |= self.constants['HDR_DIRECTORY']
+            vals_size += len(d)
+        return _msg_head.pack(header, vals_size) + d
+
+    # write one planned record into b at idx, and return where it ends
+    def __packRecord(self, b, idx, key, val, rsize, outtype, st, bsize):
+        dcount = len(val['value'])
+        if bsize is not None:
+            if dcount != 1:
+                st.pack_into(b, idx, key, outtype, bsize, dcount)
+            else:
+                st.pack_into(b, idx, key, outtype, bsize)
+            idx += st.size
+            for vb in val['val_bytes']:
+                b[idx:idx + bsize] = vb
+                idx += bsize
+            return idx
+        try:
+            if dcount != 1:
+                st.pack_into(b, idx, key, outtype, dcount, *val['value'])
+            else:
+                st.pack_into(b, idx, key, outtype, val['value'][0])
+        except struct.error as e:
+            # the same complaint as the native module's
+            raise OverflowError(e)
+        return idx + rsize
+
+
+# the struct/array codes for each fixed size type
+_formats = {
+    's8': 'b', 's16': 'h', 's32': 'i', 's64': 'q',
+    'u8': 'B', 'u16': 'H', 'u32': 'I', 'u64': 'Q',
+    'float': 'f', 'double': 'd', 'half': 'e',
+}
+
+_msg_head        = struct.Struct('<BI')
+_blob_head       = struct.Struct('<HBH')
+_blob_array_head = struct.Struct('<HBHH')
+_dir_entry       = struct.Struct('<HI')
+
+# a whole record of a fixed size type, head and all, packs with one call
+_record_structs = {}
+def _record_struct(type_name, count):
+    st = _record_structs.get((type_name, count))
+    if st is None:
+        if count == 1:
+            st = struct.Struct('<HB' + _formats[type_name])
+        else:
+            st = struct.Struct('<HBH{}{}'.format(count, _formats[type_name]))
+        if len(_record_structs) < 1024:
+            _record_structs[(type_name, count)] = st
+    return st
+
+# sdb.vals for a lazy sdb: the same mapping, but each entry is only
+# decoded when it is first looked at
+class _LazyVals(MutableMapping):
+    def __init__(self, buf, index):
+        self.buf = buf
+        self.entries = index
+
+    def __decode(self, type_name, count, size, off):
+        data = self.buf[off:off + count * size]
+        raw = [ data[i * size:(i + 1) * size] for i in range(count) ]
+        if type_name == 'blob':
+            return { 'type': type_name, 'value': [ None ] * count, 'val_bytes': raw }
+        fmt = _formats[type_name]
+        if type_name == 'half':
+            # neither memoryview nor array take halves
+            return { 'type': type_name, 'value': list(struct.unpack('<%de' % count, data)), 'val_bytes': raw }
+        if byteorder == 'little':
+            value = data.cast(fmt)
+        else:
+            value = array.array(fmt, data)
+            value.byteswap()
+        return { 'type': type_name, 'value': value, 'val_bytes': raw }
+
+    def __getitem__(self, key):
+        e = self.entries[key]
+        if isinstance(e, tuple):
+            e = self.__decode(*e)
+            self.entries[key] = e
+        return e
+
+    def __setitem__(self, key, value):
+        self.entries[key] = value
+
+    def __delitem__(self, key):
+        del self.entries[key]
 
+    def __iter__(self):
+        return iter(self.entries)
+
+    def __len__(self):
+        return len(self.entries)
 
 def sdb_to_dict(b: bytes|bytearray) -> dict:
     return sdb(b).asDict()
@@ -342,8 +576,49 @@ def sdb_to_dict(b: bytes|bytearray) -> dict:
 def dict_to_sdb(d: dict) -> bytes:
     return sdb(d).toBytes()
 
-import json
+# the id for a field name, the same as sdb_name_id in C and SDB_NAME in C++
+def name_id(name: str) -> int:
+    h = 2166136261
+    for c in name.encode():
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return ((h >> 16) ^ (h & 0xffff)) % sdb.constants['ID_RESERVED']
+
+# what is new or changed in new compared to old, plus a list of the ids
+# that have gone away. Apply it with sdb_patch.
+def sdb_diff(old: bytes|bytearray, new: bytes|bytearray) -> bytes:
+    o = sdb(old)
+    n = sdb(new)
+    reserved = sdb.constants['ID_RESERVED']
+    d = sdb(None)
+    for k, v in n.vals.items():
+        if k >= reserved:
+            continue
+        ov = o.vals.get(k)
+        if ov is None or ov['type'] != v['type'] or ov['val_bytes'] != v['val_bytes']:
+            d.vals[k] = v
+    gone = [ k for k in o.vals if k < reserved and k not in n.vals ]
+    if gone:
+        d.setVal(sdb.constants['ID_TOMBSTONES'], 'u16', gone)
+    return d.toBytes()
+
+def sdb_patch(base: bytes|bytearray, patch: bytes|bytearray) -> bytes:
+    b = sdb(base)
+    p = sdb(patch)
+    reserved = sdb.constants['ID_RESERVED']
+    gone = p.vals.get(sdb.constants['ID_TOMBSTONES'], {}).get('value', [])
+    out = sdb(None)
+    for k, v in b.vals.items():
+        if k < reserved and k not in p.vals and k not in gone:
+            out.vals[k] = v
+    for k, v in p.vals.items():
+        if k < reserved:
+            out.vals[k] = v
+    return out.toBytes()
+
+import base64
 import binascii
+import json
+import math
 
 class BytesEncoder(json.JSONEncoder):
     def default(self, obj):
@@ -351,6 +626,76 @@ class BytesEncoder(json.JSONEncoder):
             return str(binascii.hexlify(obj),'ascii')
         return json.JSONEncoder.default(self, obj)
 
+# the fewest digits that make the same float32, as sdb_to_json writes it
+def _short_float32(v):
+    # whole numbers are written out in full
+    if v == int(v) and abs(v) < 2**31:
+        return v
+    f32 = struct.Struct('<f')
+    want = f32.pack(v)
+    for p in range(1, 10):
+        s = float('%.*g' % (p, v))
+        try:
+            if f32.pack(s) == want:
+                return s
+        except OverflowError:
+            # struct won't round to the largest float32, as C does
+            pass
+    return v
+
+# and the same for halves
+def _short_float16(v):
+    if v == int(v):
+        return v
+    want = struct.pack('<e', v)
+    for p in range(1, 6):
+        s = float('%.*g' % (p, v))
+        try:
+            if struct.pack('<e', s) == want:
+                return s
+        except OverflowError:
+            pass
+    return v
+
+# a message as compact JSON: keys are the ids, blobs are base64 (or hex)
+# strings, or with nested, objects if they hold whole messages. NaNs and
+# infinities are null. The native module does the same much faster.
+def sdb_to_json(b: bytes|bytearray, nested: bool = False, hex: bool = False) -> str:
+    if _sdbuf is not None and hasattr(_sdbuf, 'to_json'):
+        try:
+            return _sdbuf.to_json(b, (1 if nested else 0) | (2 if hex else 0))
+        except ValueError as e:
+            raise SDBException(e)
+    return json.dumps(_json_ready(sdb(b), nested, hex, 0), separators=(',', ':'))
+
+_JSON_MAX_DEPTH = 8
+
+def _json_blob(v, nested, hex, depth):
+    if nested and depth < _JSON_MAX_DEPTH and len(v) >= sdb.constants['V_OFFSET']:
+        try:
+            inner = sdb(v)
+            if sdb.constants['V_OFFSET'] + inner.vals_size == len(v):
+                return _json_ready(inner, nested, hex, depth + 1)
+        except (SDBException, struct.error, IndexError, KeyError, ValueError):
+            pass
+    return binascii.hexlify(v).decode('ascii') if hex else base64.b64encode(v).decode('ascii')
+
+def _json_ready(s, nested, hex, depth):
+    rv = {}
+    for k, e in s.vals.items():
+        if e['type'] == 'blob':
+            vs = [ _json_blob(bytes(v), nested, hex, depth) for v in e['val_bytes'] ]
+        else:
+            vs = list(e['value'])
+            if e['type'] in ('float', 'double', 'half'):
+                vs = [ None if math.isnan(v) or math.isinf(v) else v for v in vs ]
+            if e['type'] == 'float':
+                vs = [ v if v is None else _short_float32(v) for v in vs ]
+            if e['type'] == 'half':
+                vs = [ v if v is None else _short_float16(v) for v in vs ]
+        rv[k] = vs[0] if len(vs) == 1 else vs
+    return rv
+
 if __name__ == '__main__':
 
     import argparse
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+
+# Builds the optional native module that sdbuf.py uses when it can:
+#
+#   python3 setup.py build_ext --inplace
+
+from setuptools import setup, Extension
+
+setup(
+    name='sdbuf',
+    version='2.0',
+    py_modules=['sdbuf'],
+    ext_modules=[
+        Extension(
+            '_sdbuf',
+            sources=['_sdbuf.c', '../c/sdbuf.c', '../c/sdb_json.c'],
+            include_dirs=['../c'],
+            extra_compile_args=['-O2'],
+            optional=True,
+        ),
+    ],
+)
@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 
+import base64
 import binascii
 import json
 
@@ -39,6 +40,67 @@ if __name__ == '__main__':
     }
     print(sdbuf.sdb_to_dict(sdbuf.dict_to_sdb(d)))
 
+    e = dict(d)
+    e[2] = 222
+    e[11] = bytes([1,2,3])
+    del e[5]
+    del e[6]
+    old_bytes = sdbuf.dict_to_sdb(d)
+    new_bytes = sdbuf.dict_to_sdb(e)
+    patch = sdbuf.sdb_diff(old_bytes, new_bytes)
+    print('patch', binascii.hexlify(patch))
+    assert sdbuf.sdb_to_dict(patch) == { 2: 222, 11: bytes([1,2,3]), 0xfff0: [5, 6] }
+    assert sdbuf.sdb_to_dict(sdbuf.sdb_patch(old_bytes, patch)) == e
+    assert len(sdbuf.sdb_diff(new_bytes, new_bytes)) == 5
 
 
 
+
+
+    indexed = sdbuf.sdb(e).toBytes(directory=True)
+    assert sdbuf.sdb_to_dict(indexed) == e
+    for k, v in e.items():
+        found = sdbuf.sdb.findIn(indexed, k)
+        assert found == sdbuf.sdb.findIn(new_bytes, k)
+        assert found == (v if isinstance(v, list) else [None] if isinstance(v, bytes) else [v])
+    assert sdbuf.sdb.findIn(indexed, 12) is None
+
+    hot_first = sdbuf.sdb(e).toBytes(priority=[11, 3, 3, 99])
+    assert sdbuf.sdb_to_dict(hot_first) == e
+    assert list(sdbuf.sdb(hot_first).vals)[:3] == [11, 3, 1]
+
+    lazy = sdbuf.sdb(bytes(indexed), lazy=True)
+    assert len(lazy.vals) == len(e)
+    assert list(lazy.find(10)) == [ 10, -100, 1000 ]
+    assert bytes(lazy.asDict()[11]) == bytes([1,2,3])
+    lazy.setVal(12, 'u8', [1])
+    del lazy.vals[1]
+    assert sdbuf.sdb_to_dict(lazy.toBytes()) == { **{ k: v for k, v in e.items() if k != 1 }, 12: 1 }
+    for inname in ['t0','t1','t2','t3','t5','t6']:
+        a = sdbuf.sdb('../c/' + inname + '.dat')
+        b = sdbuf.sdb('../c/' + inname + '.dat', lazy=True)
+        assert bytes(b.toBytes()) == bytes(a.toBytes())
+
+    import io
+    for kw in ({}, { 'directory': True }, { 'priority': [11, 3] }):
+        streamed = io.BytesIO()
+        sdbuf.sdb(e).writeTo(streamed, **kw)
+        assert streamed.getvalue() == bytes(sdbuf.sdb(e).toBytes(**kw))
+
+    j = sdbuf.sdb_to_json(new_bytes)
+    assert json.loads(j) == { str(k): base64.b64encode(v).decode() if isinstance(v, bytes) else v for k, v in e.items() }
+    outer = sdbuf.dict_to_sdb({ 1: bytes(new_bytes), 2: 0.5 })
+    assert json.loads(sdbuf.sdb_to_json(outer, nested=True)) == { '1': json.loads(j), '2': 0.5 }
+    assert json.loads(sdbuf.sdb_to_json(outer, hex=True))['1'] == binascii.hexlify(new_bytes).decode()
+
+    assert sdbuf.name_id('speed') == 48128
+    assert sdbuf.name_id('field33') == sdbuf.name_id('field274')
+
+    halves = sdbuf.sdb(None)
+    halves.setVal(1, 'half', [ 0.1, -2.5, 65504.0, float('inf') ])
+    halves.setVal(2, 'half', 1.0 / 3)
+    hb = bytes(halves.toBytes())
+    assert hb[5:9] == bytes([1, 0, 0x80 | 11, 4])
+    assert list(sdbuf.sdb(hb).vals[1]['value']) == [ 0.0999755859375, -2.5, 65504.0, float('inf') ]
+    assert list(sdbuf.sdb(hb, lazy=True).vals[2]['value']) == [ 0.333251953125 ]
+    assert sdbuf.sdb_to_json(hb) == '{"1":[0.1,-2.5,65504.0,null],"2":0.3333}'
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+
+# the native module has to agree with sdbuf.py about everything
+
+import random
+import sys
+
+import sdbuf
+
+native = sdbuf._sdbuf
+if native is None:
+    print('_sdbuf is not built; nothing to compare')
+    sys.exit(0)
+
+def both(fn):
+    sdbuf._sdbuf = None
+    try:
+        pure = fn()
+    finally:
+        sdbuf._sdbuf = native
+    return pure, fn()
+
+def random_sdb(rng):
+    s = sdbuf.sdb(None)
+    for i in range(rng.randrange(0, 40)):
+        key = rng.randrange(0, 0xfff0)
+        t = rng.choice([ t for t in sdbuf.sdb.types if t != '_inv' ])
+        count = rng.choice([1, 1, 0, 3, 17])
+        if t == 'blob':
+            n = rng.randrange(0, 300)
+            s.setBlob(key, bytes(rng.randrange(256) for _ in range(n)))
+        elif t == 'float':
+            s.setVal(key, t, [ float(rng.randrange(-1000, 1000)) / 4 for _ in range(count) ])
+        elif t == 'double':
+            s.setVal(key, t, [ rng.random() * 1e10 for _ in range(count) ])
+        elif t == 'half':
+            s.setVal(key, t, [ rng.uniform(-1e3, 1e3) for _ in range(count) ])
+        else:
+            lo, hi = sdbuf.sdb.types[t]['range']
+            hi = min(hi, 2**64 - 1)
+            s.setVal(key, t, [ rng.randint(lo, hi) for _ in range(count) ])
+    return s
+
+rng = random.Random(1)
+for i in range(200):
+    s = random_sdb(rng)
+    directory = bool(i & 1)
+    pure, fast = both(lambda: bytes(s.toBytes(directory=directory)))
+    assert pure == fast, i
+    pure_vals, fast_vals = both(lambda: sdbuf.sdb(fast).vals)
+    assert pure_vals == fast_vals, i
+    pure_dict, fast_dict = both(lambda: sdbuf.sdb_to_dict(fast))
+    assert pure_dict == fast_dict, i
+
+    for nested, hex in ((False, False), (True, True)):
+        pure_json, fast_json = both(lambda: sdbuf.sdb_to_json(fast, nested, hex))
+        assert pure_json == fast_json, (i, pure_json, fast_json)
+
+# JSON for messages inside messages, and floats of every sort
+s = sdbuf.sdb(None)
+s.setVal(1, 'double', [ rng.uniform(-1e6, 1e6) for _ in range(200) ] + [ 1e300, 5e-324, 1e16, 0.1, float('nan') ])
+s.setVal(2, 'float', [ rng.uniform(-1e3, 1e3) for _ in range(200) ] + [ 3.4028234e38, 1e-45, 123456792.0, float('-inf') ])
+# halves from doubles are rounded once, not through a float first
+s.setVal(5, 'half', [ rng.uniform(-6e4, 6e4) for _ in range(200) ] + [ 0.1, 65504.0, 6e-8, 1 + 2**-11 + 2**-40, float('nan') ])
+s.setBlob(3, bytes(random_sdb(rng).toBytes()))
+inner = bytes(random_sdb(rng).toBytes())
+s.setBlob(4, [ inner, bytes(len(inner)) ])
+for nested in (False, True):
+    pure_json, fast_json = both(lambda: sdbuf.sdb_to_json(bytes(s.toBytes()), nested))
+    assert pure_json == fast_json, (pure_json, fast_json)
+pure, fast = both(lambda: bytes(s.toBytes()))
+assert pure == fast
+
+# things only sdbuf.py can write still come out the same
+s = sdbuf.sdb(None)
+s.setBlob(1, [ bytes([1, 2]), bytes([3, 4]) ])
+pure, fast = both(lambda: bytes(s.toBytes()))
+assert pure == fast
+
+# and the same complaints
+for bad in ( (1, 'u8', 256), (2, 's8', -129), (3, 'u16', -1), (4, 'half', 65520.0), (5, 'float', 3.5e38) ):
+    for impl in (None, native):
+        sdbuf._sdbuf = impl
+        s = sdbuf.sdb(None)
+        s.setVal(*bad)
+        try:
+            s.toBytes()
+            assert False, bad
+        except OverflowError:
+            pass
+    sdbuf._sdbuf = native
+
+# just short of rounding up to infinity still packs, as FLT_MAX
+for v in (3.4028235e38, 3.4028235677973362e38, float('inf')):
+    s = sdbuf.sdb(None)
+    s.setVal(1, 'float', v)
+    pure, fast = both(lambda: bytes(s.toBytes()))
+    assert pure == fast, v
+
+# a record header that runs off the end is not read
+s = sdbuf.sdb(None)
+s.setBlob(1, bytes([1, 2, 3]))
+b = bytes(s.toBytes())
+for short in (b[:1] + (2).to_bytes(4, 'little') + b[5:7], b[:1] + (4).to_bytes(4, 'little') + b[5:9]):
+    try:
+        native.scan(short)
+        assert False, short
+    except ValueError:
+        pass
+
+try:
+    sdbuf.sdb(bytes([0x38, 0, 0, 0, 0]))
+    assert False
+except sdbuf.SDBException:
+    pass
+
+print('native and pure agree')